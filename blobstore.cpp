@@ -0,0 +1,196 @@
+#include <filesystem>
+
+#include "blobstore.h"
+#include "disksegment.h"
+#include "partitionedsegment.h"
+#include "diskio.h"
+#include "compactionfilter.h"
+
+namespace fs = std::filesystem;
+
+ByteBuffer& BlobRef::encode(ByteBuffer& buffer) const {
+    buffer.ensureCapacity(maxEncodedLength);
+    int n = writeVarint(buffer,file.lower);
+    n += writeVarint(buffer+n,file.upper);
+    n += writeVarint(buffer+n,offset);
+    n += writeVarint(buffer+n,length);
+    buffer.length = n;
+    return buffer;
+}
+
+BlobRef BlobRef::decode(const Slice& buffer) {
+    uint64_t lower,upper,offset,length;
+    int n = readVarint(buffer,buffer.length,&lower);
+    n += readVarint(buffer+n,buffer.length-n,&upper);
+    n += readVarint(buffer+n,buffer.length-n,&offset);
+    n += readVarint(buffer+n,buffer.length-n,&length);
+    return BlobRef{.file = BlobFileID{.lower = lower, .upper = upper}, .offset = offset, .length = (uint32_t)length};
+}
+
+const std::vector<BlobUsage>& BlobStore::usage(const SegmentRef& segment) {
+    static const std::vector<BlobUsage> none;
+    if(auto ps = dynamic_cast<PartitionedSegment*>(segment.get())) return ps->getBlobUsage();
+    auto ds = dynamic_cast<DiskSegment*>(segment.get());
+    return ds==nullptr ? none : ds->getBlobUsage();
+}
+
+std::shared_ptr<MemoryMappedFile> BlobStore::open(const BlobFileID& id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto itr = files.find(id);
+    if(itr!=files.end()) return itr->second;
+    auto file = std::make_shared<MemoryMappedFile>(path(id));
+    files[id] = file;
+    return file;
+}
+
+ByteBuffer& BlobStore::read(const BlobRef& ref,ByteBuffer& value) {
+    auto file = open(ref.file);
+    if(ref.offset+ref.length > file->length()) throw IllegalState("blob reference beyond end of file");
+    value.ensureCapacity(ref.length);
+    file->readAt(value,ref.offset,ref.length);
+    value.length = ref.length;
+    return value;
+}
+
+bool BlobStore::expired(const BlobRef& ref,int ttlSeconds,uint64_t now) {
+    if(ref.length < writeTimeLength) return false;
+    ByteBuffer time(writeTimeLength);
+    read(BlobRef{.file = ref.file, .offset = ref.offset+ref.length-writeTimeLength, .length = writeTimeLength},time);
+    return isExpired(time,ttlSeconds,now);
+}
+
+void BlobStore::open(const std::vector<SegmentRef>& segments) {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::set<BlobFileID> referenced;
+    for(auto& s : segments) {
+        for(auto& u : usage(s)) referenced.insert(u.file);
+    }
+    for(auto file : fs::directory_iterator(dbpath)) {
+        auto name = file.path().filename().string();
+        if(!name.starts_with("blob.")) continue;
+        auto ids = getSegmentIDs(name);
+        BlobFileID id{.lower = ids.lower, .upper = ids.upper};
+        if(referenced.contains(id)) {
+            live[id] = fs::file_size(file.path());
+        } else {
+            fs::remove(file.path());
+        }
+    }
+}
+
+void BlobStore::installed(const SegmentRef& segment) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for(auto& u : usage(segment)) {
+        if(!live.contains(u.file)) live[u.file] = fs::file_size(path(u.file));
+        obsolete.erase(u.file);
+    }
+}
+
+void BlobStore::acquire(const std::vector<BlobUsage>& usage) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for(auto& u : usage) references[u.file]++;
+}
+
+void BlobStore::release(const std::vector<BlobUsage>& usage) {
+    std::vector<BlobFileID> removable;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for(auto& u : usage) {
+            if(--references[u.file] > 0) continue;
+            references.erase(u.file);
+            if(obsolete.erase(u.file)) removable.push_back(u.file);
+        }
+    }
+    remove(removable);
+}
+
+void BlobStore::remove(const std::vector<BlobFileID>& ids) {
+    if(ids.empty() || !deleter) return;
+    std::vector<std::string> filenames;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for(auto& id : ids) {
+            files.erase(id);
+            filenames.push_back(filename(id));
+        }
+    }
+    deleter->remove(filenames);
+}
+
+std::map<BlobFileID,double> BlobStore::garbageRatios(const std::vector<SegmentRef>& segments) {
+    std::map<BlobFileID,uint64_t> referenced;
+    for(auto& s : segments) {
+        for(auto& u : usage(s)) referenced[u.file] += u.bytes;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    std::map<BlobFileID,double> ratios;
+    for(auto [id,size] : live) {
+        if(size==0) continue;
+        ratios[id] = 1.0 - std::min(1.0,referenced[id] / (double)size);
+    }
+    return ratios;
+}
+
+std::vector<std::string> BlobStore::unreferenced(const std::vector<SegmentRef>& segments) {
+    std::set<BlobFileID> referenced;
+    for(auto& s : segments) {
+        for(auto& u : usage(s)) referenced.insert(u.file);
+    }
+    std::vector<std::string> filenames;
+    std::vector<BlobFileID> removable;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for(auto itr = live.begin(); itr != live.end();) {
+            if(referenced.contains(itr->first)) {
+                itr++;
+                continue;
+            }
+            filenames.push_back(filename(itr->first));
+            // the file remains mapped while the segments of a snapshot may read it
+            if(references.contains(itr->first)) {
+                obsolete.insert(itr->first);
+            } else {
+                removable.push_back(itr->first);
+            }
+            itr = live.erase(itr);
+        }
+    }
+    remove(removable);
+    return filenames;
+}
+
+bool BlobWriter::separate(const Slice& in,bool isRef,ByteBuffer& ref) {
+    Slice value = in;
+    if(isRef) {
+        auto blob = BlobRef::decode(in);
+        if(!relocate.contains(blob.file)) {
+            usage[blob.file] += blob.length;
+            ref = in;
+            return true;
+        }
+        value = store->read(blob,this->value);
+    } else if(threshold <= 0 || value.length <= threshold) {
+        return false;
+    }
+    if(!file.is_open()) {
+        file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        file.open(store->path(id),std::fstream::out | std::fstream::trunc | std::fstream::binary);
+    }
+    file.write((const char*)(uint8_t*)value,value.length);
+    BlobRef{.file = id, .offset = offset, .length = (uint32_t)value.length}.encode(ref);
+    offset += value.length;
+    usage[id] += value.length;
+    return true;
+}
+
+std::vector<BlobUsage> BlobWriter::finish() {
+    if(file.is_open()) {
+        file.flush();
+        file.close();
+    }
+    std::vector<BlobUsage> result;
+    for(auto [file,bytes] : usage) {
+        result.push_back(BlobUsage{.file = file, .bytes = bytes});
+    }
+    return result;
+}
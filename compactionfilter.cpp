@@ -0,0 +1,63 @@
+#include <chrono>
+
+#include "compactionfilter.h"
+#include "diskio.h"
+
+uint64_t currentWriteTime() {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+void appendWriteTime(ByteBuffer& stored,const Slice& value,uint64_t now) {
+    uint8_t time[writeTimeLength];
+    writeLEuint64(time,now);
+    stored = value;
+    stored.append(Slice(time,writeTimeLength));
+}
+
+static uint64_t writeTime(const Slice& stored) {
+    return readLEuint64(stored+(stored.length-writeTimeLength));
+}
+
+bool isExpired(const Slice& stored,int ttlSeconds,uint64_t now) {
+    if(stored.length < writeTimeLength) return false;
+    return writeTime(stored) + uint64_t(ttlSeconds)*1000 < now;
+}
+
+void removeWriteTime(ByteBuffer& value,int ttlSeconds,uint64_t now) {
+    if(value.length < writeTimeLength) return;
+    if(isExpired(value,ttlSeconds,now)) {
+        value.length = 0;
+    } else {
+        value.length -= writeTimeLength;
+    }
+}
+
+void applyCompactionFilter(const Options& options,uint64_t now,KeyValue& kv,ByteBuffer& newValue) {
+    if(kv.value.empty()) return;
+    bool ttl = options.ttlSeconds > 0 && kv.value.length >= writeTimeLength;
+    if(ttl && isExpired(kv.value,options.ttlSeconds,now)) {
+        kv.value.length = 0;
+        return;
+    }
+    if(!options.compactionFilter) return;
+
+    // the filter is passed the value without the write time, which is kept if the value changes
+    Slice value = ttl ? Slice(kv.value,kv.value.length-writeTimeLength) : Slice(kv.value);
+    switch(options.compactionFilter(kv.key,value,newValue)) {
+        case FilterDecision::keep:
+            break;
+        case FilterDecision::remove:
+            kv.value.length = 0;
+            break;
+        case FilterDecision::change:
+            if(newValue.empty()) {
+                kv.value.length = 0;
+            } else if(ttl) {
+                appendWriteTime(kv.value,newValue,writeTime(kv.value));
+            } else {
+                kv.value = newValue;
+            }
+            break;
+    }
+}
@@ -0,0 +1,66 @@
+#define BOOST_TEST_MODULE compactionfilter
+#include <boost/test/included/unit_test.hpp>
+
+#include "compactionfilter.h"
+
+BOOST_AUTO_TEST_CASE( compactionfilter_ttl ) {
+    uint64_t now = 1000000;
+    ByteBuffer stored;
+    appendWriteTime(stored,"myvalue",now);
+    BOOST_TEST(stored.length==7+writeTimeLength);
+
+    BOOST_TEST(!isExpired(stored,10,now));
+    BOOST_TEST(!isExpired(stored,10,now+10000));
+    BOOST_TEST(isExpired(stored,10,now+10001));
+
+    ByteBuffer value = stored;
+    removeWriteTime(value,10,now+5000);
+    BOOST_TEST(value=="myvalue");
+
+    value = stored;
+    removeWriteTime(value,10,now+20000);
+    BOOST_TEST(value.empty());
+
+    // deletions have no write time
+    value = ByteBuffer::EMPTY();
+    removeWriteTime(value,10,now);
+    BOOST_TEST(value.empty());
+}
+
+BOOST_AUTO_TEST_CASE( compactionfilter_apply ) {
+    Options options;
+    options.compactionFilter = [](const Slice& key,const Slice& value,ByteBuffer& newValue) {
+        if(std::string_view(key).starts_with("tmp")) return FilterDecision::remove;
+        if(std::string_view(value)=="old") {
+            newValue = Slice("new");
+            return FilterDecision::change;
+        }
+        return FilterDecision::keep;
+    };
+    ByteBuffer newValue;
+
+    KeyValue kv("tmpkey","value");
+    applyCompactionFilter(options,0,kv,newValue);
+    BOOST_TEST(kv.value.empty());
+
+    kv = KeyValue("mykey","old");
+    applyCompactionFilter(options,0,kv,newValue);
+    BOOST_TEST(kv.value=="new");
+
+    kv = KeyValue("mykey","value");
+    applyCompactionFilter(options,0,kv,newValue);
+    BOOST_TEST(kv.value=="value");
+
+    // with a ttl the filter is passed the value without the write time, and a changed value keeps it
+    options.ttlSeconds = 10;
+    ByteBuffer stored;
+    appendWriteTime(stored,"old",1000);
+    kv = KeyValue("mykey",stored);
+    applyCompactionFilter(options,2000,kv,newValue);
+    removeWriteTime(kv.value,10,2000);
+    BOOST_TEST(kv.value=="new");
+
+    kv = KeyValue("mykey",stored);
+    applyCompactionFilter(options,20000,kv,newValue);
+    BOOST_TEST(kv.value.empty());
+}
@@ -0,0 +1,73 @@
+#include <algorithm>
+
+#include "compactionpolicy.h"
+
+void CompactionPolicy::recordMerge(uint64_t input,uint64_t fresh,uint64_t output) {
+    merges++;
+    inputBytes += input;
+    freshBytes += fresh;
+    outputBytes += output;
+}
+
+CompactionStats CompactionPolicy::getStats() {
+    CompactionStats stats;
+    stats.merges = merges;
+    stats.inputBytes = inputBytes;
+    stats.freshBytes = freshBytes;
+    stats.outputBytes = outputBytes;
+    if(stats.freshBytes > 0) stats.writeAmplification = double(stats.outputBytes) / stats.freshBytes;
+    return stats;
+}
+
+std::vector<SegmentRun> SmallestFirstPolicy::selectRuns(const std::vector<uint64_t>& sizes,int maxSegments,int maxRuns) {
+    int n = sizes.size();
+    int maxMergeSize = std::max(n / 2, 4);
+
+    // each run starts at the smallest segment not already in a run, until enough segments are merged
+    std::vector<SegmentRun> runs;
+    std::vector<bool> used(n);
+    int excess = n - maxSegments;
+    while(runs.size() < maxRuns && excess > 0) {
+        int smallest = -1;
+        for(int i=0;i<n-1;i++) {
+            if(used[i]) continue;
+            if(smallest<0 || sizes[i] < sizes[smallest]) smallest = i;
+        }
+        if(smallest<0) break;
+        int last = smallest;
+        while(last+1 < n && !used[last+1] && last+1-smallest < maxMergeSize) last++;
+        for(int i=smallest;i<=last;i++) used[i] = true;
+        if(last==smallest) continue;
+        runs.push_back({smallest,last-smallest+1});
+        excess -= last-smallest;
+    }
+    return runs;
+}
+
+std::vector<SegmentRun> SizeRatioPolicy::selectRuns(const std::vector<uint64_t>& sizes,int maxSegments,int maxRuns) {
+    int n = sizes.size();
+
+    std::vector<SegmentRun> runs;
+    int excess = n - maxSegments;
+    int newest = n-1;
+    while(runs.size() < maxRuns && excess > 0 && newest > 0) {
+        int oldest = newest;
+        uint64_t total = sizes[newest];
+        while(oldest > 0 && newest-oldest+1 < maxMergeWidth && sizes[oldest-1]*100 <= total*(100+sizeRatio)) {
+            total += sizes[--oldest];
+        }
+        if(oldest==newest) {
+            newest--;
+            continue;
+        }
+        runs.push_back({oldest,newest-oldest+1});
+        excess -= newest-oldest;
+        newest = oldest-1;
+    }
+    if(runs.empty() && excess > 0) {
+        // the sizes grow too fast to form a run, so only reduce the number of segments
+        int count = std::min({excess+1,maxMergeWidth,n});
+        runs.push_back({n-count,count});
+    }
+    return runs;
+}
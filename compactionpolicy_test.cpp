@@ -0,0 +1,70 @@
+#define BOOST_TEST_MODULE compactionpolicy
+#include <boost/test/included/unit_test.hpp>
+
+#include "compactionpolicy.h"
+
+BOOST_AUTO_TEST_CASE( compactionpolicy_smallest_first ) {
+    SmallestFirstPolicy policy;
+    std::vector<uint64_t> sizes = {1000,10,20,30,40,50,60,70,80,90};
+
+    auto runs = policy.selectRuns(sizes,8,1);
+    BOOST_REQUIRE(runs.size()==1);
+    BOOST_TEST(runs[0].startAt==1);
+    BOOST_TEST(runs[0].count==5);
+
+    // a second run starts at the smallest segment not in the first
+    sizes = {10,20,30,40,50,60,70,80,90,100,110,120,130,140,150,160,170,180,190,200};
+    runs = policy.selectRuns(sizes,4,2);
+    BOOST_REQUIRE(runs.size()==2);
+    BOOST_TEST(runs[0].startAt==0);
+    BOOST_TEST(runs[0].count==10);
+    BOOST_TEST(runs[1].startAt==10);
+    BOOST_TEST(runs[1].count==10);
+}
+
+BOOST_AUTO_TEST_CASE( compactionpolicy_size_ratio ) {
+    SizeRatioPolicy policy(10,32);
+
+    // the large oldest segment is not rewritten to absorb the small ones
+    std::vector<uint64_t> sizes = {1000000,100,100,100,100,100,100,100,100,100};
+    auto runs = policy.selectRuns(sizes,8,1);
+    BOOST_REQUIRE(runs.size()==1);
+    BOOST_TEST(runs[0].startAt==1);
+    BOOST_TEST(runs[0].count==9);
+
+    // a run absorbs an older segment up to the ratio of its total size
+    sizes = {1000000,2000,1000,500,250,250};
+    runs = policy.selectRuns(sizes,4,1);
+    BOOST_REQUIRE(runs.size()==1);
+    BOOST_TEST(runs[0].startAt==1);
+    BOOST_TEST(runs[0].count==5);
+
+    // disjoint runs for several merges, newest first
+    sizes = {1000,1000,1000,100,10,10,10};
+    runs = policy.selectRuns(sizes,2,2);
+    BOOST_REQUIRE(runs.size()==2);
+    BOOST_TEST(runs[0].startAt==4);
+    BOOST_TEST(runs[0].count==3);
+    BOOST_TEST(runs[1].startAt==0);
+    BOOST_TEST(runs[1].count==3);
+
+    // the newest segments are merged when the sizes grow too fast to form a run
+    sizes = {100000,10000,1000,100,10};
+    runs = policy.selectRuns(sizes,3,1);
+    BOOST_REQUIRE(runs.size()==1);
+    BOOST_TEST(runs[0].startAt==2);
+    BOOST_TEST(runs[0].count==3);
+}
+
+BOOST_AUTO_TEST_CASE( compactionpolicy_stats ) {
+    SizeRatioPolicy policy;
+    BOOST_TEST(policy.getStats().writeAmplification==0);
+    policy.recordMerge(200,200,180);
+    policy.recordMerge(380,200,360);
+    auto stats = policy.getStats();
+    BOOST_TEST(stats.merges==2);
+    BOOST_TEST(stats.inputBytes==580);
+    BOOST_TEST(stats.freshBytes==400);
+    BOOST_TEST(stats.outputBytes==540);
+    BOOST_TEST(stats.writeAmplification==1.35);
+}
@@ -0,0 +1,174 @@
+#include <string.h>
+
+#include "compression.h"
+#include "exceptions.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * The LZ format is a sequence of tokens. The high nibble of the token is the literal length and
+ * the low nibble is the match length - lzMinMatch, where 15 means that additional length bytes
+ * follow, each 255 meaning another byte follows. The token is followed by the literal length
+ * bytes, the literals, the 2 byte little endian match offset and the match length bytes. The last
+ * sequence has only literals.
+ */
+static const int lzMinMatch = 4;
+static const int lzHashBits = 12;
+static const int lzMaxOffset = 0xFFFF;
+
+static inline uint32_t lzHash(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v,p,4);
+    return (v * 2654435761U) >> (32-lzHashBits);
+}
+
+static inline uint8_t* lzWriteLength(uint8_t *op,int length) {
+    for(;length>=255;length-=255) *op++ = 255;
+    *op++ = length;
+    return op;
+}
+
+static uint8_t* lzWriteSequence(uint8_t *op,const uint8_t *literals,int literalLength,int offset,int matchLength) {
+    uint8_t *token = op++;
+    *token = (literalLength < 15 ? literalLength : 15) << 4;
+    if(literalLength >= 15) op = lzWriteLength(op,literalLength-15);
+    memcpy(op,literals,literalLength);
+    op += literalLength;
+    if(matchLength==0) return op;
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    matchLength -= lzMinMatch;
+    *token |= matchLength < 15 ? matchLength : 15;
+    if(matchLength >= 15) op = lzWriteLength(op,matchLength-15);
+    return op;
+}
+
+static void lzCompress(const Slice& in,ByteBuffer& out) {
+    const uint8_t *ip = in;
+    const int n = in.length;
+    out.ensureCapacity(n + n/255 + 16);
+    uint8_t *op = out;
+
+    int table[1<<lzHashBits];
+    for(auto& entry : table) entry = -1;
+
+    int anchor = 0;
+    int i = 0;
+    while(i + lzMinMatch <= n) {
+        auto h = lzHash(ip+i);
+        int ref = table[h];
+        table[h] = i;
+        if(ref < 0 || i-ref > lzMaxOffset || memcmp(ip+ref,ip+i,lzMinMatch)!=0) {
+            i++;
+            continue;
+        }
+        int length = lzMinMatch;
+        while(i+length < n && ip[ref+length]==ip[i+length]) length++;
+        op = lzWriteSequence(op,ip+anchor,i-anchor,i-ref,length);
+        i += length;
+        anchor = i;
+    }
+    op = lzWriteSequence(op,ip+anchor,n-anchor,0,0);
+    out.length = op - (uint8_t*)out;
+}
+
+static int lzReadLength(const uint8_t *ip,int n,int *index) {
+    int length = 0;
+    while(true) {
+        if(*index >= n) throw IllegalState("corrupt compressed block");
+        uint8_t b = ip[(*index)++];
+        length += b;
+        if(b!=255) return length;
+    }
+}
+
+static void lzDecompress(const Slice& in,int rawLength,ByteBuffer& out) {
+    const uint8_t *ip = in;
+    const int n = in.length;
+    out.ensureCapacity(rawLength);
+    uint8_t *op = out;
+    int index = 0;
+    int length = 0;
+
+    while(index < n) {
+        uint8_t token = ip[index++];
+        int literals = token >> 4;
+        if(literals==15) literals += lzReadLength(ip,n,&index);
+        if(index+literals > n || length+literals > rawLength) throw IllegalState("corrupt compressed block");
+        memcpy(op+length,ip+index,literals);
+        index += literals;
+        length += literals;
+        if(index==n) break;
+
+        if(index+2 > n) throw IllegalState("corrupt compressed block");
+        int offset = ip[index] | (ip[index+1] << 8);
+        index += 2;
+        int match = (token & 0x0F);
+        if(match==15) match += lzReadLength(ip,n,&index);
+        match += lzMinMatch;
+        if(offset==0 || offset > length || length+match > rawLength) throw IllegalState("corrupt compressed block");
+        // the match may overlap the output, so copy a byte at a time
+        for(int i=0;i<match;i++,length++) op[length] = op[length-offset];
+    }
+    if(length!=rawLength) throw IllegalState("corrupt compressed block");
+    out.length = length;
+}
+
+bool compressionAvailable(int codec) {
+    switch(codec) {
+        case compressionNone:
+        case compressionLZ:
+            return true;
+#ifdef HAVE_ZSTD
+        case compressionZstd:
+            return true;
+#endif
+    }
+    return false;
+}
+
+void compress(int codec,const Slice& in,ByteBuffer& out) {
+    switch(codec) {
+        case compressionNone:
+            out = in;
+            return;
+        case compressionLZ:
+            lzCompress(in,out);
+            return;
+#ifdef HAVE_ZSTD
+        case compressionZstd: {
+            auto bound = ZSTD_compressBound(in.length);
+            out.ensureCapacity(bound);
+            auto n = ZSTD_compress(out,bound,in,in.length,ZSTD_CLEVEL_DEFAULT);
+            if(ZSTD_isError(n)) throw IllegalState(ZSTD_getErrorName(n));
+            out.length = n;
+            return;
+        }
+#endif
+    }
+    throw IllegalState("unsupported compression");
+}
+
+void decompress(int codec,const Slice& in,int rawLength,ByteBuffer& out) {
+    switch(codec) {
+        case compressionNone:
+            if(in.length!=rawLength) throw IllegalState("corrupt block");
+            out = in;
+            return;
+        case compressionLZ:
+            lzDecompress(in,rawLength,out);
+            return;
+#ifdef HAVE_ZSTD
+        case compressionZstd: {
+            out.ensureCapacity(rawLength);
+            auto n = ZSTD_decompress(out,rawLength,in,in.length);
+            if(ZSTD_isError(n) || n!=(size_t)rawLength) throw IllegalState("corrupt compressed block");
+            out.length = n;
+            return;
+        }
+#endif
+    }
+    throw IllegalState("unsupported compression");
+}
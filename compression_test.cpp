@@ -0,0 +1,45 @@
+#define BOOST_TEST_MODULE compression
+#include <boost/test/included/unit_test.hpp>
+
+#include "compression.h"
+
+static Slice toSlice(const std::string& s) {
+    return Slice((const uint8_t*)s.data(),s.length());
+}
+
+static void roundTrip(int codec,const std::string& input) {
+    ByteBuffer compressed,decompressed;
+    compress(codec,toSlice(input),compressed);
+    decompress(codec,compressed,input.length(),decompressed);
+    BOOST_TEST((std::string)decompressed==input);
+}
+
+BOOST_AUTO_TEST_CASE( compression_lz ) {
+    roundTrip(compressionLZ,"");
+    roundTrip(compressionLZ,"a");
+    roundTrip(compressionLZ,"abcdefghijklmnopqrstuvwxyz");
+    roundTrip(compressionLZ,std::string(100000,'x'));
+
+    std::string json;
+    for(int i=0;i<1000;i++) {
+        json += "{\"name\":\"myvalue\",\"index\":"+std::to_string(i)+"}";
+    }
+    roundTrip(compressionLZ,json);
+    ByteBuffer compressed;
+    compress(compressionLZ,toSlice(json),compressed);
+    BOOST_TEST(compressed.length < (int)json.length()/3);
+
+    std::string random;
+    srand(1);
+    for(int i=0;i<100000;i++) random += (char)rand();
+    roundTrip(compressionLZ,random);
+}
+
+BOOST_AUTO_TEST_CASE( compression_corrupt ) {
+    std::string input(1000,'x');
+    ByteBuffer compressed,decompressed;
+    compress(compressionLZ,toSlice(input),compressed);
+    BOOST_CHECK_THROW(decompress(compressionLZ,compressed,999,decompressed),IllegalState);
+    BOOST_CHECK_THROW(decompress(compressionLZ,compressed.slice(0,3),1000,decompressed),IllegalState);
+    BOOST_TEST(!compressionAvailable(99));
+}
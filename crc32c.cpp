@@ -0,0 +1,69 @@
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+static const uint32_t poly = 0x82F63B78;
+
+struct Crc32cTable {
+    uint32_t table[256];
+    Crc32cTable() {
+        for(uint32_t i=0;i<256;i++) {
+            uint32_t crc = i;
+            for(int j=0;j<8;j++) crc = (crc >> 1) ^ ((crc & 1) ? poly : 0);
+            table[i] = crc;
+        }
+    }
+};
+
+static uint32_t crc32cSoftware(uint32_t crc,const uint8_t *data,size_t length) {
+    static const Crc32cTable t;
+    for(size_t i=0;i<length;i++) {
+        crc = t.table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc,const uint8_t *data,size_t length) {
+    uint64_t crc64 = crc;
+    for(;length>=8;length-=8,data+=8) {
+        uint64_t v;
+        memcpy(&v,data,8);
+        crc64 = _mm_crc32_u64(crc64,v);
+    }
+    crc = crc64;
+    for(;length>0;length--,data++) crc = _mm_crc32_u8(crc,*data);
+    return crc;
+}
+static bool hasHardware() {
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32cHardware(uint32_t crc,const uint8_t *data,size_t length) {
+    for(;length>=8;length-=8,data+=8) {
+        uint64_t v;
+        memcpy(&v,data,8);
+        crc = __crc32cd(crc,v);
+    }
+    for(;length>0;length--,data++) crc = __crc32cb(crc,*data);
+    return crc;
+}
+static bool hasHardware() { return true; }
+#else
+static uint32_t crc32cHardware(uint32_t crc,const uint8_t *data,size_t length) { return crc32cSoftware(crc,data,length); }
+static bool hasHardware() { return false; }
+#endif
+
+uint32_t crc32c(uint32_t crc,const uint8_t *data,size_t length) {
+    crc = ~crc;
+    crc = hasHardware() ? crc32cHardware(crc,data,length) : crc32cSoftware(crc,data,length);
+    return ~crc;
+}
@@ -0,0 +1,32 @@
+#define BOOST_TEST_MODULE crc32c
+#include <boost/test/included/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+#include "crc32c.h"
+
+static uint32_t crc(const std::string& s) {
+    return crc32c(0,(const uint8_t*)s.data(),s.length());
+}
+
+BOOST_AUTO_TEST_CASE( crc32c_known ) {
+    BOOST_TEST(crc("")==0);
+    BOOST_TEST(crc("123456789")==0xE3069283);
+    BOOST_TEST(crc(std::string(32,'\0'))==0x8A9136AA);
+    BOOST_TEST(crc(std::string(32,'\xff'))==0x62A8AB43);
+}
+
+BOOST_AUTO_TEST_CASE( crc32c_incremental ) {
+    std::vector<uint8_t> data(10000);
+    for(int i=0;i<data.size();i++) data[i] = i*31 + (i>>7);
+    uint32_t whole = crc32c(0,data.data(),data.size());
+    // split at unaligned offsets to exercise the byte and word paths
+    for(int split : {1,3,7,8,9,4095,9999}) {
+        uint32_t c = crc32c(0,data.data(),split);
+        c = crc32c(c,data.data()+split,data.size()-split);
+        BOOST_TEST(c==whole);
+    }
+    data[5000] ^= 1;
+    BOOST_TEST(crc32c(0,data.data(),data.size())!=whole);
+}
@@ -7,7 +7,9 @@
 #include <atomic>
 #include <filesystem>
 #include <exception>
-#include <regex>
+#include <algorithm>
+#include <set>
+#include <fstream>
 
 #include "database.h"
 #include "exceptions.h"
@@ -15,6 +17,7 @@
 #include "memorysegment.h"
 #include "multisegment.h"
 #include "merger.h"
+#include "manifest.h"
 
 namespace fs = std::filesystem;
 
@@ -49,6 +52,9 @@ DatabaseRef Database::openImpl(const std::string& path, const Options& in_option
     if (!lockFile.tryLock())
         throw DatabaseInUse();
 
+    checkTtl(path,in_options);
+    finishIngest(path);
+
     Options options(in_options);
     if(options.maxMemoryBytes < dbMemorySegment) {
         options.maxMemoryBytes = dbMemorySegment;
@@ -56,12 +62,46 @@ DatabaseRef Database::openImpl(const std::string& path, const Options& in_option
     if(options.maxSegments < dbMaxSegments) {
         options.maxSegments = dbMaxSegments;
     }
+    if(!options.compactionPolicy) {
+        options.compactionPolicy = std::make_shared<SmallestFirstPolicy>();
+    }
+    if(!options.scheduler) {
+        options.scheduler = JobScheduler::shared();
+    }
+    if(!options.fileCache && options.maxOpenFiles > 0) {
+        options.fileCache = std::make_shared<FileCache>(options.maxOpenFiles);
+    }
+    if(!compressionAvailable(options.compression)) {
+        throw DatabaseOpenFailed("compression codec not available");
+    }
+    if(options.blockSize < minKeyBlockSize || options.blockSize > maxKeyBlockSize || options.indexInterval < 1) {
+        throw DatabaseOpenFailed("invalid key block size or index interval");
+    }
+
+    bool leveled = options.leveled || LevelManifest::exists(path);
+    if(leveled && options.segmentFormat==segmentFormatV1) {
+        throw DatabaseOpenFailed("leveled databases require segment format 2");
+    }
 
     auto db = new Database(path,lockFile,options);
 
-    db->deleter.deleteScheduled();
+    db->deleter->deleteScheduled();
 
-    auto segments = DiskSegment::loadDiskSegments(path,options);
+    db->blobs = std::make_shared<BlobStore>(path,db->deleter);
+    db->leveled = leveled;
+    Levels levels;
+    std::vector<SegmentRef> segments;
+    if(LevelManifest::exists(path)) {
+        std::vector<SegmentRef> level0;
+        levels = LevelManifest::load(path,options,db->blobs,level0);
+        segments = levelSegments(levels,level0);
+    } else {
+        // an existing database that is opened leveled starts with every segment in level 0
+        segments = DiskSegment::loadDiskSegments(path,options,db->blobs);
+    }
+    // the levels file replaces the manifest, which would otherwise become stale
+    if(leveled) fs::remove(Manifest::filename(path));
+    db->blobs->open(segments);
     uint64_t maxSegID = 0;
     for(auto s : segments) {
         maxSegID = MAX(maxSegID,s->upperID());
@@ -71,21 +111,69 @@ DatabaseRef Database::openImpl(const std::string& path, const Options& in_option
     auto ms = MemorySegment::newMemorySegment(db->path,db->nextSegmentID(),db->options);
     auto multis = MultiSegment::newMultiSegment(copyAndAppend(segments,ms));
 
-    db->setState(DatabaseState(segments,ms,multis));
+    db->setState(DatabaseState(segments,ms,multis,levels));
 
     DatabaseRef ref(db);
     db->weakRef = ref;
 
     if(!options.disableAutoMerge) {
-        db->wg.add(1);
-        db->merger.autoMerger(db);
+        db->merger.wakeup(db);
     }
+    if(options.scrubIntervalSeconds > 0) {
+        db->scrubber.start(db);
+    }
+    db->deleter->start([db](std::chrono::microseconds delay) {
+        db->wg.add(1);
+        db->options.scheduler->scheduleAfter(db,JobPriority::deletion,std::chrono::ceil<std::chrono::milliseconds>(delay),[db]() {
+            WaitGroupDone done(db->wg);
+            db->deleter->deletePending();
+        });
+    },options.deleteBytesPerSecond);
 
     return ref;
 }
 
 Database::Database(const std::string& path,const LockFile& lockFile,const Options& options)
-     : _open(true) , lockFile(lockFile) , options(options), deleter(path), path(path) {
+     : _open(true) , lockFile(lockFile) , options(options), deleter(std::make_shared<Deleter>(path)), path(path) {
+}
+
+Database::~Database() {
+    // the background jobs of a database that was not closed must not outlive it
+    closing = true;
+    scrubber.stop();
+    deleter->stop();
+    options.scheduler->drain(this);
+    wg.waitEmpty();
+}
+
+// the files being ingested are linked under this prefix until they are validated
+static const std::string stagingPrefix = "ingesting.";
+// lists the renames of the staged files into segment files while an ingest installs them
+static const std::string ingestLog = "ingest";
+
+static void saveIngestLog(const std::string& path,const std::vector<std::pair<std::string,std::string>>& renames) {
+    auto filename = path+"/"+ingestLog;
+    {
+        std::ofstream out;
+        out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        out.open(filename+".tmp",std::ios::out | std::ios::trunc);
+        for(auto& [from,to] : renames) out << from << " " << to << "\n";
+    }
+    fs::rename(filename+".tmp",filename);
+}
+
+void Database::finishIngest(const std::string& path) {
+    std::ifstream in(path+"/"+ingestLog);
+    std::string from,to;
+    while(in >> from >> to) {
+        if(fs::exists(path+"/"+from)) fs::rename(path+"/"+from,path+"/"+to);
+    }
+    in.close();
+    fs::remove(path+"/"+ingestLog);
+    fs::remove(path+"/"+ingestLog+".tmp");
+    for(auto& file : fs::directory_iterator(path)) {
+        if(file.path().filename().string().starts_with(stagingPrefix)) fs::remove(file.path());
+    }
 }
 
 void Database::checkValidDatabase(const std::string& path) {
@@ -93,15 +181,205 @@ void Database::checkValidDatabase(const std::string& path) {
     
     if(!fs::is_directory(path)) throw InvalidDatabase();
 
-    std::cmatch m;
-    std::regex re("(log|keys|data)\\..*");
+    static const std::string prefixes[] = {"log.","keys.","data.","segment.","blob.","deleting.",stagingPrefix};
 
     for(auto file : fs::directory_iterator(path)) {
         auto name = file.path().filename().string();
         if(name=="lockfile") continue;
         if(name=="deleted") continue;
-        if(!std::regex_match(name.c_str(),m,re)) throw InvalidDatabase();
+        if(name=="levels" || name=="levels.tmp") continue;
+        if(name=="manifest" || name=="manifest.tmp") continue;
+        if(name=="ttl" || name=="ttl.tmp") continue;
+        if(name==ingestLog || name==ingestLog+".tmp") continue;
+        if(std::none_of(std::begin(prefixes),std::end(prefixes),[&](auto& prefix) { return name.starts_with(prefix); })) throw InvalidDatabase();
+    }
+}
+
+void Database::checkTtl(const std::string& path,const Options& options) {
+    auto filename = path+"/ttl";
+    int stored = -1;
+    {
+        std::ifstream in(filename);
+        if(!(in >> stored)) stored = -1;
+    }
+    // a different TTL only changes which values are expired, but stripping the write time from
+    // values that have none, or returning it as part of the value, would corrupt them
+    if(stored >= 0 && (stored > 0)!=(options.ttlSeconds > 0)) {
+        throw DatabaseOpenFailed("ttlSeconds must be set if and only if the database was written with a TTL");
+    }
+    if(stored==options.ttlSeconds) return;
+    {
+        std::ofstream out;
+        out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        out.open(filename+".tmp",std::ios::out | std::ios::trunc);
+        out << options.ttlSeconds << "\n";
     }
+    fs::rename(filename+".tmp",filename);
+}
+
+void Database::checkpoint(const std::string& dir) {
+    if(!_open) throw DatabaseClosed();
+    if(fs::exists(dir)) throw DatabaseException("checkpoint directory already exists");
+    // a close waits for the checkpoint, so the files of the state are not deleted
+    UseWaitGroup use(wg);
+    std::shared_ptr<const DatabaseState> state;
+    {
+        DB_LOCK();
+        if(getState()->memory->size() > 0) swapMemory();
+        state = getState();
+    }
+
+    auto link = [&](const std::string& name) {
+        std::error_code ec;
+        fs::create_hard_link(path+"/"+name,dir+"/"+name,ec);
+        if(ec) fs::copy_file(path+"/"+name,dir+"/"+name);
+    };
+
+    fs::create_directories(dir);
+    try {
+        std::vector<SegmentRef> segments;
+        std::vector<std::string> level0Files;
+        std::set<BlobFileID> blobFiles;
+        int levelSegments = levelSegmentCount(state->levels);
+        for(int i=0;i<state->segments.size();i++) {
+            auto s = state->segments[i];
+            if(typeid(*s)==typeid(MemorySegment)) {
+                // the log file of a memory segment may not have been flushed
+                auto itr = s->lookup(ByteBuffer::EMPTY(),ByteBuffer::EMPTY());
+                if(itr->peekKey().empty()) continue;
+                s = writeAndLoadSegment(dir,s->lowerID(),s->upperID(),itr.get(),false,options);
+            } else {
+                for(auto& name : s->files()) link(name);
+                for(auto& u : BlobStore::usage(s)) blobFiles.insert(u.file);
+            }
+            segments.push_back(s);
+            if(i>=levelSegments) {
+                for(auto& file : s->files()) level0Files.push_back(file);
+            }
+        }
+        for(auto& id : blobFiles) link(blobs->filename(id));
+        if(fs::exists(path+"/ttl")) fs::copy_file(path+"/ttl",dir+"/ttl");
+        if(leveled) {
+            LevelManifest::save(dir,state->levels,level0Files);
+        } else {
+            Manifest::save(dir,segments);
+        }
+    } catch(...) {
+        fs::remove_all(dir);
+        throw;
+    }
+}
+
+void Database::ingest(const std::vector<std::string>& files) {
+    if(!_open) throw DatabaseClosed();
+    UseWaitGroup use(wg);
+
+    // the files are linked under staging names and validated without holding the database lock
+    std::vector<std::string> staged;
+    std::vector<SegmentRef> validated;
+    auto removeStaged = [&]() {
+        validated.clear();
+        std::error_code ec;
+        for(auto& name : staged) fs::remove(path+"/"+name,ec);
+    };
+    try {
+        for(auto& file : files) {
+            auto n = std::to_string(++stagedFiles);
+            staged.push_back(stagingPrefix+n+"."+n);
+            auto name = path+"/"+staged.back();
+            std::error_code ec;
+            fs::create_hard_link(file,name,ec);
+            if(ec) fs::copy_file(file,name);
+            SegmentRef segment;
+            try {
+                // the blob files of a database are not shared, so a segment cannot reference them
+                segment = DiskSegment::newDiskSegment(name,{},nullptr,options.fileCache);
+            } catch(const std::exception&) {
+                throw DatabaseException("invalid segment file");
+            }
+            // the write times are only stored with the values if the segment was written with a TTL
+            if((((DiskSegment*)segment.get())->getMetadata().ttlSeconds > 0)!=(options.ttlSeconds > 0)) {
+                throw DatabaseException("segment file TTL does not match the database");
+            }
+            validated.push_back(segment);
+        }
+    } catch(...) {
+        removeStaged();
+        throw;
+    }
+
+    std::unique_lock lock(db_lock);
+    if(!_open) {
+        removeStaged();
+        throw DatabaseClosed();
+    }
+
+    // the ids are assigned with the lock held, so that they are newer than the memory segment
+    // and older than the memory segment that replaces it
+    std::vector<std::pair<std::string,std::string>> renames;
+    std::vector<DiskSegment*> sources;
+    for(int i=0;i<validated.size();i++) {
+        auto ds = (DiskSegment*)validated[i].get();
+        if(ds->getKeyIndex().empty()) continue;
+        auto id = nextSegmentID();
+        renames.push_back({staged[i],"segment."+std::to_string(id)+"."+std::to_string(id)});
+        sources.push_back(ds);
+    }
+    if(renames.empty()) {
+        removeStaged();
+        return;
+    }
+
+    auto state = getState();
+    auto segments = copyAndAppend(state->segments,state->memory);
+    std::vector<SegmentRef> ingested;
+    int renamed = 0;
+    try {
+        // the renames are completed when the database is opened if they are interrupted, so the
+        // files are either all ingested or none are
+        saveIngestLog(path,renames);
+        for(auto& [from,to] : renames) {
+            fs::rename(path+"/"+from,path+"/"+to);
+            renamed++;
+        }
+        // the validated segments are opened again under their new names, without reading them
+        for(int i=0;i<renames.size();i++) {
+            auto name = path+"/"+renames[i].second;
+            ingested.push_back(DiskSegment::newDiskSegment(name,sources[i]->getMetadata(),sources[i]->getKeyIndex(),nullptr,options.fileCache));
+        }
+        segments.insert(segments.end(),ingested.begin(),ingested.end());
+        if(leveled) {
+            // the ingested segments are the newest of level 0
+            std::vector<std::string> level0Files;
+            for(auto itr = segments.begin()+levelSegmentCount(state->levels);itr<segments.end();itr++) {
+                for(auto& file : (*itr)->files()) level0Files.push_back(file);
+            }
+            LevelManifest::save(path,state->levels,level0Files);
+        }
+        fs::remove(path+"/"+ingestLog);
+    } catch(...) {
+        std::error_code ec;
+        for(int i=0;i<renamed;i++) fs::rename(path+"/"+renames[i].second,path+"/"+renames[i].first,ec);
+        fs::remove(path+"/"+ingestLog,ec);
+        ingested.clear();
+        removeStaged();
+        throw;
+    }
+    validated.clear();
+
+    auto memory = MemorySegment::newMemorySegment(path,nextSegmentID(),options);
+    auto multi = MultiSegment::newMultiSegment(copyAndAppend(segments,memory));
+    setState(DatabaseState(segments,memory,multi,state->levels));
+    lock.unlock();
+
+    saveManifest();
+    if(!options.disableAutoMerge) merger.wakeup(this);
+}
+
+void Database::saveManifest() {
+    if(leveled) return;
+    std::lock_guard<std::mutex> lock(manifest_lock);
+    Manifest::save(path,getState()->segments);
 }
 
 void Database::remove(const std::string& path) {
@@ -122,36 +400,70 @@ void Database::closeWithMerge(int segmentCount) {
     if(!_open) throw DatabaseClosed();
 
     closing=true;
-    merger.wakeup();
+    scrubber.stop();
+    // the files still pending are deleted after the database is opened again
+    deleter->stop();
 
     // wait for background merger to finish
+    options.scheduler->drain(this);
     wg.waitEmpty();
 
     DB_LOCK();
 
     auto state = getState();
-    DatabaseState newState(copyAndAppend(state->segments,state->memory),MemorySegmentRef(0),MultiSegmentRef(0));
+    DatabaseState newState(copyAndAppend(state->segments,state->memory),MemorySegmentRef(0),MultiSegmentRef(0),state->levels);
     setState(newState);
     if(segmentCount>0) {
-        merger.mergeSegments0(this,segmentCount,false);
+        if(leveled) {
+            merger.compactLevels(this,0);
+        } else {
+            merger.mergeSegments0(this,segmentCount);
+        }
     }
     state = getState();
-    for(auto s : state->segments) {
-        auto seg = s.get();
+    // the disk segments written for the memory segments, in the order of the segments
+    std::vector<SegmentRef> flushed(state->segments.size());
+    for(int i=0;i<state->segments.size();i++) {
+        auto seg = state->segments[i].get();
         if(typeid(*seg)!=typeid(MemorySegment)) continue;
         WaitGroup *wgptr = &wg;
         wgptr->add(1);
-        executor.enqueue([seg,this,wgptr]() {
-            writeSegmentToDisk(this,seg);
+        options.scheduler->schedule(this,JobPriority::flush,[seg,this,wgptr,written = &flushed[i]]() {
+            *written = writeSegmentToDisk(this,seg);
             wgptr->done();
         });
     }
     wg.waitEmpty();
+    if(!leveled) {
+        std::vector<SegmentRef> segments;
+        for(int i=0;i<state->segments.size();i++) {
+            if(typeid(*state->segments[i])!=typeid(MemorySegment)) {
+                segments.push_back(state->segments[i]);
+            } else if(flushed[i]) {
+                segments.push_back(flushed[i]);
+            }
+        }
+        Manifest::save(path,segments);
+    }
+    if(leveled) {
+        // the memory segments were written to level 0 using their ids
+        state = getState();
+        std::vector<std::string> level0Files;
+        for(auto itr = state->segments.begin()+levelSegmentCount(state->levels);itr<state->segments.end();itr++) {
+            if(typeid(**itr)==typeid(MemorySegment)) {
+                auto file = path+"/segment."+std::to_string((*itr)->lowerID())+"."+std::to_string((*itr)->upperID());
+                if(fs::exists(file)) level0Files.push_back(file);
+            } else {
+                for(auto& file : (*itr)->files()) level0Files.push_back(file);
+            }
+        }
+        LevelManifest::save(path,state->levels,level0Files);
+    }
     auto segments = getState()->segments;
     for(auto s : segments) {
         s->close();
     }
     _open=false;
-    deleter.deleteScheduled();
+    deleter->deleteScheduled();
 }
 
@@ -2,8 +2,14 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
 
 #include "database.h"
+#include "disksegment.h"
+#include "manifest.h"
+#include "segmentwriter.h"
 #include "exceptions.h"
 
 namespace fs = std::filesystem;
@@ -63,21 +69,1289 @@ BOOST_AUTO_TEST_CASE( database_merge) {
         int count=0;
         for(auto f : files) {
             auto filename = f.path().filename().string();
-            if(filename.starts_with("keys.") || filename.starts_with("data.")) {
+            if(filename.starts_with("segment.")) {
                 count++;
             }
         }
         return count;
     };
 
-    BOOST_TEST(countFiles()==nsegs*2);
+    BOOST_TEST(countFiles()==nsegs);
     auto db = Database::open("test/mydb",options);
     db->closeWithMerge(1);
-    BOOST_TEST(countFiles()==2);
+    BOOST_TEST(countFiles()==1);
 
     db = Database::open("test/mydb",options);
     auto itr = db->lookup("","");
     int count=0;
     while(!(itr->next().key.empty())) count++;
     BOOST_TEST(count==100);
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE( database_format_v1 ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.segmentFormat = 1;
+
+    for(int i=0;i<2;i++) {
+        auto db = Database::open("test/mydb",options);
+        for(int j=0;j<1000;j++) {
+            db->put("mykey"+std::to_string(j),"myvalue"+std::to_string(i));
+        }
+        db->closeWithMerge(0);
+    }
+    BOOST_TEST(fs::exists("test/mydb/keys.2.2"));
+    BOOST_TEST(fs::exists("test/mydb/data.2.2"));
+
+    // v1 segments are readable, and are merged into a v2 segment
+    options.segmentFormat = 2;
+    auto db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey999")=="myvalue1");
+    db->closeWithMerge(1);
+    BOOST_TEST(fs::exists("test/mydb/segment.1.3"));
+    BOOST_TEST(!fs::exists("test/mydb/keys.2.2"));
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey999")=="myvalue1");
+    BOOST_TEST(db->get("mykey1000").empty());
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_approximate ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+
+    auto db = Database::open("test/mydb",options);
+    auto put = [&](int i) {
+        char key[16];
+        snprintf(key,sizeof(key),"mykey%07d",i);
+        db->put(key,"myvalue"+std::to_string(i));
+    };
+    for(int i=0;i<100000;i++) put(i);
+    auto count = db->approximateCount("","");
+    BOOST_TEST(count > 50000);
+    BOOST_TEST(count < 200000);
+
+    db->closeWithMerge(1);
+    db = Database::open("test/mydb",options);
+
+    count = db->approximateCount("","");
+    BOOST_TEST(count > 90000);
+    BOOST_TEST(count < 110000);
+    count = db->approximateCount("mykey0025000","mykey0074999");
+    BOOST_TEST(count > 45000);
+    BOOST_TEST(count < 55000);
+    BOOST_TEST(db->approximateCount("mykey0000010","mykey0000019")==10);
+    BOOST_TEST(db->approximateCount("x","z")==0);
+
+    auto size = db->approximateSize("","");
+    auto half = db->approximateSize("mykey0050000","");
+    BOOST_TEST(size > 1000000);
+    BOOST_TEST(half > size/3);
+    BOOST_TEST(half < (size*2)/3);
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_blobs ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.blobValueThreshold = 100;
+
+    auto countBlobs = [](){
+        int count = 0;
+        for(auto file : fs::directory_iterator("test/mydb")) {
+            if(file.path().filename().string().starts_with("blob.")) count++;
+        }
+        return count;
+    };
+    auto blobBytes = [](){
+        uint64_t bytes = 0;
+        for(auto file : fs::directory_iterator("test/mydb")) {
+            if(file.path().filename().string().starts_with("blob.")) bytes += fs::file_size(file.path());
+        }
+        return bytes;
+    };
+    auto value = [](int i,char c) { return std::string(1000,c)+std::to_string(i); };
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<100;i++) db->put("mykey"+std::to_string(i),value(i,'a'));
+    db->put("small","smallvalue");
+    db->closeWithMerge(0);
+    BOOST_TEST(countBlobs()==1);
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey7")==value(7,'a'));
+    BOOST_TEST(db->get("small")=="smallvalue");
+    for(int i=0;i<100;i++) db->put("mykey"+std::to_string(i),value(i,'b'));
+    db->closeWithMerge(0);
+    BOOST_TEST(countBlobs()==2);
+
+    // the merge copies the blob references, and the overwritten blob file is removed
+    db = Database::open("test/mydb",options);
+    db->closeWithMerge(1);
+    BOOST_TEST(countBlobs()==1);
+
+    db = Database::open("test/mydb",options);
+    for(int i=0;i<60;i++) db->put("mykey"+std::to_string(i),value(i,'c'));
+    db->closeWithMerge(1);
+    BOOST_TEST(countBlobs()==2);
+    BOOST_TEST(blobBytes() > 160000);
+
+    // the older blob file is mostly garbage, so its live values are relocated to a new blob file
+    db = Database::open("test/mydb",options);
+    db->put("another","value");
+    db->closeWithMerge(1);
+    BOOST_TEST(countBlobs()==2);
+    BOOST_TEST(blobBytes() < 110000);
+
+    db = Database::open("test/mydb",options);
+    for(int i=0;i<100;i++) {
+        BOOST_TEST(db->get("mykey"+std::to_string(i))==value(i,i<60 ? 'c' : 'b'));
+    }
+    BOOST_TEST(db->get("small")=="smallvalue");
+    auto itr = db->lookup("mykey70","mykey70");
+    KeyValue kv;
+    BOOST_TEST(itr->next(kv).value==value(70,'b'));
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_blobs_reclaimed ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.blobValueThreshold = 100;
+
+    auto countFiles = [](const std::string& prefix) {
+        int count = 0;
+        for(auto file : fs::directory_iterator("test/mydb")) {
+            if(file.path().filename().string().starts_with(prefix)) count++;
+        }
+        return count;
+    };
+    auto value = [](int i,char c) { return std::string(1000,c)+std::to_string(i); };
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<100;i++) db->put("mykey"+std::to_string(i),value(i,'a'));
+    db->closeWithMerge(0);
+    BOOST_TEST(countFiles("blob.")==1);
+
+    // the overwritten blob file is kept while a snapshot may read it
+    db = Database::open("test/mydb",options);
+    auto snapshot = db->snapshot();
+    for(int i=0;i<100;i++) db->put("mykey"+std::to_string(i),value(i,'b'));
+    db->compactRange("","");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    BOOST_TEST(countFiles("blob.")==2);
+    BOOST_TEST(snapshot->get("mykey7")==value(7,'a'));
+
+    // and deleted while the database is open once the snapshot is released
+    snapshot.reset();
+    auto start = std::chrono::steady_clock::now();
+    while(countFiles("blob.")+countFiles("deleting.blob.")>1 && std::chrono::steady_clock::now()-start < std::chrono::seconds(5)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_TEST(countFiles("blob.")==1);
+    BOOST_TEST(countFiles("deleting.blob.")==0);
+    BOOST_TEST(db->get("mykey7")==value(7,'b'));
+    db->close();
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey99")==value(99,'b'));
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_checksums ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<100000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+    db->closeWithMerge(1);
+
+    db = Database::open("test/mydb",options);
+    auto stats = db->scrub();
+    BOOST_TEST(stats.segmentsScrubbed==1);
+    BOOST_TEST(stats.blocksScrubbed>1);
+    BOOST_TEST(stats.corruptBlocks==0);
+    auto blocks = stats.blocksScrubbed;
+    db->closeWithMerge(0);
+
+    // the blocks verified by reads are not counted by the scrub
+    db = Database::open("test/mydb",options);
+    ReadOptions verify;
+    verify.verifyChecksums = true;
+    ByteBuffer value;
+    BOOST_TEST(db->get(Slice("mykey50000"),value,verify)=="myvalue50000");
+    stats = db->scrub();
+    BOOST_TEST(stats.blocksScrubbed==blocks-1);
+    db->closeWithMerge(0);
+
+    // corrupt a value of the first key block
+    for(auto file : fs::directory_iterator("test/mydb")) {
+        if(!file.path().filename().string().starts_with("segment.")) continue;
+        std::fstream f(file.path(),std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(100);
+        f.put('X');
+    }
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(!db->get(Slice("mykey0"),value).empty());
+    BOOST_CHECK_THROW(db->get(Slice("mykey0"),value,verify),DatabaseCorrupted);
+    BOOST_TEST(db->get(Slice("mykey99999"),value,verify)=="myvalue99999");
+    BOOST_CHECK_THROW(db->lookup(Slice("mykey0"),Slice("mykey1"),verify),DatabaseCorrupted);
+
+    stats = db->scrub();
+    BOOST_TEST(stats.corruptBlocks==1);
+    BOOST_TEST(stats.corruptFiles.size()==1);
+    // a known corrupt segment is not scrubbed again
+    stats = db->scrub();
+    BOOST_TEST(stats.corruptBlocks==1);
+    db->closeWithMerge(0);
+}
+
+BOOST_AUTO_TEST_CASE( database_background_scrub ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<100000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+    db->closeWithMerge(1);
+
+    // the rate limit splits the pass into several jobs, which resume where the last one stopped
+    options.scrubIntervalSeconds = 1;
+    options.scrubBytesPerSecond = 1024*1024;
+    db = Database::open("test/mydb",options);
+    auto start = std::chrono::steady_clock::now();
+    while(db->scrubStats().segmentsScrubbed==0 && std::chrono::steady_clock::now()-start < std::chrono::seconds(10)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    auto stats = db->scrubStats();
+    BOOST_TEST(stats.segmentsScrubbed==1);
+    BOOST_TEST(stats.corruptBlocks==0);
+    db->closeWithMerge(0);
+
+    db = Database::open("test/mydb",Options(true));
+    BOOST_TEST(db->scrub().blocksScrubbed==stats.blocksScrubbed);
+    db->closeWithMerge(0);
+
+    // the delayed scrub does not hold up the close
+    options.scrubIntervalSeconds = 60;
+    db = Database::open("test/mydb",options);
+    start = std::chrono::steady_clock::now();
+    db->closeWithMerge(0);
+    BOOST_TEST((std::chrono::steady_clock::now()-start < std::chrono::seconds(10)));
+}
+
+BOOST_AUTO_TEST_CASE( database_subcompactions ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.minSubcompactionBytes = 256*1024;
+
+    auto countPartitions = [](){
+        int count = 0;
+        for(auto file : fs::directory_iterator("test/mydb")) {
+            auto name = file.path().filename().string();
+            if(name.starts_with("segment.") && std::count(name.begin(),name.end(),'.')==3) count++;
+        }
+        return count;
+    };
+
+    auto db = Database::open("test/mydb",options);
+    for(int pass=0;pass<2;pass++) {
+        for(int i=0;i<100000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i)+"."+std::to_string(pass));
+        db->remove(Slice("mykey"+std::to_string(pass)));
+        // subcompactions split using the key index of the disk segments
+        db->closeWithMerge(0);
+        db = Database::open("test/mydb",options);
+        db->closeWithMerge(1);
+        BOOST_TEST(countPartitions()>1);
+
+        db = Database::open("test/mydb",options);
+        BOOST_TEST(db->get("mykey"+std::to_string(pass)).empty());
+        BOOST_TEST(db->get("mykey50000")=="myvalue50000."+std::to_string(pass));
+        auto itr = db->lookup(Slice(),Slice());
+        int count = 0;
+        KeyValue kv;
+        while(!itr->next(kv).key.empty()) count++;
+        BOOST_TEST(count==99999);
+    }
+    db->closeWithMerge(0);
+}
+
+BOOST_AUTO_TEST_CASE( database_leveled ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.leveled = true;
+    options.levelBaseBytes = 1024*1024;
+    options.levelSizeRatio = 2;
+    options.levelSegmentBytes = 256*1024;
+
+    // the number of segment files in each level, from the manifest
+    auto levelFiles = [](){
+        std::map<int,int> files;
+        std::ifstream in("test/mydb/levels");
+        int level;
+        std::string name;
+        while(in >> level >> name) files[level]++;
+        return files;
+    };
+
+    auto db = Database::open("test/mydb",options);
+    for(int pass=0;pass<3;pass++) {
+        for(int i=0;i<100000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i)+"."+std::to_string(pass));
+        db->remove(Slice("mykey"+std::to_string(pass)));
+        db->close();
+
+        auto files = levelFiles();
+        BOOST_TEST(files[0]==0);
+        BOOST_TEST(files.size()>1);
+
+        db = Database::open("test/mydb",options);
+        BOOST_TEST(db->get("mykey"+std::to_string(pass)).empty());
+        BOOST_TEST(db->get("mykey50000")=="myvalue50000."+std::to_string(pass));
+        BOOST_TEST(db->get("mykey99999")=="myvalue99999."+std::to_string(pass));
+        auto itr = db->lookup(Slice(),Slice());
+        int count = 0;
+        KeyValue kv;
+        while(!itr->next(kv).key.empty()) count++;
+        BOOST_TEST(count==99999);
+    }
+    auto files = levelFiles();
+    BOOST_TEST(files.rbegin()->first>1);
+
+    // level 0 is written to the manifest when closing without a merge
+    db->put("another","value");
+    db->closeWithMerge(0);
+    BOOST_TEST(levelFiles()[0]==1);
+
+    // a leveled database remains leveled
+    options.leveled = false;
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("another")=="value");
+    BOOST_TEST(db->get("mykey50000")=="myvalue50000.2");
+    db->close();
+    BOOST_TEST(levelFiles()[0]==0);
+}
+
+BOOST_AUTO_TEST_CASE( database_leveled_move ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.leveled = true;
+    options.level0Segments = 2;
+
+    auto levelFiles = [](){
+        std::map<int,int> files;
+        std::ifstream in("test/mydb/levels");
+        int level;
+        std::string name;
+        while(in >> level >> name) files[level]++;
+        return files;
+    };
+    auto key = [](int i) {
+        char buffer[32];
+        snprintf(buffer,sizeof(buffer),"mykey%06d",i);
+        return std::string(buffer);
+    };
+
+    // sequentially loaded level 0 segments do not overlap
+    for(int s=0;s<3;s++) {
+        auto db = Database::open("test/mydb",options);
+        for(int i=s*1000;i<(s+1)*1000;i++) db->put(key(i),"myvalue"+std::to_string(i));
+        db->closeWithMerge(0);
+    }
+    BOOST_TEST(levelFiles()[0]==3);
+
+    // so they are moved to level 1 rather than merged into a single segment
+    options.disableAutoMerge = false;
+    auto db = Database::open("test/mydb",options);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    db->closeWithMerge(0);
+    auto files = levelFiles();
+    BOOST_TEST(files[0]==0);
+    BOOST_TEST(files[1]==3);
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get(key(0))=="myvalue0");
+    BOOST_TEST(db->get(key(1500))=="myvalue1500");
+    BOOST_TEST(db->get(key(2999))=="myvalue2999");
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_leveled_partitioned ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.minSubcompactionBytes = 64*1024;
+
+    auto countPartitions = [](){
+        int count = 0;
+        for(auto file : fs::directory_iterator("test/mydb")) {
+            auto name = file.path().filename().string();
+            if(name.starts_with("segment.") && std::count(name.begin(),name.end(),'.')==3) count++;
+        }
+        return count;
+    };
+
+    auto db = Database::open("test/mydb",options);
+    for(int pass=0;pass<2;pass++) {
+        for(int i=0;i<20000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i)+"."+std::to_string(pass));
+        db->closeWithMerge(0);
+        db = Database::open("test/mydb",options);
+    }
+    db->closeWithMerge(1);
+    BOOST_TEST(countPartitions()>1);
+
+    // the partitioned segment starts in level 0, and is rewritten rather than moved to level 1
+    options.leveled = true;
+    db = Database::open("test/mydb",options);
+    db->close();
+    std::map<int,int> files;
+    std::ifstream in("test/mydb/levels");
+    int level;
+    std::string name;
+    while(in >> level >> name) {
+        files[level]++;
+        BOOST_TEST(std::count(name.begin(),name.end(),'.')==2);
+    }
+    BOOST_TEST(files[0]==0);
+    BOOST_TEST(files[1]>0);
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey0")=="myvalue0.1");
+    BOOST_TEST(db->get("mykey19999")=="myvalue19999.1");
+    int count = 0;
+    auto itr = db->lookup("","");
+    while(!itr->next().key.empty()) count++;
+    BOOST_TEST(count==20000);
+    itr.reset();
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_rate_limiter ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.rateLimiter = std::make_shared<RateLimiter>(64*1024*1024,true);
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<100000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+    for(int i=0;i<1000;i++) BOOST_TEST(db->get("mykey"+std::to_string(i))=="myvalue"+std::to_string(i));
+    db->close();
+
+    // the segments written on close are counted by the limiter
+    auto stats = options.rateLimiter->getStats();
+    BOOST_TEST(stats.bytes > 1024*1024);
+}
+
+BOOST_AUTO_TEST_CASE( database_tombstones ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.minTombstones = 1000;
+
+    auto countSegments = [](){
+        int count = 0;
+        for(auto file : fs::directory_iterator("test/mydb")) {
+            if(file.path().filename().string().starts_with("segment.")) count++;
+        }
+        return count;
+    };
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<20000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+    db->closeWithMerge(0);
+
+    db = Database::open("test/mydb",options);
+    for(int i=0;i<15000;i++) db->remove(Slice("mykey"+std::to_string(i)));
+    db->closeWithMerge(0);
+    BOOST_TEST(countSegments()==2);
+
+    // the segment of deletions is merged with the older segment by the background merger, which
+    // removes the deletions
+    db = Database::open("test/mydb",options);
+    auto start = std::chrono::steady_clock::now();
+    while(countSegments()!=1 && std::chrono::steady_clock::now()-start < std::chrono::seconds(10)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_TEST(countSegments()==1);
+    db->closeWithMerge(0);
+    BOOST_TEST(countSegments()==1);
+
+    auto segments = DiskSegment::loadDiskSegments("test/mydb",options);
+    BOOST_REQUIRE(segments.size()==1);
+    uint64_t entries,deletes;
+    segments[0]->entryCounts(&entries,&deletes);
+    BOOST_TEST(entries==5000);
+    BOOST_TEST(deletes==0);
+    segments.clear();
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey7").empty());
+    BOOST_TEST(db->get("mykey15000")=="myvalue15000");
+    int count = 0;
+    auto itr = db->lookup("","");
+    while(!itr->next().key.empty()) count++;
+    BOOST_TEST(count==5000);
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_compaction_filter ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.compactionFilter = [](const Slice& key,const Slice& value,ByteBuffer& newValue) {
+        if(std::string_view(key).starts_with("tmp")) return FilterDecision::remove;
+        if(std::string_view(value).starts_with("old")) {
+            newValue = Slice("new");
+            return FilterDecision::change;
+        }
+        return FilterDecision::keep;
+    };
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<1000;i++) {
+        db->put("mykey"+std::to_string(i),(i%2==0 ? "old" : "myvalue")+std::to_string(i));
+        db->put("tmpkey"+std::to_string(i),"myvalue"+std::to_string(i));
+    }
+    BOOST_TEST(db->get("tmpkey7")=="myvalue7");
+    db->closeWithMerge(0);
+
+    // the filter is applied when the memory segment is written
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("tmpkey7").empty());
+    BOOST_TEST(db->get("mykey7")=="myvalue7");
+    BOOST_TEST(db->get("mykey8")=="new");
+    db->closeWithMerge(1);
+
+    db = Database::open("test/mydb",options);
+    int count = 0;
+    auto itr = db->lookup("","");
+    while(!itr->next().key.empty()) count++;
+    BOOST_TEST(count==1000);
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_compaction_filter_blobs ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.blobValueThreshold = 100;
+
+    auto value = [](int i,char c) { return std::string(1000,c)+std::to_string(i); };
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<100;i++) db->put("mykey"+std::to_string(i),value(i,i%2==0 ? 'a' : 'b'));
+    db->closeWithMerge(0);
+    db = Database::open("test/mydb",options);
+    for(int i=0;i<100;i++) db->put("tmpkey"+std::to_string(i),value(i,'a'));
+    db->closeWithMerge(0);
+
+    // the values in blob files are passed to the filter when the segments are merged
+    int filtered = 0;
+    options.compactionFilter = [&](const Slice& key,const Slice& value,ByteBuffer& newValue) {
+        filtered++;
+        if(std::string_view(key).starts_with("tmp")) return FilterDecision::remove;
+        if(std::string_view(value).starts_with("b")) {
+            newValue = Slice("new");
+            return FilterDecision::change;
+        }
+        return FilterDecision::keep;
+    };
+    db = Database::open("test/mydb",options);
+    db->closeWithMerge(1);
+    BOOST_TEST(filtered==200);
+
+    options.compactionFilter = nullptr;
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("tmpkey7").empty());
+    BOOST_TEST(db->get("mykey7")=="new");
+    BOOST_TEST(db->get("mykey8")==value(8,'a'));
+    int count = 0;
+    auto itr = db->lookup("","");
+    while(!itr->next().key.empty()) count++;
+    BOOST_TEST(count==100);
+    itr.reset();
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_ttl ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.ttlSeconds = 2;
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<1000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+    BOOST_TEST(db->get("mykey7")=="myvalue7");
+    db->closeWithMerge(0);
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey7")=="myvalue7");
+    WriteBatch batch;
+    batch.put("another","value");
+    db->write(batch);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+    db->put("mykey8","updated");
+
+    // expired values are not returned by reads
+    BOOST_TEST(db->get("mykey7").empty());
+    BOOST_TEST(db->get("another").empty());
+    BOOST_TEST(db->get("mykey8")=="updated");
+    {
+        KeyValue kv;
+        auto itr = db->lookup("mykey7","mykey7");
+        BOOST_TEST(itr->next(kv).key=="mykey7");
+        BOOST_TEST(kv.value.empty());
+        itr = db->lookup("mykey8","mykey8");
+        BOOST_TEST(itr->next(kv).value=="updated");
+    }
+    db->closeWithMerge(1);
+
+    // and are removed by merges
+    auto segments = DiskSegment::loadDiskSegments("test/mydb",options);
+    BOOST_REQUIRE(segments.size()==1);
+    uint64_t entries,deletes;
+    segments[0]->entryCounts(&entries,&deletes);
+    BOOST_TEST(entries==1);
+    segments.clear();
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey8")=="updated");
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_ttl_blobs ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.blobValueThreshold = 100;
+    options.ttlSeconds = 1;
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<100;i++) db->put("mykey"+std::to_string(i),std::string(200,'a'));
+    db->closeWithMerge(0);
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey7")==std::string(200,'a'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    db->put("mykey8",std::string(200,'b'));
+    BOOST_TEST(db->get("mykey7").empty());
+    db->closeWithMerge(1);
+
+    // the values stored in blob files are removed by merges too
+    auto segments = DiskSegment::loadDiskSegments("test/mydb",options,std::make_shared<BlobStore>("test/mydb"));
+    BOOST_REQUIRE(segments.size()==1);
+    uint64_t entries,deletes;
+    segments[0]->entryCounts(&entries,&deletes);
+    BOOST_TEST(entries==1);
+    segments.clear();
+
+    // a database written with a TTL cannot be opened without one
+    options.ttlSeconds = 0;
+    BOOST_CHECK_THROW(Database::open("test/mydb",options),DatabaseOpenFailed);
+    // but the TTL may change
+    options.ttlSeconds = 60;
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey8")==std::string(200,'b'));
+
+    // nor can segments written without a TTL be ingested
+    fs::create_directories("test/myingest");
+    {
+        SegmentWriter writer("test/myingest/file",Options());
+        writer.put("mykey9","myvalue");
+        writer.finish();
+    }
+    BOOST_CHECK_THROW(db->ingest({"test/myingest/file"}),DatabaseException);
+    BOOST_TEST(db->get("mykey9").empty());
+    db->close();
+    fs::remove_all("test/myingest");
+}
+
+BOOST_AUTO_TEST_CASE( database_compact_range ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+
+    auto countRange = [](DatabaseRef db,const Slice& lower,const Slice& upper) {
+        int count = 0;
+        auto itr = db->lookup(lower,upper);
+        while(!itr->next().key.empty()) count++;
+        return count;
+    };
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<1000;i++) {
+        db->put("a"+std::to_string(i),"myvalue"+std::to_string(i));
+        db->put("b"+std::to_string(i),"myvalue"+std::to_string(i));
+    }
+    db->closeWithMerge(0);
+
+    db = Database::open("test/mydb",options);
+    for(int i=0;i<1000;i++) db->remove(Slice("b"+std::to_string(i)));
+    db->closeWithMerge(0);
+
+    // the deletions of the range are returned by lookups until the range is compacted
+    db = Database::open("test/mydb",options);
+    db->put("c1","myvalue1");
+    BOOST_TEST(countRange(db,"b","b~")==1000);
+    uint64_t progressBytes = 0, progressTotal = 0;
+    db->compactRange("b","b~",[&](uint64_t bytes,uint64_t total) {
+        progressBytes = bytes;
+        progressTotal = total;
+    });
+    BOOST_TEST(progressTotal > 0);
+    BOOST_TEST(progressBytes==progressTotal);
+    BOOST_TEST(countRange(db,"b","b~")==0);
+    BOOST_TEST(countRange(db,"a","a~")==1000);
+    BOOST_TEST(db->get("c1")=="myvalue1");
+    db->close();
+
+    // the deletions are also removed when only segments outside of the range are older
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+    db = Database::open("test/mydb",options);
+    db->put("a1","myvalue1");
+    db->closeWithMerge(0);
+    db = Database::open("test/mydb",options);
+    db->remove(Slice("a2"));
+    for(int i=0;i<1000;i++) db->put("b"+std::to_string(i),"myvalue"+std::to_string(i));
+    db->closeWithMerge(0);
+    db = Database::open("test/mydb",options);
+    for(int i=0;i<1000;i++) db->remove(Slice("b"+std::to_string(i)));
+    db->compactRange("b","b~");
+    BOOST_TEST(countRange(db,"b","b~")==0);
+    BOOST_TEST(countRange(db,"a","a~")==1);
+    db->close();
+
+    // but not when an older segment holds keys of the merged segments
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+    db = Database::open("test/mydb",options);
+    db->put("a1","myvalue1");
+    db->closeWithMerge(0);
+    db = Database::open("test/mydb",options);
+    db->remove(Slice("a1"));
+    for(int i=0;i<1000;i++) db->put("b"+std::to_string(i),"myvalue"+std::to_string(i));
+    db->closeWithMerge(0);
+    db = Database::open("test/mydb",options);
+    for(int i=0;i<1000;i++) db->remove(Slice("b"+std::to_string(i)));
+    db->compactRange("b","b~");
+    BOOST_TEST(countRange(db,"b","b~")==1000);
+    {
+        KeyValue kv;
+        auto itr = db->lookup("a1","a1");
+        BOOST_TEST(itr->next(kv).key=="a1");
+        BOOST_TEST(kv.value.empty());
+    }
+    db->close();
+
+    // a leveled database compacts the range into the deepest level
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+    options.leveled = true;
+    db = Database::open("test/mydb",options);
+    for(int i=0;i<1000;i++) db->put("b"+std::to_string(i),"myvalue"+std::to_string(i));
+    db->closeWithMerge(0);
+    db = Database::open("test/mydb",options);
+    for(int i=0;i<1000;i++) db->remove(Slice("b"+std::to_string(i)));
+    db->compactRange("b","b~");
+    BOOST_TEST(countRange(db,"b","b~")==0);
+    db->put("c1","myvalue1");
+    db->closeWithMerge(0);
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(countRange(db,"b","b~")==0);
+    BOOST_TEST(db->get("c1")=="myvalue1");
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_concurrent_merges ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.maxBackgroundMerges = 4;
+
+    // every segment overwrites the values of the previous ones, so the merges of disjoint runs must
+    // keep the segments in order
+    for(int i=0;i<40;i++) {
+        auto db = Database::open("test/mydb",options);
+        for(int j=0;j<1000;j++) {
+            db->put("mykey"+std::to_string(j),"myvalue"+std::to_string(i));
+        }
+        if(i%10==0) db->put("other"+std::to_string(i),"myvalue");
+        db->closeWithMerge(0);
+    }
+
+    auto db = Database::open("test/mydb",options);
+    db->closeWithMerge(3);
+    int files = 0;
+    for(auto file : fs::directory_iterator("test/mydb")) {
+        if(file.path().filename().string().starts_with("segment.")) files++;
+    }
+    BOOST_TEST(files<=3);
+
+    db = Database::open("test/mydb",options);
+    {
+        int count = 0;
+        auto itr = db->lookup("","");
+        KeyValue kv;
+        while(!itr->next(kv).key.empty()) {
+            if(std::string_view(Slice(kv.key)).starts_with("mykey")) BOOST_TEST(kv.value=="myvalue39");
+            count++;
+        }
+        BOOST_TEST(count==1004);
+    }
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_background_merges ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.maxBackgroundMerges = 4;
+
+    auto countSegments = [](){
+        int count = 0;
+        for(auto file : fs::directory_iterator("test/mydb")) {
+            if(file.path().filename().string().starts_with("segment.")) count++;
+        }
+        return count;
+    };
+
+    for(int i=0;i<40;i++) {
+        auto db = Database::open("test/mydb",options);
+        for(int j=0;j<1000;j++) {
+            db->put("mykey"+std::to_string(j),"myvalue"+std::to_string(i));
+        }
+        db->closeWithMerge(0);
+    }
+
+    // each run is merged and installed by its own job, and the merges continue until the segments
+    // are within maxSegments
+    options.disableAutoMerge = false;
+    auto db = Database::open("test/mydb",options);
+    auto start = std::chrono::steady_clock::now();
+    while(countSegments()>8 && std::chrono::steady_clock::now()-start < std::chrono::seconds(20)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_TEST(countSegments()<=8);
+    {
+        int count = 0;
+        auto itr = db->lookup("","");
+        KeyValue kv;
+        while(!itr->next(kv).key.empty()) {
+            BOOST_TEST(kv.value=="myvalue39");
+            count++;
+        }
+        BOOST_TEST(count==1000);
+    }
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_compaction_policy ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+
+    // a large segment followed by small ones
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<50000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+    db->closeWithMerge(0);
+    for(int i=0;i<12;i++) {
+        db = Database::open("test/mydb",options);
+        for(int j=0;j<100;j++) db->put("other"+std::to_string(i*100+j),"myvalue");
+        db->closeWithMerge(0);
+    }
+
+    auto policy = std::make_shared<SizeRatioPolicy>();
+    options.compactionPolicy = policy;
+    options.maxBackgroundMerges = 1;
+    db = Database::open("test/mydb",options);
+    db->closeWithMerge(8);
+
+    // only the small segments were merged, so little more than the flushed bytes were written
+    auto stats = policy->getStats();
+    BOOST_TEST(stats.merges==1);
+    BOOST_TEST(stats.inputBytes==stats.freshBytes);
+    BOOST_TEST(stats.writeAmplification < 1.5);
+
+    db = Database::open("test/mydb",options);
+    {
+        int count = 0;
+        auto itr = db->lookup("","");
+        while(!itr->next().key.empty()) count++;
+        BOOST_TEST(count==51200);
+    }
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_shared_scheduler ) {
+    Options options(true);
+    options.scheduler = std::make_shared<JobScheduler>(2);
+
+    auto countFiles = [](const std::string& path) {
+        int count = 0;
+        for(auto file : fs::directory_iterator(path)) {
+            if(file.path().filename().string().starts_with("segment.")) count++;
+        }
+        return count;
+    };
+
+    // both databases are merged in the background by the threads of the shared scheduler
+    std::vector<DatabaseRef> dbs;
+    for(auto path : {"test/mydb","test/mydb2"}) {
+        try { Database::remove(std::string(path)); } catch(DatabaseNotFound){}
+        dbs.push_back(Database::open(path,options));
+    }
+    std::string value(100,'x');
+    for(int i=0;i<150000;i++) {
+        for(auto& db : dbs) db->put("mykey"+std::to_string(i),value);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+    for(auto& db : dbs) db->closeWithMerge(0);
+    BOOST_TEST(countFiles("test/mydb") <= 10);
+    BOOST_TEST(countFiles("test/mydb2") <= 10);
+
+    for(auto path : {"test/mydb","test/mydb2"}) {
+        auto db = Database::open(path,options);
+        BOOST_TEST(db->get("mykey149999")==value);
+        db->close();
+    }
+    dbs.clear();
+    Database::remove(std::string("test/mydb2"));
+}
+
+BOOST_AUTO_TEST_CASE( database_background_deletion ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+
+    auto countFiles = [](const std::string& prefix) {
+        int count = 0;
+        for(auto file : fs::directory_iterator("test/mydb")) {
+            if(file.path().filename().string().starts_with(prefix)) count++;
+        }
+        return count;
+    };
+
+    for(int i=0;i<4;i++) {
+        auto db = Database::open("test/mydb",options);
+        for(int j=0;j<1000;j++) db->put("mykey"+std::to_string(j),"myvalue"+std::to_string(i));
+        db->closeWithMerge(0);
+    }
+    BOOST_TEST(countFiles("segment.")==4);
+
+    // the merged segments are deleted in the background once no snapshot references them
+    auto db = Database::open("test/mydb",options);
+    auto snapshot = db->snapshot();
+    db->compactRange("","");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    BOOST_TEST(countFiles("segment.")==5);
+    BOOST_TEST(snapshot->get("mykey1")=="myvalue3");
+    snapshot.reset();
+
+    auto start = std::chrono::steady_clock::now();
+    while(countFiles("segment.")+countFiles("deleting.")>1 && std::chrono::steady_clock::now()-start < std::chrono::seconds(5)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_TEST(countFiles("segment.")==1);
+    BOOST_TEST(countFiles("deleting.")==0);
+    auto stats = db->deleterStats();
+    BOOST_TEST(stats.deletedFiles==4);
+    BOOST_TEST(stats.pendingBytes==0);
+    BOOST_TEST(db->get("mykey1")=="myvalue3");
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_manifest ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+
+    for(int i=0;i<3;i++) {
+        auto db = Database::open("test/mydb",options);
+        for(int j=0;j<1000;j++) db->put("mykey"+std::to_string(j),"myvalue"+std::to_string(i));
+        db->closeWithMerge(0);
+    }
+    // the manifest lists the flushed segments when the database is closed
+    auto entries = Manifest::load("test/mydb");
+    BOOST_TEST(entries.size()==3);
+
+    // and the merged segment after a merge
+    auto db = Database::open("test/mydb",options);
+    db->compactRange("","");
+    entries = Manifest::load("test/mydb");
+    BOOST_REQUIRE(entries.size()==1);
+    BOOST_TEST(entries.begin()->first=="segment.1.3");
+    BOOST_TEST(entries.begin()->second.metadata.keyCount==1000);
+    db->close();
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey1")=="myvalue2");
+    db->close();
+
+    // without the manifest the segments are read from their files
+    fs::remove(Manifest::filename("test/mydb"));
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey999")=="myvalue2");
+    db->close();
+    BOOST_TEST(fs::exists(Manifest::filename("test/mydb")));
+}
+
+BOOST_AUTO_TEST_CASE( database_max_open_files ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.maxOpenFiles = 2;
+
+    for(int i=0;i<5;i++) {
+        auto db = Database::open("test/mydb",options);
+        for(int j=0;j<1000;j++) db->put("mykey"+std::to_string(i*1000+j),"myvalue"+std::to_string(i));
+        db->closeWithMerge(0);
+    }
+
+    // the segments are only mapped when they are read, and at most 2 stay mapped
+    auto db = Database::open("test/mydb",options);
+    BOOST_TEST(db->fileCacheStats().openFiles==0);
+    for(int i=0;i<5;i++) {
+        BOOST_TEST(db->get("mykey"+std::to_string(i*1000+500))=="myvalue"+std::to_string(i));
+    }
+    auto stats = db->fileCacheStats();
+    BOOST_TEST(stats.openFiles==2);
+    BOOST_TEST(stats.evictions>=3);
+
+    // an iterator keeps the segments it reads mapped
+    int count = 0;
+    auto itr = db->lookup("","");
+    while(!itr->next().key.empty()) count++;
+    BOOST_TEST(count==5000);
+    itr.reset();
+    BOOST_TEST(db->get("mykey1")=="myvalue0");
+    BOOST_TEST(db->fileCacheStats().openFiles<=2);
+    BOOST_TEST(db->fileCacheStats().hits>0);
+    db->close();
+}
+
+BOOST_AUTO_TEST_CASE( database_checkpoint ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+    fs::remove_all("test/mycheckpoint");
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.blobValueThreshold = 100;
+    std::string large(200,'x');
+
+    for(int i=0;i<2;i++) {
+        auto db = Database::open("test/mydb",options);
+        for(int j=0;j<1000;j++) db->put("mykey"+std::to_string(i*1000+j),"myvalue"+std::to_string(i));
+        db->put("mylarge"+std::to_string(i),large);
+        db->closeWithMerge(0);
+    }
+
+    auto db = Database::open("test/mydb",options);
+    db->put("mykey1","myvalue2");
+    db->put("mykey3000","myvalue3000");
+    db->checkpoint("test/mycheckpoint");
+    BOOST_CHECK_THROW(db->checkpoint("test/mycheckpoint"),DatabaseException);
+
+    // the segment files are shared with the database
+    int links = 0;
+    for(auto& file : fs::directory_iterator("test/mycheckpoint")) {
+        auto name = file.path().filename().string();
+        if(name.starts_with("segment.") || name.starts_with("blob.")) {
+            if(fs::hard_link_count(file.path())==2) links++;
+        }
+    }
+    BOOST_TEST(links==4);
+
+    // later writes and merges of the database do not change the checkpoint
+    db->put("mykey1","myvalue3");
+    db->remove(Slice("mykey3000"));
+    db->compactRange("","");
+    db->close();
+
+    auto copy = Database::open("test/mycheckpoint",Options());
+    BOOST_TEST(copy->get("mykey1")=="myvalue2");
+    BOOST_TEST(copy->get("mykey3000")=="myvalue3000");
+    BOOST_TEST(copy->get("mykey1999")=="myvalue1");
+    BOOST_TEST(copy->get("mylarge1")==large);
+    copy->close();
+
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey1")=="myvalue3");
+    BOOST_TEST(db->get("mykey3000").empty());
+    BOOST_TEST(db->get("mylarge0")==large);
+    db->close();
+    Database::remove("test/mycheckpoint");
+}
+
+BOOST_AUTO_TEST_CASE( database_checkpoint_leveled ) {
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+    fs::remove_all("test/mycheckpoint");
+
+    Options options(true);
+    options.disableAutoMerge = true;
+    options.leveled = true;
+    options.levelBaseBytes = 1024*1024;
+    options.levelSizeRatio = 2;
+    options.levelSegmentBytes = 256*1024;
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<100000;i++) db->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+    db->close();
+
+    db = Database::open("test/mydb",options);
+    db->put("mykey1","updated");
+    db->checkpoint("test/mycheckpoint");
+
+    // the checkpoint keeps the levels, with the memory segment in level 0
+    BOOST_TEST(!fs::exists("test/mycheckpoint/manifest"));
+    std::map<int,int> levelFiles;
+    {
+        std::ifstream in("test/mycheckpoint/levels");
+        int level;
+        std::string name;
+        while(in >> level >> name) {
+            levelFiles[level]++;
+            BOOST_TEST(fs::exists("test/mycheckpoint/"+name));
+        }
+    }
+    BOOST_TEST(levelFiles[0]==1);
+    BOOST_TEST(levelFiles.rbegin()->first>1);
+
+    db->put("mykey1","later");
+    db->remove(Slice("mykey2"));
+    db->compactRange("","");
+    db->close();
+
+    auto copy = Database::open("test/mycheckpoint",options);
+    BOOST_TEST(copy->get("mykey1")=="updated");
+    BOOST_TEST(copy->get("mykey2")=="myvalue2");
+    BOOST_TEST(copy->get("mykey99999")=="myvalue99999");
+    int count = 0;
+    auto itr = copy->lookup(Slice(),Slice());
+    while(!itr->next().key.empty()) count++;
+    BOOST_TEST(count==100000);
+    copy->close();
+    Database::remove("test/mycheckpoint");
+}
+
+BOOST_AUTO_TEST_CASE( database_ingest ) {
+    for(bool leveled : {false,true}) {
+        try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+        fs::remove_all("test/myingest");
+        fs::create_directories("test/myingest");
+
+        Options options(true);
+        options.disableAutoMerge = true;
+        options.leveled = leveled;
+
+        std::vector<std::string> files;
+        for(int i=0;i<2;i++) {
+            files.push_back("test/myingest/file"+std::to_string(i));
+            SegmentWriter writer(files.back(),options);
+            for(int j=0;j<999;j++) writer.put("mykey"+std::to_string(1000+j),"myvalue"+std::to_string(i));
+            writer.remove("mykey1999");
+            writer.finish();
+        }
+        {
+            SegmentWriter writer("test/myingest/empty",options);
+            writer.finish();
+        }
+        std::ofstream("test/myingest/invalid") << "not a segment";
+
+        auto db = Database::open("test/mydb",options);
+        db->put("mykey1000","myvalue");
+        db->put("mykey2000","myvalue");
+        BOOST_CHECK_THROW(db->ingest({files[0],"test/myingest/invalid"}),DatabaseException);
+        BOOST_TEST(db->get("mykey1001").empty());
+        // the staged files of a failed ingest are removed
+        for(auto& file : fs::directory_iterator("test/mydb")) {
+            BOOST_TEST(!file.path().filename().string().starts_with("ingesting."));
+        }
+
+        files.push_back("test/myingest/empty");
+        db->ingest(files);
+        // the files are linked, not moved
+        BOOST_TEST(fs::exists(files[0]));
+        // and rebuilding a file replaces it, so the ingested segment is unchanged
+        {
+            SegmentWriter writer(files[0],options);
+            writer.put("mykey1000","rebuilt");
+            writer.finish();
+        }
+        // the ingested segments are newer than the earlier writes, and the later files take precedence
+        BOOST_TEST(db->get("mykey1000")=="myvalue1");
+        BOOST_TEST(db->get("mykey1998")=="myvalue1");
+        BOOST_TEST(db->get("mykey1999").empty());
+        BOOST_TEST(db->get("mykey2000")=="myvalue");
+        // the writes after the ingest are newer than the ingested segments
+        db->put("mykey1001","myvalue2");
+        BOOST_TEST(db->get("mykey1001")=="myvalue2");
+        db->closeWithMerge(0);
+
+        db = Database::open("test/mydb",options);
+        BOOST_TEST(db->get("mykey1000")=="myvalue1");
+        BOOST_TEST(db->get("mykey1001")=="myvalue2");
+        BOOST_TEST(db->get("mykey1999").empty());
+        // the lookup returns the deletion as an empty value
+        int count = 0;
+        auto itr = db->lookup("","");
+        KeyValue kv;
+        while(!itr->next(kv).key.empty()) {
+            if(!kv.value.empty()) count++;
+        }
+        BOOST_TEST(count==1000);
+        db->close();
+
+        db = Database::open("test/mydb",options);
+        BOOST_TEST(db->get("mykey1000")=="myvalue1");
+        BOOST_TEST(db->get("mykey1001")=="myvalue2");
+        BOOST_TEST(db->get("mykey2000")=="myvalue");
+        db->close();
+    }
+
+    // an ingest interrupted after its files were validated is completed by the next open, and the
+    // files staged by an ingest that was not are removed
+    Database::remove("test/mydb");
+    Options options(true);
+    options.disableAutoMerge = true;
+    auto db = Database::open("test/mydb",options);
+    db->put("mykey1000","myvalue");
+    db->closeWithMerge(0);
+    std::ofstream("test/mydb/ingest") << "ingesting.1.1 segment.1000.1000\ningesting.2.2 segment.1001.1001\n";
+    fs::copy_file("test/myingest/file1","test/mydb/segment.1000.1000");
+    fs::copy_file("test/myingest/file0","test/mydb/ingesting.2.2");
+    fs::copy_file("test/myingest/file1","test/mydb/ingesting.3.3");
+    db = Database::open("test/mydb",options);
+    BOOST_TEST(db->get("mykey1000")=="rebuilt");
+    BOOST_TEST(db->get("mykey1001")=="myvalue1");
+    BOOST_TEST(!fs::exists("test/mydb/ingest"));
+    BOOST_TEST(!fs::exists("test/mydb/ingesting.3.3"));
+    db->close();
+    fs::remove_all("test/myingest");
+}
@@ -4,6 +4,7 @@
 #include "memorysegment.h"
 #include "multisegment.h"
 #include "segment.h"
+#include "compactionfilter.h"
 
 ByteBuffer Database::get(const Slice& key) {
     ByteBuffer buffer;
@@ -11,27 +12,44 @@ ByteBuffer Database::get(const Slice& key) {
 }
 
 ByteBuffer& Database::get(const Slice& key,ByteBuffer& value) {
+    return get(key,value,ReadOptions());
+}
+
+ByteBuffer& Database::get(const Slice& key,ByteBuffer& value,const ReadOptions& readOptions) {
     if(!_open) throw DatabaseClosed();
     checkKey(key);
-    return getState()->multi->get(key,value);
+    auto limiter = options.rateLimiter.get();
+    if(limiter==nullptr || !limiter->sampleLatency()) {
+        getState()->multi->get(key,value,readOptions);
+    } else {
+        // the latency of foreground gets tunes the rate of background writes
+        auto start = std::chrono::steady_clock::now();
+        getState()->multi->get(key,value,readOptions);
+        limiter->recordLatency(std::chrono::steady_clock::now()-start);
+    }
+    if(options.ttlSeconds > 0) removeWriteTime(value,options.ttlSeconds,currentWriteTime());
+    return value;
 }
 
 void Database::maybeMerge() {
     if(options.disableAutoMerge) return;
     auto state = getState();
     if(state->segments.size()> 2*options.maxSegments) {
-        merger.wakeup();
+        merger.wakeup(this);
     }
 }
 
 void Database::maybeSwapMemory() {
+    if(getState()->memory->size() > options.maxMemoryBytes) swapMemory();
+}
+
+void Database::swapMemory() {
     auto state = getState();
-    if(state->memory->size() > options.maxMemoryBytes) {
-        auto segments = copyAndAppend(state->segments,state->memory);
-        auto memory = MemorySegment::newMemorySegment(path,nextSegmentID(),options);
-        auto multi = MultiSegment::newMultiSegment(copyAndAppend(segments,memory));
-        setState(DatabaseState(segments,memory,multi));
-    }
+    auto segments = copyAndAppend(state->segments,state->memory);
+    auto memory = MemorySegment::newMemorySegment(path,nextSegmentID(),options);
+    auto multi = MultiSegment::newMultiSegment(copyAndAppend(segments,memory));
+    setState(DatabaseState(segments,memory,multi,state->levels));
+    if(!options.disableAutoMerge) merger.wakeup(this);
 }
 
 void Database::put(const Slice& key,const Slice& value) {
@@ -42,7 +60,13 @@ void Database::put(const Slice& key,const Slice& value) {
 
     maybeSwapMemory();
 
-    getState()->memory->put(key,value);
+    if(options.ttlSeconds > 0) {
+        ByteBuffer stored;
+        appendWriteTime(stored,value,currentWriteTime());
+        getState()->memory->put(key,stored);
+    } else {
+        getState()->memory->put(key,value);
+    }
 
     DB_UNLOCK();
 
@@ -72,7 +96,18 @@ void Database::write(const WriteBatch& batch) {
         DB_LOCK();
         if(!_open) throw DatabaseClosed();
         maybeSwapMemory();
-        getState()->memory.memory()->write(batch);
+        if(options.ttlSeconds > 0) {
+            WriteBatch stored;
+            ByteBuffer value;
+            auto now = currentWriteTime();
+            for(auto& kv : batch.entries) {
+                appendWriteTime(value,kv.value,now);
+                stored.put(kv.key,value);
+            }
+            getState()->memory.memory()->write(stored);
+        } else {
+            getState()->memory.memory()->write(batch);
+        }
     }
     maybeMerge();
 }
@@ -82,6 +117,40 @@ LookupRef Database::lookup(const Slice& lower,const Slice& upper) {
     return snapshot->lookup(lower,upper);
 }
 
+LookupRef Database::lookup(const Slice& lower,const Slice& upper,const ReadOptions& readOptions) {
+    auto snapshot = Database::snapshot();
+    return snapshot->lookup(lower,upper,readOptions);
+}
+
+void Database::compactRange(const Slice& lower,const Slice& upper,const CompactionProgress& progress) {
+    if(!_open) throw DatabaseClosed();
+    UseWaitGroup use(wg);
+    {
+        DB_LOCK();
+        // the writes made before the call are included in the compaction
+        if(getState()->memory->size() > 0) swapMemory();
+    }
+    merger.compactRange(this,lower,upper,progress);
+    // background merges that found the merger busy were skipped
+    if(!options.disableAutoMerge) merger.wakeup(this);
+}
+
+ScrubStats Database::scrub() {
+    if(!_open) throw DatabaseClosed();
+    scrubber.scrub(this,false);
+    return scrubber.getStats();
+}
+
+uint64_t Database::approximateSize(const Slice& lower,const Slice& upper) {
+    if(!_open) throw DatabaseClosed();
+    return getState()->multi->estimateRange(lower,upper).bytes;
+}
+
+uint64_t Database::approximateCount(const Slice& lower,const Slice& upper) {
+    if(!_open) throw DatabaseClosed();
+    return getState()->multi->estimateRange(lower,upper).count;
+}
+
 SnapshotRef Database::snapshot() {
     DB_LOCK();
     if(!_open) throw DatabaseClosed();
@@ -91,7 +160,8 @@ SnapshotRef Database::snapshot() {
     auto memory = MemorySegment::newMemorySegment(path,nextSegmentID(),options);
     auto multi = MultiSegment::newMultiSegment(copyAndAppend(segments,memory));
 
-    setState(DatabaseState(segments,memory,multi));
+    setState(DatabaseState(segments,memory,multi,state->levels));
+    if(!options.disableAutoMerge) merger.wakeup(this);
 
     return SnapshotRef(new Snapshot(DatabaseRef(weakRef),MultiSegment::newMultiSegment(segments)));
 }
@@ -0,0 +1,147 @@
+#include <algorithm>
+
+#include "deleter.h"
+
+// large files are truncated by this many bytes at a time before they are unlinked, so that the
+// file system frees their blocks in bounded steps
+static const uint64_t truncateStep = 16 * 1024 * 1024;
+static const std::string deletingPrefix = "deleting.";
+
+void Deleter::scheduleDeletion(std::vector<std::string>& files) {
+    if(dbpath=="") return;
+    std::lock_guard<std::mutex> lock(mtx);
+    if(!file.is_open()) {
+        file.open(dbpath+"/deleted",std::ios::out | std::ios::app);
+    }
+    for(auto f : files) {
+        file << f << "\n";
+    }
+    file.flush();
+}
+
+/**
+ * @brief rename a file to deleting.* and add it to the pending files, called with the lock held
+ */
+void Deleter::queue(const std::string& name) {
+    std::error_code ec;
+    auto renamed = name.starts_with(deletingPrefix) ? name : deletingPrefix+name;
+    if(renamed!=name) {
+        fs::rename(dbpath+"/"+name,dbpath+"/"+renamed,ec);
+        if(ec) return;
+    } else if(std::find(pending.begin(),pending.end(),name)!=pending.end()) {
+        return;
+    }
+    auto size = fs::file_size(dbpath+"/"+renamed,ec);
+    if(ec) return;
+    pending.push_back(renamed);
+    stats.pendingFiles++;
+    stats.pendingBytes += size;
+}
+
+void Deleter::deleteScheduled() {
+    if(dbpath=="") return;
+    std::lock_guard<std::mutex> lock(mtx);
+    if(file.is_open()) file.close();
+    std::fstream in;
+    in.open(dbpath+"/deleted",std::ios::in);
+    std::string entry;
+    while(std::getline(in,entry)) {
+        if(fs::exists(dbpath+"/"+entry)) queue(entry);
+    }
+    in.close();
+    for(auto& f : fs::directory_iterator(dbpath)) {
+        auto name = f.path().filename().string();
+        if(name.starts_with(deletingPrefix)) queue(name);
+    }
+    fs::remove(dbpath+"/deleted");
+    if(!pending.empty() && wakeup && !scheduled) {
+        scheduled = true;
+        wakeup(std::chrono::microseconds(0));
+    }
+}
+
+void Deleter::remove(const std::vector<std::string>& files) {
+    if(dbpath=="") return;
+    std::lock_guard<std::mutex> lock(mtx);
+    for(auto& f : files) queue(f);
+    // the wakeup is called with the lock held, so that it is not called once stop() returns
+    if(!pending.empty() && wakeup && !scheduled) {
+        scheduled = true;
+        wakeup(std::chrono::microseconds(0));
+    }
+}
+
+void Deleter::start(std::function<void(std::chrono::microseconds)> wakeup,int64_t bytesPerSecond) {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = false;
+    this->wakeup = wakeup;
+    limiter.reset(bytesPerSecond > 0 ? new RateLimiter(bytesPerSecond) : nullptr);
+    if(!pending.empty() && !scheduled) {
+        scheduled = true;
+        wakeup(std::chrono::microseconds(0));
+    }
+}
+
+void Deleter::stop() {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+    wakeup = nullptr;
+}
+
+/**
+ * @brief truncate a pending file by one step, or unlink it once it is no larger than a step,
+ * taking the bytes from the limiter
+ *
+ * @param wait set to the time to wait before the next step
+ * @return true if the file was unlinked
+ */
+bool Deleter::deleteStep(const std::string& name,std::chrono::microseconds& wait) {
+    auto path = dbpath+"/"+name;
+    std::error_code ec;
+    uint64_t size = fs::file_size(path,ec);
+    if(ec) return true;
+    uint64_t step = std::min(size,truncateStep);
+    if(limiter) wait = limiter->reserve(step);
+    size -= step;
+    if(size==0) {
+        fs::remove(path,ec);
+    } else {
+        fs::resize_file(path,size,ec);
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    stats.pendingBytes -= std::min(stats.pendingBytes,step);
+    stats.deletedBytes += step;
+    return size==0 || ec;
+}
+
+void Deleter::deletePending() {
+    while(true) {
+        std::string name;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if(stopping || pending.empty()) {
+                scheduled = false;
+                return;
+            }
+            // only one deletePending() runs at a time, so the front stays queued until it is deleted
+            name = pending.front();
+        }
+        std::chrono::microseconds wait(0);
+        bool deleted = deleteStep(name,wait);
+        std::lock_guard<std::mutex> lock(mtx);
+        if(deleted) {
+            pending.pop_front();
+            stats.pendingFiles--;
+            stats.deletedFiles++;
+        }
+        if(wait.count() > 0 && !pending.empty() && wakeup) {
+            wakeup(wait);
+            return;
+        }
+    }
+}
+
+DeleterStats Deleter::getStats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return stats;
+}
@@ -0,0 +1,130 @@
+#define BOOST_TEST_MODULE deleter
+#include <boost/test/included/unit_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "deleter.h"
+
+using namespace std::chrono;
+
+static const std::string dir = "test/deleter";
+
+static void createFile(const std::string& name,uint64_t size) {
+    std::ofstream out(dir+"/"+name);
+    out << "x";
+    out.close();
+    fs::resize_file(dir+"/"+name,size);
+}
+
+static int countFiles(const std::string& prefix) {
+    int count = 0;
+    for(auto& f : fs::directory_iterator(dir)) {
+        if(f.path().filename().string().starts_with(prefix)) count++;
+    }
+    return count;
+}
+
+BOOST_AUTO_TEST_CASE( deleter_scheduled ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    createFile("segment.1.1",1000);
+    createFile("segment.2.2",2000);
+    createFile("segment.3.3",3000);
+
+    {
+        Deleter deleter(dir);
+        std::vector<std::string> files = {"segment.1.1","segment.2.2"};
+        deleter.scheduleDeletion(files);
+    }
+
+    // the logged files are renamed when the database is opened, and deleted in the background
+    Deleter deleter(dir);
+    deleter.deleteScheduled();
+    BOOST_TEST(countFiles("segment.")==1);
+    BOOST_TEST(countFiles("deleting.")==2);
+    BOOST_TEST(!fs::exists(dir+"/deleted"));
+    auto stats = deleter.getStats();
+    BOOST_TEST(stats.pendingFiles==2);
+    BOOST_TEST(stats.pendingBytes==3000);
+
+    int wakeups = 0;
+    deleter.start([&](microseconds) { wakeups++; },0);
+    BOOST_TEST(wakeups==1);
+    deleter.deletePending();
+    BOOST_TEST(countFiles("deleting.")==0);
+    stats = deleter.getStats();
+    BOOST_TEST(stats.pendingFiles==0);
+    BOOST_TEST(stats.pendingBytes==0);
+    BOOST_TEST(stats.deletedFiles==2);
+    BOOST_TEST(stats.deletedBytes==3000);
+
+    // files of removed segments are queued with a single wakeup until they are deleted
+    deleter.remove({"segment.3.3"});
+    deleter.remove({"segment.4.4"});
+    BOOST_TEST(wakeups==2);
+    BOOST_TEST(deleter.getStats().pendingFiles==1);
+    deleter.deletePending();
+    BOOST_TEST(countFiles("")==0);
+}
+
+BOOST_AUTO_TEST_CASE( deleter_throttled ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    createFile("segment.1.1",48*1024*1024);
+
+    // each step that exceeds the rate schedules the next step after the wait, instead of sleeping
+    Deleter deleter(dir);
+    std::vector<microseconds> delays;
+    deleter.start([&](microseconds delay) { delays.push_back(delay); },64*1024*1024);
+    deleter.remove({"segment.1.1"});
+    BOOST_TEST(delays.size()==1);
+    auto start = steady_clock::now();
+    deleter.deletePending();
+    BOOST_REQUIRE(delays.size()==2);
+    BOOST_TEST(delays.back().count() > 0);
+    for(int i=0;i<10 && countFiles("")>0;i++) {
+        std::this_thread::sleep_for(delays.back());
+        deleter.deletePending();
+    }
+    auto elapsed = duration_cast<milliseconds>(steady_clock::now()-start).count();
+    BOOST_TEST(delays.size()==3);
+    BOOST_TEST(elapsed >= 500);
+    BOOST_TEST(countFiles("")==0);
+    BOOST_TEST(deleter.getStats().deletedBytes==48*1024*1024);
+}
+
+BOOST_AUTO_TEST_CASE( deleter_stop ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    createFile("segment.1.1",64*1024*1024);
+
+    Deleter deleter(dir);
+    std::atomic<int64_t> delay{0};
+    deleter.start([&](microseconds d) { delay = d.count(); },32*1024*1024);
+    deleter.remove({"segment.1.1"});
+    std::thread runner([&]() {
+        while(countFiles("deleting.")>0 && deleter.getStats().deletedBytes < 64*1024*1024) {
+            std::this_thread::sleep_for(microseconds(delay));
+            auto before = deleter.getStats().deletedBytes;
+            deleter.deletePending();
+            if(deleter.getStats().deletedBytes==before) break;
+        }
+    });
+    std::this_thread::sleep_for(milliseconds(300));
+    deleter.stop();
+    runner.join();
+
+    // the partially truncated file is left pending, and deleted after the next open
+    BOOST_TEST(countFiles("deleting.")==1);
+    BOOST_TEST(fs::file_size(dir+"/deleting.segment.1.1") < 64*1024*1024);
+
+    Deleter reopened(dir);
+    reopened.deleteScheduled();
+    BOOST_TEST(reopened.getStats().pendingFiles==1);
+    reopened.start([](microseconds) {},0);
+    reopened.deletePending();
+    BOOST_TEST(countFiles("")==0);
+    fs::remove_all(dir);
+}
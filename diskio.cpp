@@ -2,10 +2,16 @@
 #include <format>
 #include <filesystem>
 #include <fstream>
+#include <map>
 
 #include "database.h"
 #include "diskio.h"
 #include "bytebuffer.h"
+#include "filewriter.h"
+#include "crc32c.h"
+#include "compactionfilter.h"
+#include "partitionedsegment.h"
+#include "segmentwriter.h"
 
 namespace fs = std::filesystem;
 
@@ -19,6 +25,55 @@ uint64_t readLEuint64(const unsigned char *buffer) {
     return readLEuint32(buffer) + (uint64_t(readLEuint32(buffer+4)) << 32);
 }
 
+void writeLEuint16(unsigned char *buffer,uint16_t value) {
+    buffer[0] = value;
+    buffer[1] = value>>8;
+}
+void writeLEuint32(unsigned char *buffer,uint32_t value) {
+    buffer[0] = value;
+    buffer[1] = value>>8;
+    buffer[2] = value>>16;
+    buffer[3] = value>>24;
+}
+void writeLEuint64(unsigned char *buffer,uint64_t value) {
+    writeLEuint32(buffer,value);
+    writeLEuint32(buffer+4,value>>32);
+}
+
+/**
+ * @brief read a LEB128 encoded unsigned integer
+ * @return the number of bytes consumed
+ * @throws IllegalState if the varint extends beyond length
+ */
+int readVarint(const unsigned char *buffer,int length,uint64_t *value) {
+    uint64_t result = 0;
+    for(int i=0,shift=0;i<length && shift<64;i++,shift+=7) {
+        result |= uint64_t(buffer[i] & 0x7F) << shift;
+        if((buffer[i] & 0x80)==0) {
+            *value = result;
+            return i+1;
+        }
+    }
+    throw IllegalState("invalid varint");
+}
+int writeVarint(unsigned char *buffer,uint64_t value) {
+    int n = 0;
+    while(value >= 0x80) {
+        buffer[n++] = value | 0x80;
+        value >>= 7;
+    }
+    buffer[n++] = value;
+    return n;
+}
+int varintLength(uint64_t value) {
+    int n = 1;
+    while(value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
 uint16_t readLEuint16(std::istream& file) {
     return file.get() + (file.get()<<8);
 }
@@ -29,23 +84,36 @@ uint64_t readLEuint64(std::istream& file) {
     return readLEuint32(file) + (uint64_t(readLEuint32(file)) << 32);
 }
 
-void writeSegmentToDisk(Database *db,Segment *seg) {
+SegmentRef writeSegmentToDisk(Database *db,Segment *seg) {
     auto itr = seg->lookup(ByteBuffer::EMPTY(),ByteBuffer::EMPTY());
     if(itr->peekKey().empty()) {
         seg->removeSegment();
-        return;
+        return nullptr;
     }
 
     auto lowerId = seg->lowerID();
     auto upperId = seg->upperID();
 
-    std::string keyFilename = db->path+"/keys."+std::to_string(lowerId)+"."+std::to_string(upperId);
-    std::string dataFilename = db->path+"/data."+std::to_string(lowerId)+"."+std::to_string(upperId);
-    writeAndLoadSegment(keyFilename,dataFilename,itr.get(),false);
+    SegmentRef written;
+    if(db->options.segmentFormat!=segmentFormatV1) {
+        BlobWriter blobs(db->blobs,BlobFileID{.lower = lowerId, .upper = upperId},db->options.blobValueThreshold);
+        written = writeAndLoadSegment(db->path,lowerId,upperId,itr.get(),false,db->options,&blobs);
+    } else {
+        written = writeAndLoadSegment(db->path,lowerId,upperId,itr.get(),false,db->options);
+    }
     seg->removeSegment();
+    return written;
 }
 
-SegmentRef writeAndLoadSegment(std::string keyFilename,std::string dataFilename,LookupIterator * const itr,bool purgeDeleted) {
+SegmentRef writeAndLoadSegment(const std::string& dbpath,ID lowerId,ID upperId,LookupIterator *itr,bool purgeDeleted,const Options& options,BlobWriter *blobs) {
+    auto ids = std::to_string(lowerId)+"."+std::to_string(upperId);
+    if(options.segmentFormat==segmentFormatV1) {
+        return writeAndLoadSegment(dbpath+"/keys."+ids,dbpath+"/data."+ids,itr,purgeDeleted,options);
+    }
+    return writeAndLoadSegment(dbpath+"/segment."+ids,itr,purgeDeleted,blobs,options);
+}
+
+SegmentRef writeAndLoadSegment(std::string keyFilename,std::string dataFilename,LookupIterator * const itr,bool purgeDeleted,const Options& options) {
     if(fs::exists(keyFilename) || fs::exists(dataFilename)) {
         throw IllegalState("key/data file should not exist");
     }
@@ -53,12 +121,26 @@ SegmentRef writeAndLoadSegment(std::string keyFilename,std::string dataFilename,
     std::string keyFilenameTmp = keyFilename+".tmp";
     std::string dataFilenameTmp = dataFilename+".tmp";
 
-    auto keyIndex = writeSegmentFiles(keyFilenameTmp,dataFilenameTmp,itr,purgeDeleted);
+    auto keyIndex = writeSegmentFiles(keyFilenameTmp,dataFilenameTmp,itr,purgeDeleted,options);
 
     fs::rename(keyFilenameTmp,keyFilename);
     fs::rename(dataFilenameTmp,dataFilename);
 
-    return DiskSegment::newDiskSegment(keyFilename,dataFilename,keyIndex);
+    return DiskSegment::newDiskSegment(keyFilename,dataFilename,keyIndex,options.fileCache);
+}
+
+SegmentRef writeAndLoadSegment(std::string filename,LookupIterator * const itr,bool purgeDeleted,BlobWriter *blobs,const Options& options) {
+    if(fs::exists(filename)) {
+        throw IllegalState("segment file should not exist");
+    }
+
+    std::string filenameTmp = filename+".tmp";
+
+    auto keyIndex = writeSegmentFile(filenameTmp,itr,purgeDeleted,blobs,options);
+
+    fs::rename(filenameTmp,filename);
+
+    return DiskSegment::newDiskSegment(filename,keyIndex,blobs ? blobs->store : nullptr,options.fileCache);
 }
 
 void writeLEuint16(ostream& fs,uint16_t value) {
@@ -76,13 +158,6 @@ void writeLEuint64(ostream& fs,uint64_t value) {
     writeLEuint32(fs, value>>32);
 }
 
-void writeBuffer(ostream& fs,const Slice& bb) {
-    fs.write((const char*)(uint8_t*)bb,bb.length);
-}
-void writeBuffer(ostream& fs,const Slice& bb,int len) {
-    fs.write((const char*)(uint8_t*)bb,len);
-}
-
 struct DiskKey {
     uint16_t keylen;
     Slice compressedKey;
@@ -109,38 +184,44 @@ DiskKey encodeKey(const Slice& key,const Slice& prevKey) {
     return DiskKey{.keylen=(uint16_t)key.length, .compressedKey=key};
 }
 
-KeyIndex writeSegmentFiles(std::string keyFilename,std::string dataFilename,LookupIterator *itr,bool purgeDeleted) {
+KeyIndex writeSegmentFiles(std::string keyFilename,std::string dataFilename,LookupIterator *itr,bool purgeDeleted,const Options& options) {
     KeyIndex keyIndex;
 
-    std::fstream keyF;
-    std::fstream dataF;
-
-    keyF.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    dataF.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-    keyF.open(keyFilename,fstream::out | fstream::binary);
-    dataF.open(dataFilename,fstream::out | fstream::binary);
+    FileWriter keyF(keyFilename,false,FileWriter::defaultBufferSize,options.rateLimiter.get());
+    FileWriter dataF(dataFilename,false,FileWriter::defaultBufferSize,options.rateLimiter.get());
 
     int64_t dataOffset = 0;
     int keyBlockLen = 0;
     int keyCount = 0;
     int block = 0;
 
-    ByteBuffer zeros(keyBlockSize);
-    memset((uint8_t*)zeros,0,keyBlockSize);
+    // the key block is encoded in memory and written whole, zero padded
+    uint8_t keyBlock[keyBlockSize];
     ByteBuffer prevKey;
 
+    const bool filtered = options.ttlSeconds > 0 || options.compactionFilter;
+    const uint64_t now = currentWriteTime();
+    ByteBuffer newValue;
+
+    auto flushBlock = [&]() {
+        writeLEuint16(keyBlock+keyBlockLen,endOfBlock);
+        keyBlockLen+=2;
+        memset(keyBlock+keyBlockLen,0,keyBlockSize-keyBlockLen);
+        keyF.write(keyBlock,keyBlockSize);
+        keyBlockLen=0;
+    };
+
     while(true) {
         auto kv = itr->next();
         if(kv.key.empty()) break;
+        // values are only stored in blob files by v2 segments
+        if(itr->isBlobRef()) throw IllegalState("blob reference requires segment format 2");
+        if(filtered) applyCompactionFilter(options,now,kv,newValue);
         if(purgeDeleted && kv.value.empty()) continue;
         keyCount++;
-        writeBuffer(dataF,kv.value);
+        dataF.write(kv.value);
         if(keyBlockLen+2+kv.key.length+8+4 >= keyBlockSize-2) {
-            writeLEuint16(keyF,endOfBlock);
-            keyBlockLen+=2;
-            writeBuffer(keyF,zeros,keyBlockSize-keyBlockLen);
-            keyBlockLen=0;
+            flushBlock();
             prevKey = ByteBuffer::EMPTY();
         }
         if(keyBlockLen==0) {
@@ -152,10 +233,11 @@ KeyIndex writeSegmentFiles(std::string keyFilename,std::string dataFilename,Look
 
         auto dk = encodeKey(kv.key,prevKey);
         prevKey = kv.key;
-        writeLEuint16(keyF,dk.keylen);
-        writeBuffer(keyF,dk.compressedKey);
-        writeLEuint64(keyF,dataOffset);
-        writeLEuint32(keyF,kv.value.length);
+        uint8_t *p = keyBlock+keyBlockLen;
+        writeLEuint16(p,dk.keylen);
+        memcpy(p+2,dk.compressedKey,dk.compressedKey.length);
+        writeLEuint64(p+2+dk.compressedKey.length,dataOffset);
+        writeLEuint32(p+2+dk.compressedKey.length+8,kv.value.length);
 
         dataOffset += kv.value.length;
 
@@ -163,13 +245,488 @@ KeyIndex writeSegmentFiles(std::string keyFilename,std::string dataFilename,Look
     }
 
     if(keyBlockLen > 0 && keyBlockLen < keyBlockSize) {
-        writeLEuint16(keyF,endOfBlock);
-        keyBlockLen += 2;
-        writeBuffer(keyF,zeros,keyBlockSize-keyBlockLen);
+        flushBlock();
+    }
+
+    keyF.close();
+    dataF.close();
+
+    return keyIndex;
+}
+
+int sharedPrefixLen(const Slice& prevKey,const Slice& key) {
+    int length = 0;
+    for(;length < prevKey.length && length < key.length; length++) {
+        if(prevKey[length] != key[length]) break;
+    }
+    return length;
+}
+
+enum MetadataTag {
+    tagKeyOffset = 1,
+    tagKeyBlocks = 2,
+    tagBlockSize = 3,
+    tagIndexInterval = 4,
+    tagIndexOffset = 5,
+    tagIndexLength = 6,
+    tagKeyCount = 7,
+    tagDataLength = 8,
+    tagTaggedValues = 9,
+    tagBlobUsage = 10,
+    tagCompression = 11,
+    tagChecksums = 12,
+    tagDeleteCount = 13,
+    tagTtlSeconds = 14,
+};
+
+void appendVarint(ByteBuffer& buffer,uint64_t value) {
+    uint8_t tmp[10];
+    buffer.append(Slice(tmp,writeVarint(tmp,value)));
+}
+
+/**
+ * each field is encoded as varint (tag << 1 | isBytes) followed by either a varint value, or a
+ * varint length and the bytes
+ */
+ByteBuffer SegmentMetadata::encode() const {
+    ByteBuffer buffer;
+    auto field = [&](MetadataTag tag,uint64_t value) {
+        appendVarint(buffer,tag << 1);
+        appendVarint(buffer,value);
+    };
+    field(tagKeyOffset,keyOffset);
+    field(tagKeyBlocks,keyBlocks);
+    field(tagBlockSize,blockSize);
+    field(tagIndexInterval,indexInterval);
+    field(tagIndexOffset,indexOffset);
+    field(tagIndexLength,indexLength);
+    field(tagKeyCount,keyCount);
+    field(tagDataLength,dataLength);
+    field(tagTaggedValues,taggedValues);
+    field(tagCompression,compression);
+    field(tagChecksums,checksums);
+    if(countsDeletes) field(tagDeleteCount,deleteCount);
+    if(ttlSeconds > 0) field(tagTtlSeconds,ttlSeconds);
+    if(!blobUsage.empty()) {
+        ByteBuffer usage;
+        appendVarint(usage,blobUsage.size());
+        for(auto& u : blobUsage) {
+            appendVarint(usage,u.file.lower);
+            appendVarint(usage,u.file.upper);
+            appendVarint(usage,u.bytes);
+        }
+        appendVarint(buffer,(tagBlobUsage << 1) | 1);
+        appendVarint(buffer,usage.length);
+        buffer.append(usage);
+    }
+    return buffer;
+}
+
+SegmentMetadata SegmentMetadata::decode(const Slice& buffer) {
+    SegmentMetadata metadata;
+    int index = 0;
+    while(index < buffer.length) {
+        uint64_t key,value;
+        index += readVarint(buffer+index,buffer.length-index,&key);
+        index += readVarint(buffer+index,buffer.length-index,&value);
+        if(key & 1) {
+            if(index+value > (uint64_t)buffer.length) throw IllegalState("invalid segment metadata");
+            Slice bytes = buffer.slice(index,value);
+            index += value;
+            // unknown bytes fields are skipped
+            if((key >> 1)==tagBlobUsage) {
+                int n = 0;
+                uint64_t count,lower,upper,bytesUsed;
+                n += readVarint(bytes+n,bytes.length-n,&count);
+                for(uint64_t i=0;i<count;i++) {
+                    n += readVarint(bytes+n,bytes.length-n,&lower);
+                    n += readVarint(bytes+n,bytes.length-n,&upper);
+                    n += readVarint(bytes+n,bytes.length-n,&bytesUsed);
+                    metadata.blobUsage.push_back(BlobUsage{.file = BlobFileID{.lower = lower, .upper = upper}, .bytes = bytesUsed});
+                }
+            }
+            continue;
+        }
+        switch(key >> 1) {
+            case tagKeyOffset: metadata.keyOffset = value; break;
+            case tagKeyBlocks: metadata.keyBlocks = value; break;
+            case tagBlockSize: metadata.blockSize = value; break;
+            case tagIndexInterval: metadata.indexInterval = value; break;
+            case tagIndexOffset: metadata.indexOffset = value; break;
+            case tagIndexLength: metadata.indexLength = value; break;
+            case tagKeyCount: metadata.keyCount = value; break;
+            case tagDataLength: metadata.dataLength = value; break;
+            case tagTaggedValues: metadata.taggedValues = value; break;
+            case tagCompression: metadata.compression = value; break;
+            case tagChecksums: metadata.checksums = value; break;
+            case tagDeleteCount:
+                metadata.deleteCount = value;
+                metadata.countsDeletes = true;
+                break;
+            case tagTtlSeconds: metadata.ttlSeconds = value; break;
+        }
+    }
+    if(index!=buffer.length) throw IllegalState("invalid segment metadata");
+    return metadata;
+}
+
+/**
+ * @brief write the key index, metadata and footer that follow the key blocks of a v2 segment
+ */
+static void writeSegmentTrailer(FileWriter& segF,const KeyIndex& keyIndex,SegmentMetadata& metadata) {
+    ByteBuffer index;
+    appendVarint(index,keyIndex.size());
+    for(auto& key : keyIndex) {
+        appendVarint(index,key.length);
+        index.append(key);
+    }
+    metadata.indexOffset = metadata.keyOffset + metadata.keyBlocks * metadata.blockSize;
+    metadata.indexLength = index.length;
+    segF.write(index);
+
+    auto encoded = metadata.encode();
+    segF.write(encoded);
+
+    uint8_t footer[segmentFooterSize];
+    writeLEuint64(footer,metadata.indexOffset+metadata.indexLength);
+    writeLEuint32(footer+8,encoded.length);
+    writeLEuint32(footer+12,segmentFormatV2);
+    writeLEuint64(footer+16,segmentMagic);
+    segF.write(footer,segmentFooterSize);
+}
+
+static int checkedBlockSize(const Options& options) {
+    if(options.blockSize < minKeyBlockSize || options.blockSize > maxKeyBlockSize || options.indexInterval < 1) {
+        throw IllegalState("invalid key block size or index interval");
+    }
+    return options.blockSize;
+}
+
+SegmentWriter::SegmentWriter(const std::string& filename,const std::string& target,const Options& options,BlobWriter *blobs)
+:   filename(filename),
+    target(target),
+    keysFilename(target+".keys.tmp"),
+    compression(options.compression),
+    inlineLimit(std::min(options.inlineValueThreshold,maxInlineValueLength)),
+    blockSize(checkedBlockSize(options)),
+    indexInterval(options.indexInterval),
+    entriesSize(options.blockSize - keyBlockTrailerSize),
+    ttlSeconds(options.ttlSeconds),
+    blobs(blobs),
+    segF(filename,options.directIO,FileWriter::defaultBufferSize,options.rateLimiter.get()),
+    keyF(keysFilename,options.directIO,FileWriter::defaultBufferSize,options.rateLimiter.get()),
+    blockData(dataBlockSize),
+    compressed(dataBlockSize),
+    ref(BlobRef::maxEncodedLength),
+    blockBuffer(blockSize),
+    blockLen(keyBlockHeaderSize)
+{
+    metadata.blockSize = blockSize;
+    metadata.indexInterval = indexInterval;
+    metadata.taggedValues = true;
+    metadata.compression = compression;
+    metadata.checksums = true;
+    metadata.countsDeletes = true;
+    metadata.ttlSeconds = options.ttlSeconds;
+    blockData.length = 0;
+}
+
+SegmentWriter::~SegmentWriter() {
+    if(finished) return;
+    // the writer may be destroyed by an exception from a write, so the files are removed regardless
+    try {
+        segF.close();
+        keyF.close();
+    } catch(...) {
+    }
+    std::error_code ec;
+    fs::remove(filename,ec);
+    fs::remove(keysFilename,ec);
+}
+
+void SegmentWriter::flushBlock() {
+    uint8_t *block = blockBuffer;
+    if(compression!=compressionNone) {
+        compress(compression,blockData,compressed);
+        Slice stored = compressed.length < blockData.length ? Slice(compressed) : Slice(blockData);
+        uint8_t header[20];
+        int n = writeVarint(header,blockData.length);
+        n += writeVarint(header+n,stored.length);
+        segF.write(header,n);
+        segF.write(stored);
+        dataCrc = crc32c(crc32c(0,header,n),stored,stored.length);
+        dataOffset += n + stored.length;
+        blockData.length = 0;
+    }
+    writeLEuint16(block,blockEntries);
+    writeLEuint64(block+2,blockDataOffset);
+    memset(block+blockLen,0,blockSize-blockLen);
+    writeLEuint32(block+entriesSize,dataCrc);
+    writeLEuint32(block+blockSize-4,crc32c(0,block,blockSize-4));
+    dataCrc = 0;
+    keyF.write(block,blockSize);
+    metadata.keyBlocks++;
+    blockLen = keyBlockHeaderSize;
+    blockEntries = 0;
+}
+
+void SegmentWriter::append(const Slice& key,const Slice& entryValue,bool isBlobRef) {
+    uint8_t *block = blockBuffer;
+    Slice value = entryValue;
+    int kind = valueKindData;
+    if(blobs!=nullptr && blobs->separate(entryValue,isBlobRef,ref)) {
+        value = ref;
+        kind = valueKindBlob;
+    } else if(isBlobRef) {
+        throw IllegalState("blob reference requires a blob writer");
+    } else if(value.length > 0 && value.length <= inlineLimit) {
+        kind = valueKindInline;
+    }
+    uint64_t taggedLength = (uint64_t(value.length) << valueKindBits) | kind;
+
+    int shared = blockEntries==0 ? 0 : sharedPrefixLen(prevKey,key);
+    int entryLen = varintLength(shared) + varintLength(key.length-shared) + (key.length-shared) + varintLength(taggedLength);
+    if(kind==valueKindInline) entryLen += value.length;
+    if(blockEntries > 0 && (blockLen+entryLen > entriesSize || blockEntries==0xFFFF || blockData.length >= dataBlockSize)) {
+        flushBlock();
+        shared = 0;
+    }
+    if(blockEntries==0) {
+        if((metadata.keyBlocks % indexInterval) == 0) {
+            keyIndex.push_back(key);
+        }
+        blockDataOffset = dataOffset;
+    }
+
+    blockLen += writeVarint(block+blockLen,shared);
+    blockLen += writeVarint(block+blockLen,key.length-shared);
+    memcpy(block+blockLen,key+shared,key.length-shared);
+    blockLen += key.length-shared;
+    blockLen += writeVarint(block+blockLen,taggedLength);
+    blockEntries++;
+
+    if(kind==valueKindInline) {
+        memcpy(block+blockLen,value,value.length);
+        blockLen += value.length;
+    } else if(compression!=compressionNone) {
+        blockData.append(value);
+    } else {
+        segF.write(value);
+        dataCrc = crc32c(dataCrc,value,value.length);
+        dataOffset += value.length;
+    }
+    metadata.keyCount++;
+    if(entryValue.empty()) metadata.deleteCount++;
+    prevKey = key;
+}
+
+void SegmentWriter::checkOrder(const Slice& key) {
+    if(finished) throw IllegalState("segment writer is finished");
+    if(key.empty()) throw EmptyKey();
+    if(key.length > maxKeyLength) throw KeyTooLong();
+    if(metadata.keyCount > 0 && !Slice::less(prevKey,key)) throw IllegalState("keys must be added in ascending order");
+}
+
+void SegmentWriter::put(const Slice& key,const Slice& value) {
+    checkOrder(key);
+    if(ttlSeconds > 0) {
+        // stored as Database::put stores it, so that the value expires relative to its write
+        appendWriteTime(timedValue,value,currentWriteTime());
+        append(key,timedValue,false);
+    } else {
+        append(key,value,false);
+    }
+}
+
+void SegmentWriter::remove(const Slice& key) {
+    checkOrder(key);
+    append(key,Slice(),false);
+}
+
+KeyIndex SegmentWriter::finish() {
+    if(finished) throw IllegalState("segment writer is finished");
+    if(blockEntries > 0) flushBlock();
+    if(blobs!=nullptr) metadata.blobUsage = blobs->finish();
+
+    // the key blocks are page aligned in the file
+    metadata.dataLength = dataOffset;
+    metadata.keyOffset = ((dataOffset + keyBlockSize - 1) / keyBlockSize) * keyBlockSize;
+    segF.writeZeros(metadata.keyOffset-dataOffset);
+
+    keyF.close();
+    segF.writeFile(keysFilename);
+    fs::remove(keysFilename);
+
+    writeSegmentTrailer(segF,keyIndex,metadata);
+
+    segF.close();
+    if(target!=filename) fs::rename(filename,target);
+    finished = true;
+
+    return keyIndex;
+}
+
+/**
+ * @brief write a v2 segment file. The values are written first, followed by the key blocks, the
+ * key index, the metadata and the footer. Each key block starts with the entry count and the data
+ * offset of its first entry, and each entry is the varint shared prefix length, the varint suffix
+ * length, the suffix and the varint value length. Since values are written in key order, the data
+ * offset of every other entry in the block is implicit.
+ *
+ * The key blocks are written to a temporary file while the values are written, and appended to
+ * the segment file once all of the values have been written.
+ *
+ * If the segment is compressed, the values of each key block are written as a single data block,
+ * which is the varint uncompressed length, the varint stored length and the compressed values. The
+ * key block header has the offset of the data block, and the value offsets are relative to it. The
+ * data block is stored uncompressed if compression does not reduce its size.
+ *
+ * Values up to the inline threshold are stored in the key block after the value length.
+ *
+ * Each key block ends with the CRC32C of the data written since the start of the block, followed
+ * by the CRC32C of the rest of the key block.
+ */
+KeyIndex writeSegmentFile(std::string filename,LookupIterator *itr,bool purgeDeleted,BlobWriter *blobs,const Options& options) {
+    // the callers write to a temporary file, which they rename
+    SegmentWriter writer(filename,filename,options,blobs);
+    // expired and filtered entries are written as deletions
+    const bool filtered = options.ttlSeconds > 0 || options.compactionFilter;
+    const uint64_t now = currentWriteTime();
+    ByteBuffer newValue, blobValue;
+
+    while(true) {
+        auto kv = itr->next();
+        if(kv.key.empty()) break;
+        bool isBlobRef = itr->isBlobRef();
+        if(filtered && !isBlobRef) {
+            applyCompactionFilter(options,now,kv,newValue);
+        } else if(isBlobRef && options.compactionFilter && blobs!=nullptr) {
+            // values in blob files are read for the filter, and keep their reference unless changed
+            blobs->store->read(BlobRef::decode(kv.value),blobValue);
+            KeyValue filteredKv(kv.key,blobValue);
+            applyCompactionFilter(options,now,filteredKv,newValue);
+            if(filteredKv.value.compareTo(blobValue)!=0) {
+                kv.value = filteredKv.value;
+                isBlobRef = false;
+            }
+        } else if(isBlobRef && options.ttlSeconds > 0 && blobs!=nullptr) {
+            // only the write time of values in blob files is read to expire them
+            if(blobs->store->expired(BlobRef::decode(kv.value),options.ttlSeconds,now)) {
+                kv.value.length = 0;
+                isBlobRef = false;
+            }
+        }
+        if(purgeDeleted && kv.value.empty()) continue;
+        writer.append(kv.key,kv.value,isBlobRef);
     }
+    return writer.finish();
+}
 
-    keyF.flush();
-    dataF.flush();
+std::vector<DiskSegment*> copyableSegments(const std::vector<SegmentRef>& segments,bool purgeDeleted,const Options& options) {
+    if(options.segmentFormat==segmentFormatV1 || options.compactionFilter || options.ttlSeconds > 0) return {};
+    std::vector<DiskSegment*> sources;
+    for(auto& s : segments) {
+        std::vector<SegmentRef> parts{s};
+        if(auto ps = dynamic_cast<PartitionedSegment*>(s.get())) parts = ps->getPartitions();
+        for(auto& p : parts) {
+            auto ds = dynamic_cast<DiskSegment*>(p.get());
+            if(ds==nullptr || ds->format!=segmentFormatV2 || !ds->checksums || !ds->taggedValues) return {};
+            if(ds->blockSize!=options.blockSize || ds->compression!=options.compression) return {};
+            if(purgeDeleted && (!ds->countsDeletes || ds->deleteCount > 0)) return {};
+            if(ds->keyBlocks > 0) sources.push_back(ds);
+        }
+    }
+    if(sources.empty()) return {};
+    std::vector<std::pair<ByteBuffer,DiskSegment*>> ordered;
+    for(auto ds : sources) ordered.push_back({ds->keyIndex[0],ds});
+    std::sort(ordered.begin(),ordered.end(),[](const auto& a,const auto& b) { return Slice::less(a.first,b.first); });
+    for(int i=0;i+1<ordered.size();i++) {
+        if(!Slice::less(ordered[i].second->lastKey(),ordered[i+1].first)) return {};
+    }
+    sources.clear();
+    for(auto& [key,ds] : ordered) sources.push_back(ds);
+    return sources;
+}
+
+KeyIndex copySegmentFile(std::string filename,const std::vector<DiskSegment*>& segments,const Options& options) {
+    const int blockSize = options.blockSize;
+    const int indexInterval = options.indexInterval;
+    KeyIndex keyIndex;
+    SegmentMetadata metadata;
+    metadata.blockSize = blockSize;
+    metadata.indexInterval = indexInterval;
+    metadata.taggedValues = true;
+    metadata.compression = options.compression;
+    metadata.checksums = true;
+    metadata.countsDeletes = true;
+
+    FileWriter segF(filename,options.directIO,FileWriter::defaultBufferSize,options.rateLimiter.get());
+
+    // the data regions are concatenated, so the blocks of each segment move by the same offset
+    std::vector<uint64_t> dataOffsets;
+    std::map<BlobFileID,uint64_t> blobUsage;
+    for(auto ds : segments) {
+        dataOffsets.push_back(metadata.dataLength);
+        auto pinned = ds->pin();
+        for(uint64_t offset=0;offset<ds->dataLength;) {
+            int length = std::min(ds->dataLength-offset,(uint64_t)FileWriter::defaultBufferSize);
+            segF.write(ds->dataFile.slice(offset,length));
+            offset += length;
+        }
+        metadata.dataLength += ds->dataLength;
+        metadata.keyCount += ds->keyCount;
+        metadata.deleteCount += ds->deleteCount;
+        if(!ds->countsDeletes) metadata.countsDeletes = false;
+        for(auto& u : ds->blobUsage) blobUsage[u.file] += u.bytes;
+    }
+    for(auto [file,bytes] : blobUsage) metadata.blobUsage.push_back(BlobUsage{.file = file, .bytes = bytes});
+
+    // the key blocks are page aligned in the file
+    metadata.keyOffset = ((metadata.dataLength + keyBlockSize - 1) / keyBlockSize) * keyBlockSize;
+    segF.writeZeros(metadata.keyOffset-metadata.dataLength);
+
+    // only the data offset in the block header and the key block checksum change, the data
+    // checksum covers bytes that are copied unchanged
+    ByteBuffer blockBuffer(blockSize);
+    uint8_t *block = blockBuffer;
+    KeyBlockDecoder decoder(segmentFormatV2,true);
+    for(int i=0;i<segments.size();i++) {
+        auto ds = segments[i];
+        auto pinned = ds->pin();
+        for(int64_t b=0;b<ds->keyBlocks;b++) {
+            Slice source = ds->keyBlock(b);
+            if(readLEuint32(source+blockSize-4)!=crc32c(0,source,blockSize-4)) throw DatabaseCorrupted();
+            memcpy(block,source,blockSize);
+            writeLEuint64(block+2,readLEuint64(block+2)+dataOffsets[i]);
+            writeLEuint32(block+blockSize-4,crc32c(0,block,blockSize-4));
+            if((metadata.keyBlocks % indexInterval) == 0) {
+                decoder.reset(block,blockSize);
+                if(!decoder.next()) throw DatabaseCorrupted();
+                keyIndex.push_back(decoder.key());
+            }
+            segF.write(block,blockSize);
+            metadata.keyBlocks++;
+        }
+    }
+
+    writeSegmentTrailer(segF,keyIndex,metadata);
+
+    segF.close();
 
     return keyIndex;
-}
\ No newline at end of file
+}
+
+SegmentRef copyAndLoadSegment(const std::string& dbpath,ID lowerId,ID upperId,const std::vector<DiskSegment*>& segments,const Options& options,BlobStoreRef blobs) {
+    auto filename = dbpath+"/segment."+std::to_string(lowerId)+"."+std::to_string(upperId);
+    if(fs::exists(filename)) {
+        throw IllegalState("segment file should not exist");
+    }
+
+    std::string filenameTmp = filename+".tmp";
+
+    auto keyIndex = copySegmentFile(filenameTmp,segments,options);
+
+    fs::rename(filenameTmp,filename);
+
+    return DiskSegment::newDiskSegment(filename,keyIndex,blobs,options.fileCache);
+}
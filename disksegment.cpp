@@ -3,13 +3,19 @@
 #include <filesystem>
 #include <boost/algorithm/string.hpp>
 #include <memory>
+#include <map>
+#include <limits>
+#include <algorithm>
 
 #include <arpa/inet.h>
 
 #include "constants.h"
 #include "disksegment.h"
+#include "crc32c.h"
 #include "logsegment.h"
+#include "partitionedsegment.h"
 #include "diskio.h"
+#include "manifest.h"
 
 namespace fs = std::filesystem;
 
@@ -22,30 +28,41 @@ bool segmentCompare(const SegmentRef& a,const SegmentRef& b) {
     return id1 < id2;
 }
 
-std::vector<SegmentRef> DiskSegment::loadDiskSegments(std::string directory, Options options) {
+std::vector<SegmentRef> DiskSegment::loadDiskSegments(std::string directory, Options options, BlobStoreRef blobs) {
     auto files = fs::directory_iterator(directory);
     std::vector<SegmentRef> segments;
+    auto removeFileIfExists = [&](std::string filename) {
+        fs::path path = directory+"/"+filename;
+        if(fs::exists(path)) fs::remove(path);
+    };
     // first remove any tmp files 
     for(auto file : files) {
         if(file.path().extension()!=".tmp") continue;
         auto base = file.path().stem().string();
-        std::string segs;
-        if(base.starts_with("keys.")) {
-            segs = base.substr(strlen("keys."));
-        } else if(base.starts_with("data.")) {
-            segs = base.substr(strlen("data."));
-        } else {
+        if(!base.starts_with("keys.") && !base.starts_with("data.") && !base.starts_with("segment.")) {
             throw IllegalState(("unknown tmp file "+base).c_str());
         }
-        auto removeFileIfExists = [](std::string filename) {
-            fs::path path = filename;
-            if(fs::exists(path)) fs::remove(path);
-        };
+        auto ids = getSegmentIDs(base);
+        auto segs = std::to_string(ids.lower)+"."+std::to_string(ids.upper);
         removeFileIfExists("keys."+segs);
         removeFileIfExists("data."+segs);
         removeFileIfExists("keys."+segs+".tmp");
         removeFileIfExists("data."+segs+".tmp");
+        removeFileIfExists("segment."+segs);
+        removeFileIfExists("segment."+segs+".tmp");
+        removeFileIfExists(file.path().filename());
+        // the partitions of a subcompaction are renamed after all of them are written, so a
+        // remaining tmp partition means the set is incomplete
+        std::vector<fs::path> partitions;
+        for(auto other : fs::directory_iterator(directory)) {
+            if(other.path().filename().string().starts_with("segment."+segs+".")) partitions.push_back(other.path());
+        }
+        for(auto& path : partitions) fs::remove(path);
     }
+    // the partitions of each subcompaction, by id range and partition number
+    std::map<std::pair<ID,ID>,std::map<int,SegmentRef>> partitioned;
+    // the segment files, which are opened in parallel
+    std::vector<std::string> filenames;
     files = fs::directory_iterator(directory);
     for(auto file : files) {
         if(file.path().string().starts_with("log.")) {
@@ -53,27 +70,63 @@ std::vector<SegmentRef> DiskSegment::loadDiskSegments(std::string directory, Opt
             segments.push_back(ls);
         }
         auto filename = file.path().filename().string();
-        if(!filename.starts_with("keys.")) continue;
-        auto ids = getSegmentIDs(filename);
-        auto keyFilename = directory+"/"+"keys."+std::to_string(ids.lower)+"."+std::to_string(ids.upper);
-        auto dataFilename = directory+"/"+"data."+std::to_string(ids.lower)+"."+std::to_string(ids.upper);
-        auto segment = DiskSegment::newDiskSegment(keyFilename,dataFilename,{});
-        segments.push_back(segment);
+        if(filename.starts_with("segment.") || filename.starts_with("keys.")) filenames.push_back(filename);
     }
-    std::sort(segments.begin(),segments.end(),segmentCompare);
-    // remove any segments that are fully contained in another segment
-next:
-    for(auto i = segments.begin(); i<segments.end(); i++) {
-        auto seg = *i;
-        for(auto j = i + 1; j < segments.end(); j++) {
-            auto seg0 = *j;
-            if(seg->lowerID() >= seg0->lowerID() && seg->upperID() <= seg0->upperID()) {
-                segments.erase(i);
-                goto next;
+    auto cached = Manifest::load(directory);
+    std::vector<SegmentRef> loaded(filenames.size());
+    Database::executor.parallelFor(filenames.size(),[&](int i) {
+        auto& filename = filenames[i];
+        auto entry = cached.find(filename);
+        if(filename.starts_with("keys.")) {
+            auto ids = getSegmentIDs(filename);
+            auto keyFilename = directory+"/"+"keys."+std::to_string(ids.lower)+"."+std::to_string(ids.upper);
+            auto dataFilename = directory+"/"+"data."+std::to_string(ids.lower)+"."+std::to_string(ids.upper);
+            KeyIndex keyIndex;
+            if(entry!=cached.end() && entry->second.format==segmentFormatV1 && entry->second.size==fs::file_size(keyFilename)+fs::file_size(dataFilename)) {
+                keyIndex = entry->second.keyIndex;
             }
+            loaded[i] = DiskSegment::newDiskSegment(keyFilename,dataFilename,keyIndex,options.fileCache);
+            return;
+        }
+        auto path = directory+"/"+filename;
+        if(entry!=cached.end() && entry->second.format==segmentFormatV2 && entry->second.size==fs::file_size(path)) {
+            loaded[i] = DiskSegment::newDiskSegment(path,entry->second.metadata,entry->second.keyIndex,blobs,options.fileCache);
+        } else {
+            loaded[i] = DiskSegment::newDiskSegment(path,{},blobs,options.fileCache);
         }
+    });
+    for(int i=0;i<filenames.size();i++) {
+        auto& segment = loaded[i];
+        std::vector<std::string> parts;
+        boost::split(parts,filenames[i],boost::is_any_of("."));
+        if(parts[0]=="segment" && parts.size()==4) {
+            partitioned[{segment->lowerID(),segment->upperID()}][std::stoi(parts[3])] = segment;
+        } else {
+            segments.push_back(segment);
+        }
+    }
+    for(auto& [ids,partitions] : partitioned) {
+        if(partitions.size()==1) {
+            segments.push_back(partitions.begin()->second);
+            continue;
+        }
+        std::vector<SegmentRef> ordered;
+        for(auto& [index,partition] : partitions) ordered.push_back(partition);
+        segments.push_back(PartitionedSegment::newPartitionedSegment(ordered));
+    }
+    std::sort(segments.begin(),segments.end(),segmentCompare);
+    // remove any segments that are fully contained in another segment. A later segment has an
+    // upper id that is at least as high, so a segment is contained if a later one has a lower id
+    // that is not higher.
+    std::vector<SegmentRef> live;
+    ID minLowerID = std::numeric_limits<ID>::max();
+    for(auto itr = segments.rbegin(); itr!=segments.rend(); itr++) {
+        if((*itr)->lowerID() >= minLowerID) continue;
+        minLowerID = (*itr)->lowerID();
+        live.push_back(*itr);
     }
-    return segments;
+    std::reverse(live.begin(),live.end());
+    return live;
 }
 
 IDS getSegmentIDs(const std::string& filename) {
@@ -83,13 +136,10 @@ IDS getSegmentIDs(const std::string& filename) {
 }
 
 /**
- * @brief search key file using binary search
- * 
- * @param key the key to look for
- * @param offset the offset of the value in the data file, or -1 if not found
- * @param length the length of the value in the data file
+ * @brief find the key block that would contain the key, using the key index and then a binary
+ * search of the first keys of the blocks
  */
-void DiskSegment::binarySearch(const Slice& key,int64_t *offset,uint32_t *length) {
+int64_t DiskSegment::findBlock(const Slice& key) {
     int64_t lowBlock = 0;
     int64_t highBlock = keyBlocks - 1;
 
@@ -98,15 +148,13 @@ void DiskSegment::binarySearch(const Slice& key,int64_t *offset,uint32_t *length
 
     auto index = itr-keyIndex.begin();
 
-    lowBlock = index * keyIndexInterval;
-    highBlock = lowBlock + keyIndexInterval;
+    lowBlock = index * indexInterval;
+    highBlock = lowBlock + indexInterval;
     if(highBlock >= keyBlocks) {
         highBlock = keyBlocks-1;
     }
 
-    unsigned char buffer[maxKeySize+2];
-    int64_t block = binarySearch0(lowBlock,highBlock,key,buffer);
-    scanBlock(block,key,offset,length);
+    return binarySearch0(lowBlock,highBlock,key);
 }
 
 /**
@@ -115,18 +163,17 @@ void DiskSegment::binarySearch(const Slice& key,int64_t *offset,uint32_t *length
  * @param lowBlock 
  * @param highBlock 
  * @param key 
- * @param buffer 
  * @return int64_t the block number to be scanned
  */
-int64_t DiskSegment::binarySearch0(int64_t lowBlock,int64_t highBlock,const ByteBuffer& key,unsigned char *buffer) {
+int64_t DiskSegment::binarySearch0(int64_t lowBlock,int64_t highBlock,const Slice& key) {
+    KeyBlockDecoder decoder(format,taggedValues);
     if(highBlock-lowBlock<=1) {
         // the key is either in low block or high block, or does not exist, so check high block
-        keyFile.readAt(buffer,highBlock*keyBlockSize,maxKeySize+2);
-        uint16_t keylen = readLEuint16(buffer);
+        Slice buffer = keyBlock(highBlock);
+        decoder.reset(buffer,buffer.length);
+        if(!decoder.next()) throw IllegalState("empty key block");
 
-        Slice skey(buffer+2,keylen);
-
-        if(Slice::less(key,skey)) {
+        if(Slice::less(key,decoder.key())) {
             return lowBlock;
         } else {
             return highBlock;
@@ -134,14 +181,14 @@ int64_t DiskSegment::binarySearch0(int64_t lowBlock,int64_t highBlock,const Byte
     }
 
     uint64_t block = (highBlock-lowBlock)/2 + lowBlock;
-    keyFile.readAt(buffer,block*keyBlockSize,maxKeySize+2);
-    uint16_t keylen = readLEuint16(buffer);
-    Slice skey(buffer+2,keylen);
+    Slice buffer = keyBlock(block);
+    decoder.reset(buffer,buffer.length);
+    if(!decoder.next()) throw IllegalState("empty key block");
 
-    if(Slice::less(key,skey)) {
-        return binarySearch0(lowBlock,block,key,buffer);
+    if(Slice::less(key,decoder.key())) {
+        return binarySearch0(lowBlock,block,key);
     } else {
-        return binarySearch0(block,highBlock,key,buffer);
+        return binarySearch0(block,highBlock,key);
     }
 }
 
@@ -152,72 +199,102 @@ int64_t DiskSegment::binarySearch0(int64_t lowBlock,int64_t highBlock,const Byte
  * @param key the key to look for
  * @param offset the offset of the value in the data file, or -1 if the key was not found
  * @param length the length of the value in the data file
+ * @param kind the kind of value in the data file
+ * @param dataBlock the offset of the data block containing the value, if the segment is compressed
+ * @param value set to the value if it is stored inline
  */
-void DiskSegment::scanBlock(int64_t block,const Slice& key,int64_t *offset,uint32_t *length) {
-    uint8_t buffer[keyBlockSize];
-    uint8_t tmpKey[maxKeySize];
-    keyFile.readAt(buffer,block*keyBlockSize,keyBlockSize);
-    int index = 0;
-
-    while(true) {
-        if(index+2>keyBlockSize) throw IllegalState("buffer overrun");
-
-        uint16_t keylen = readLEuint16(buffer+index);
-        int compressedLen = keylen;
-        int prefixLen = 0;
-
-        if(keylen==endOfBlock) {
-            *offset=-1;
+void DiskSegment::scanBlock(int64_t block,const Slice& key,int64_t *offset,uint32_t *length,int *kind,uint64_t *dataBlock,ByteBuffer& value) {
+    Slice buffer = keyBlock(block);
+    KeyBlockDecoder decoder(format,taggedValues);
+    decoder.reset(buffer,buffer.length);
+
+    while(decoder.next()) {
+        int cmp = decoder.key().compareTo(key);
+        if(cmp==0) {
+            *offset = decoder.dataOffset;
+            *length = decoder.dataLength;
+            *kind = decoder.valueKind;
+            *dataBlock = decoder.blockDataOffset;
+            if(decoder.valueKind==valueKindInline) value = decoder.inlineValue;
             return;
         }
-
-        index+=2;
-
-        if((keylen&compressedBit) != 0) {
-            prefixLen = (keylen >> 8) & maxPrefixLen;
-            compressedLen = keylen & maxCompressedLen;
-        }
-
-        int endOfKey = index + compressedLen;
-
-        if(endOfKey>keyBlockSize) throw IllegalState("buffer overrun");
-
-        // tmpKey always has the previous key, so only need to replace the suffix
-
-        memcpy(tmpKey+prefixLen,buffer+index,compressedLen);
-
-        Slice candidate(tmpKey,prefixLen+compressedLen);
-        
-        if(candidate.compareTo(key)==0) {
-            *offset =readLEuint64(buffer+endOfKey);
-            *length =readLEuint32(buffer+endOfKey+8);
-            return;
-        }
-        if(!Slice::less(candidate,key)) {
-            *offset=-1;
-            return;
-        }
-        index = endOfKey + 12;
+        if(cmp>0) break;
     }
-
+    *offset=-1;
 }
 
-ByteBuffer& DiskSegment::get(const Slice& key,ByteBuffer &value) {
+ByteBuffer& DiskSegment::get(const Slice& key,ByteBuffer &value,const ReadOptions& options) {
     int64_t offset;
     uint32_t length;
+    int kind;
+    uint64_t dataBlock;
 
-    binarySearch(key,&offset,&length);
+    if(keyBlocks==0) {
+        value = ByteBuffer::EMPTY();
+        return value;
+    }
+
+    auto pinned = pin();
+    int64_t block = findBlock(key);
+    if(options.verifyChecksums) checkBlock(block);
+    scanBlock(block,key,&offset,&length,&kind,&dataBlock,value);
 
     if(offset<0 || length==0) {
         value = ByteBuffer::EMPTY();
         return value;
     }
-    value.ensureCapacity(length);
-    dataFile.readAt(value, offset, length);
-    value.length = length;
+    if(kind==valueKindInline) {
+        return value;
+    }
+    if(compression!=compressionNone) {
+        ByteBuffer block;
+        readDataBlock(dataBlock,block);
+        if(offset-dataBlock+length > (uint64_t)block.length) throw IllegalState("value beyond end of data block");
+        value = block.slice(offset-dataBlock,length);
+    } else {
+        value.ensureCapacity(length);
+        dataFile.readAt(value, offset, length);
+        value.length = length;
+    }
+    if(kind==valueKindBlob) {
+        blobs->read(BlobRef::decode(value),value);
+    }
     return value;
 }
 
+LookupRef DiskSegment::lookup(const Slice& lower, const Slice& upper, bool resolveBlobs, bool verify) {
+    if(keyBlocks==0) return LookupRef(new EmptyIterator());
+    auto pinned = pin();
+    int64_t block = 0;
+    if(!lower.empty()) {
+        auto itr = std::upper_bound(keyIndex.begin(),keyIndex.end(),lower,ByteBuffer::less);
+        if(itr!=keyIndex.begin()) itr--;
+        int index = itr - keyIndex.begin();
+        block = index * indexInterval;
+    }
+    if(verify) checkBlock(block);
+    return LookupRef(new Iterator(SegmentRef(weakRef),lower,upper,keyBlock(block),block,format,taggedValues,resolveBlobs,verify,std::move(pinned)));
+}
+
+bool DiskSegment::verifyBlock(int64_t block,uint64_t *bytes) {
+    if(bytes!=nullptr) *bytes = 0;
+    if(!checksums || verified[block]) return true;
+    auto pinned = pin();
+    Slice buffer = keyBlock(block);
+    if(bytes!=nullptr) *bytes = blockSize;
+    if(readLEuint32(buffer+blockSize-4)!=crc32c(0,buffer,blockSize-4)) return false;
+
+    // the data of the block extends to the data of the next block
+    uint64_t start = readLEuint64(buffer+2);
+    uint64_t end = block+1 < keyBlocks ? readLEuint64(keyBlock(block+1)+2) : dataLength;
+    if(end < start || end > keyOffset) return false;
+    if(bytes!=nullptr) *bytes += end-start;
+    if(readLEuint32(buffer+blockSize-keyBlockTrailerSize)!=crc32c(keyFile.slice(start,end-start))) return false;
+
+    if(!verified[block].exchange(true)) verifiedBlocks++;
+    return true;
+}
+
 struct DecodedKeyLen {
     uint16_t prefixLen;
     uint16_t compressedLen;
@@ -239,9 +316,62 @@ DecodedKeyLen decodeKeyLen(uint16_t keylen) {
     return DecodedKeyLen{.prefixLen = prefixLen, .compressedLen = compressedLen};
 }
 
-void decodeKey(ByteBuffer &buffer,const Slice& key, const Slice& prevKey,uint16_t prefixLen) {
-    buffer = prevKey.slice(0,prefixLen);
-    buffer.append(key);
+void KeyBlockDecoder::reset(const uint8_t *block,int length) {
+    this->block = block;
+    this->blockLength = length;
+    keyLength = 0;
+    if(format==segmentFormatV1) {
+        index = 0;
+        return;
+    }
+    remaining = readLEuint16(block);
+    nextOffset = blockDataOffset = readLEuint64(block+2);
+    index = keyBlockHeaderSize;
+}
+
+bool KeyBlockDecoder::next() {
+    if(format==segmentFormatV1) {
+        if(index+2>blockLength) throw IllegalState("buffer overrun");
+        uint16_t keylen = readLEuint16(block+index);
+        if(keylen==endOfBlock) return false;
+        index+=2;
+        DecodedKeyLen dk = decodeKeyLen(keylen);
+        if(index+dk.compressedLen+12>blockLength) throw IllegalState("buffer overrun");
+        // the buffer always has the previous key, so only need to replace the suffix
+        memcpy(keyBuffer+dk.prefixLen,block+index,dk.compressedLen);
+        keyLength = dk.prefixLen+dk.compressedLen;
+        index += dk.compressedLen;
+        dataOffset = readLEuint64(block+index);
+        dataLength = readLEuint32(block+index+8);
+        index += 12;
+        return true;
+    }
+    if(remaining==0) return false;
+    uint64_t shared,unshared,length;
+    index += readVarint(block+index,blockLength-index,&shared);
+    index += readVarint(block+index,blockLength-index,&unshared);
+    if(shared > (uint64_t)keyLength || shared+unshared > maxKeyLength || unshared==0) throw IllegalState("invalid prefix/compressed length");
+    if(index+(int)unshared>blockLength) throw IllegalState("buffer overrun");
+    memcpy(keyBuffer+shared,block+index,unshared);
+    keyLength = shared+unshared;
+    index += unshared;
+    index += readVarint(block+index,blockLength-index,&length);
+    if(taggedValues) {
+        valueKind = length & ((1<<valueKindBits)-1);
+        length >>= valueKindBits;
+    }
+    dataOffset = nextOffset;
+    dataLength = length;
+    if(valueKind==valueKindInline) {
+        if(index+(int)length>blockLength) throw IllegalState("buffer overrun");
+        inlineValue = Slice(block+index,length);
+        index += length;
+    } else {
+        // values are stored in key order, so the data offsets are implicit
+        nextOffset += length;
+    }
+    remaining--;
+    return true;
 }
 
 void DiskSegment::Iterator::nextKeyValue() {
@@ -252,11 +382,8 @@ void DiskSegment::Iterator::nextKeyValue() {
 
     DiskSegment *dsp = (DiskSegment*)ds.get();
 
-    prevKey = currentKey;
     while(true) {
-        uint16_t keylen = readLEuint16(buffer+bufferOffset);
-        bufferOffset += 2;
-        if(keylen == endOfBlock) {
+        if(!decoder.next()) {
             block++;
             if(block == dsp->keyBlocks) {
                 finished = true;
@@ -264,60 +391,222 @@ void DiskSegment::Iterator::nextKeyValue() {
                 valid = true;
                 return;
             }
-            int n = dsp->keyFile.readAt(buffer,block*keyBlockSize,keyBlockSize);
-            if(n!=keyBlockSize) throw IllegalState("did not read key block size");
-            bufferOffset = 0;
-            prevKey = ByteBuffer::EMPTY();
+            if(verify) dsp->checkBlock(block);
+            buffer = dsp->keyBlock(block);
+            decoder.reset(buffer,buffer.length);
             continue;
         }
-        DecodedKeyLen dk = decodeKeyLen(keylen);
-        Slice keySlice = buffer.slice(bufferOffset,dk.compressedLen);
-        bufferOffset += dk.compressedLen;
-        decodeKey(currentKey,keySlice,prevKey,dk.prefixLen);
-        uint64_t dataoffset = readLEuint64(buffer+bufferOffset);
-        bufferOffset+=8;
-        uint32_t datalen = readLEuint32(buffer+bufferOffset);
-        bufferOffset+=4;
-        prevKey = currentKey;
+        Slice key = decoder.key();
         if(!lower.empty()) {
-            if(ByteBuffer::less(currentKey,lower))
+            if(Slice::less(key,lower))
                 continue;
-            if(currentKey.compareTo(lower)==0) goto found;
         }
-        if(!upper.empty()) {
-            if(currentKey.compareTo(upper)==0) goto found;
-            if(!ByteBuffer::less(currentKey,upper)) {
-                finished=true;
-                valid=true;
-                currentKey = ByteBuffer::EMPTY();
-                return;
-            }
+        if(!upper.empty() && Slice::less(upper,key)) {
+            finished=true;
+            valid=true;
+            currentKey = ByteBuffer::EMPTY();
+            return;
         }
-    found:
-        if(datalen==0) {
+        currentKey = key;
+        currentKind = decoder.valueKind;
+        uint32_t datalen = decoder.dataLength;
+        if(currentKind==valueKindInline) {
+            currentValue = decoder.inlineValue;
+            currentKind = valueKindData;
+        } else if(datalen==0) {
             currentValue = ByteBuffer::EMPTY();
         } else {
-            currentValue.ensureCapacity(datalen);
-            dsp->dataFile.readAt(currentValue,dataoffset,datalen);
-            currentValue.length = datalen;
+            if(dsp->compression!=compressionNone) {
+                if(decoder.blockDataOffset!=dataBlockOffset) {
+                    dsp->readDataBlock(decoder.blockDataOffset,dataBlock);
+                    dataBlockOffset = decoder.blockDataOffset;
+                }
+                uint64_t offset = decoder.dataOffset-dataBlockOffset;
+                if(offset+datalen > (uint64_t)dataBlock.length) throw IllegalState("value beyond end of data block");
+                currentValue = dataBlock.slice(offset,datalen);
+            } else {
+                currentValue.ensureCapacity(datalen);
+                dsp->dataFile.readAt(currentValue,decoder.dataOffset,datalen);
+                currentValue.length = datalen;
+            }
+            if(currentKind==valueKindBlob && resolveBlobs) {
+                dsp->blobs->read(BlobRef::decode(currentValue),currentValue);
+                currentKind = valueKindData;
+            }
         }
         valid=true;
         return;
     }
 }
 
-void DiskSegment::loadKeyIndex(std::vector<const ByteBuffer>& index,MemoryMappedFile& kf,int64_t keyBlocks) {
-    ByteBuffer buffer(keyBlockSize);
-    if(kf.length()==0) return;
-    int64_t block;
-    for(block = 0; block < keyBlocks; block+= keyIndexInterval) {
-        kf.readAt(buffer,block*keyBlockSize,keyBlockSize);
-        uint16_t keylen = readLEuint16(buffer);
-        if(keylen==endOfBlock) {
+void DiskSegment::loadKeyIndex() {
+    auto pinned = pin();
+    KeyBlockDecoder decoder(format,taggedValues);
+    for(int64_t block = 0; block < keyBlocks; block+= indexInterval) {
+        Slice buffer = keyBlock(block);
+        decoder.reset(buffer,buffer.length);
+        if(!decoder.next()) {
             break;
         }
-        ByteBuffer key(keylen);
-        memcpy(key,buffer+2,keylen);
-        index.push_back(key);
+        keyIndex.push_back(decoder.key());
+    }
+}
+
+/**
+ * @brief read and decompress a data block of a compressed segment
+ */
+void DiskSegment::readDataBlock(uint64_t offset,ByteBuffer& block) {
+    uint8_t header[20];
+    int n = std::min((uint64_t)sizeof(header),keyFile.length()-offset);
+    keyFile.readAt(header,offset,n);
+    uint64_t rawLength,storedLength;
+    int index = readVarint(header,n,&rawLength);
+    index += readVarint(header+index,n-index,&storedLength);
+    if(offset+index+storedLength > keyFile.length()) throw IllegalState("data block beyond end of file");
+    Slice stored = keyFile.slice(offset+index,storedLength);
+    if(storedLength==rawLength) {
+        block = stored;
+    } else {
+        decompress(compression,stored,rawLength,block);
+    }
+}
+
+SegmentMetadata DiskSegment::getMetadata() {
+    SegmentMetadata metadata;
+    metadata.keyOffset = keyOffset;
+    metadata.keyBlocks = keyBlocks;
+    metadata.blockSize = blockSize;
+    metadata.indexInterval = indexInterval;
+    metadata.indexOffset = indexOffset;
+    metadata.indexLength = indexLength;
+    metadata.keyCount = keyCount;
+    metadata.deleteCount = deleteCount;
+    metadata.countsDeletes = countsDeletes;
+    metadata.dataLength = dataLength;
+    metadata.taggedValues = taggedValues;
+    metadata.blobUsage = blobUsage;
+    metadata.compression = compression;
+    metadata.checksums = checksums;
+    metadata.ttlSeconds = ttlSeconds;
+    return metadata;
+}
+
+SegmentMetadata DiskSegment::readMetadata() {
+    if(keyFile.length() < segmentFooterSize) throw IllegalState("segment file too short");
+    auto pinned = pin();
+    uint8_t footer[segmentFooterSize];
+    keyFile.readAt(footer,keyFile.length()-segmentFooterSize,segmentFooterSize);
+    if(readLEuint64(footer+16)!=segmentMagic) throw IllegalState("invalid segment file");
+    if(readLEuint32(footer+12)!=segmentFormatV2) throw IllegalState("unsupported segment format");
+    uint64_t offset = readLEuint64(footer);
+    uint32_t length = readLEuint32(footer+8);
+    if(offset+length+segmentFooterSize > keyFile.length()) throw IllegalState("invalid segment metadata");
+    ByteBuffer buffer(length);
+    keyFile.readAt(buffer,offset,length);
+    return SegmentMetadata::decode(buffer);
+}
+
+void DiskSegment::readKeyIndex(const SegmentMetadata& metadata) {
+    auto pinned = pin();
+    ByteBuffer buffer(metadata.indexLength);
+    keyFile.readAt(buffer,metadata.indexOffset,metadata.indexLength);
+    int index = 0;
+    uint64_t count;
+    index += readVarint(buffer+index,buffer.length-index,&count);
+    for(uint64_t i=0;i<count;i++) {
+        uint64_t length;
+        index += readVarint(buffer+index,buffer.length-index,&length);
+        if(index+(int)length > buffer.length) throw IllegalState("invalid key index");
+        keyIndex.push_back(buffer.slice(index,length));
+        index += length;
+    }
+}
+
+/**
+ * @brief summary of the entries of a key block that fall within a range
+ */
+struct BlockRange {
+    int entries = 0;
+    int matched = 0;
+    // data offset of the first entry >= lower, or past the last entry if none
+    uint64_t startOffset = 0;
+    // data offset past the last entry <= upper, or of the first entry if none
+    uint64_t endOffset = 0;
+};
+
+static BlockRange scanBlockRange(const Slice& buffer,int format,bool taggedValues,const Slice& lower,const Slice& upper) {
+    KeyBlockDecoder decoder(format,taggedValues);
+    decoder.reset(buffer,buffer.length);
+
+    BlockRange range;
+    bool foundStart = false, foundEnd = false;
+    while(decoder.next()) {
+        Slice key = decoder.key();
+        uint64_t offset = decoder.dataOffset;
+        uint32_t length = decoder.valueKind==valueKindInline ? 0 : decoder.dataLength;
+
+        if(range.entries==0) range.endOffset = offset;
+        range.entries++;
+        if(!lower.empty() && Slice::less(key,lower)) {
+            range.startOffset = offset+length;
+            continue;
+        }
+        if(!foundStart) {
+            range.startOffset = offset;
+            foundStart = true;
+        }
+        if(foundEnd || (!upper.empty() && Slice::less(upper,key))) {
+            foundEnd = true;
+            continue;
+        }
+        range.matched++;
+        range.endOffset = offset+length;
+    }
+    return range;
+}
+
+ByteBuffer DiskSegment::lastKey() {
+    ByteBuffer key;
+    if(keyBlocks==0) return key;
+    auto pinned = pin();
+    KeyBlockDecoder decoder(format,taggedValues);
+    Slice buffer = keyBlock(keyBlocks-1);
+    decoder.reset(buffer,buffer.length);
+    while(decoder.next()) {
+        key = decoder.key();
+    }
+    return key;
+}
+
+RangeEstimate DiskSegment::estimateRange(const Slice& lower,const Slice& upper) {
+    if(keyBlocks==0) return RangeEstimate();
+    auto pinned = pin();
+    auto readBlockRange = [&](int64_t block,const Slice& lower,const Slice& upper) {
+        return scanBlockRange(keyBlock(block),format,taggedValues,lower,upper);
+    };
+
+    int64_t lowBlock = lower.empty() ? 0 : findBlock(lower);
+    int64_t highBlock = upper.empty() ? keyBlocks-1 : findBlock(upper);
+    if(highBlock < lowBlock) return RangeEstimate();
+
+    auto low = readBlockRange(lowBlock,lower,upper);
+    if(lowBlock==highBlock) {
+        if(low.matched==0) return RangeEstimate();
+        return RangeEstimate{
+            .bytes = low.endOffset - low.startOffset + (blockSize * low.matched) / low.entries,
+            .count = (uint64_t)low.matched
+        };
+    }
+    auto high = readBlockRange(highBlock,lower,upper);
+
+    // the blocks between the boundary blocks are assumed to be as full as the block in the middle
+    uint64_t middleBlocks = highBlock - lowBlock - 1;
+    uint64_t count = low.matched + high.matched;
+    if(middleBlocks > 0) {
+        auto middle = readBlockRange(lowBlock+1+middleBlocks/2,Slice(),Slice());
+        count += middleBlocks * middle.entries;
     }
+    uint64_t keyBytes = middleBlocks * blockSize + (blockSize * low.matched) / std::max(low.entries,1) + (blockSize * high.matched) / std::max(high.entries,1);
+    uint64_t dataBytes = high.endOffset > low.startOffset ? high.endOffset - low.startOffset : 0;
+    return RangeEstimate{.bytes = keyBytes + dataBytes, .count = count};
 }
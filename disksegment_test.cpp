@@ -86,3 +86,156 @@ BOOST_AUTO_TEST_CASE( disksegment_large ) {
     BOOST_TEST(kv.value=="myvalue1");
 }
 
+
+BOOST_AUTO_TEST_CASE( disksegment_v2 ) {
+    fs::remove_all("test");
+    fs::create_directory("test");
+    auto ms = MemorySegment::newMemoryOnlySegment();
+    std::string longkey(900,'x');
+    for(int i=0;i<100000;i++) {
+        std::string k = "mykey"+std::to_string(i);
+        std::string v = "myvalue"+std::to_string(i);
+        ms->put(k,v);
+        ms->put(longkey+k,v);
+    }
+    ms->remove("mykey5");
+    auto itr = ms->lookup("","");
+    auto ds = writeAndLoadSegment("test/segment.0.0",itr.get(),false);
+    BOOST_TEST(ds->files().size()==1);
+
+    auto verify = [&](SegmentRef ds) {
+        auto itr = ds->lookup("","");
+        int count = 0;
+        while(true) {
+            auto kv = itr->next();
+            if(kv.key.empty()) break;
+            count++;
+        }
+        BOOST_TEST(count==200000);
+        BOOST_TEST(ds->get("mykey1")=="myvalue1");
+        BOOST_TEST(ds->get("mykey99999")=="myvalue99999");
+        BOOST_TEST(ds->get(longkey+"mykey77")=="myvalue77");
+        BOOST_TEST(ds->get("mykey5").empty());
+        BOOST_TEST(ds->get("mykey100000").empty());
+        itr = ds->lookup("mykey1","mykey1");
+        auto kv = itr->next();
+        BOOST_TEST(kv.key=="mykey1");
+        BOOST_TEST(kv.value=="myvalue1");
+        BOOST_TEST(itr->next().key.empty());
+    };
+    verify(ds);
+    // reopen reading the stored key index
+    verify(DiskSegment::newDiskSegment("test/segment.0.0",{}));
+    fs::remove_all("test");
+}
+
+BOOST_AUTO_TEST_CASE( disksegment_compressed ) {
+    fs::remove_all("test");
+    fs::create_directory("test");
+    auto ms = MemorySegment::newMemoryOnlySegment();
+    for(int i=0;i<100000;i++) {
+        std::string v = "{\"name\":\"myvalue\",\"index\":"+std::to_string(i)+",\"active\":true}";
+        ms->put("mykey"+std::to_string(i),v);
+    }
+    ms->remove("mykey5");
+    auto itr = ms->lookup("","");
+    auto plain = writeAndLoadSegment("test/segment.0.0",itr.get(),false);
+    itr = ms->lookup("","");
+    Options options;
+    options.compression = compressionLZ;
+    auto ds = writeAndLoadSegment("test/segment.1.1",itr.get(),false,nullptr,options);
+    BOOST_TEST(ds->size() < plain->size()/2);
+
+    auto verify = [&](SegmentRef ds) {
+        auto itr = ds->lookup("","");
+        int count = 0;
+        while(true) {
+            auto kv = itr->next();
+            if(kv.key.empty()) break;
+            count++;
+        }
+        BOOST_TEST(count==100000);
+        BOOST_TEST(ds->get("mykey1")=="{\"name\":\"myvalue\",\"index\":1,\"active\":true}");
+        BOOST_TEST(ds->get("mykey99999")=="{\"name\":\"myvalue\",\"index\":99999,\"active\":true}");
+        BOOST_TEST(ds->get("mykey5").empty());
+        BOOST_TEST(ds->get("mykey100000").empty());
+        itr = ds->lookup("mykey77","mykey78");
+        auto kv = itr->next();
+        BOOST_TEST(kv.key=="mykey77");
+        BOOST_TEST(kv.value=="{\"name\":\"myvalue\",\"index\":77,\"active\":true}");
+    };
+    verify(ds);
+    verify(DiskSegment::newDiskSegment("test/segment.1.1",{}));
+    fs::remove_all("test");
+}
+
+BOOST_AUTO_TEST_CASE( disksegment_inline ) {
+    fs::remove_all("test");
+    fs::create_directory("test");
+    auto ms = MemorySegment::newMemoryOnlySegment();
+    auto value = [](int i) { return i%10==0 ? std::string(100,'x')+std::to_string(i) : std::to_string(i); };
+    for(int i=0;i<100000;i++) {
+        ms->put("mykey"+std::to_string(i),value(i));
+    }
+    ms->remove("mykey5");
+    Options options;
+    options.inlineValueThreshold = 16;
+    for(auto compression : {compressionNone,compressionLZ}) {
+        options.compression = compression;
+        std::string filename = "test/segment."+std::to_string(compression)+"."+std::to_string(compression);
+        auto itr = ms->lookup("","");
+        auto ds = writeAndLoadSegment(filename,itr.get(),false,nullptr,options);
+        for(auto ds : {ds,DiskSegment::newDiskSegment(filename,{})}) {
+            itr = ds->lookup("","");
+            int count = 0;
+            while(true) {
+                auto kv = itr->next();
+                if(kv.key.empty()) break;
+                count++;
+            }
+            BOOST_TEST(count==100000);
+            BOOST_TEST(ds->get("mykey1")==value(1));
+            BOOST_TEST(ds->get("mykey10")==value(10));
+            BOOST_TEST(ds->get("mykey99999")==value(99999));
+            BOOST_TEST(ds->get("mykey5").empty());
+            itr = ds->lookup("mykey99990","mykey99991");
+            BOOST_TEST(itr->next().value==value(99990));
+            BOOST_TEST(itr->next().value==value(99991));
+        }
+    }
+    fs::remove_all("test");
+}
+
+BOOST_AUTO_TEST_CASE( disksegment_block_size ) {
+    fs::remove_all("test");
+    fs::create_directory("test");
+    auto ms = MemorySegment::newMemoryOnlySegment();
+    std::string longkey(500,'x');
+    for(int i=0;i<20000;i++) {
+        ms->put(longkey+std::to_string(i),"myvalue"+std::to_string(i));
+    }
+    Options options;
+    options.blockSize = 16*1024;
+    options.indexInterval = 4;
+    auto itr = ms->lookup("","");
+    auto ds = writeAndLoadSegment("test/segment.0.0",itr.get(),false,nullptr,options);
+    for(auto ds : {ds,DiskSegment::newDiskSegment("test/segment.0.0",{})}) {
+        auto& index = std::dynamic_pointer_cast<DiskSegment>(ds)->getKeyIndex();
+        BOOST_TEST(index.size() > 1);
+        itr = ds->lookup("","");
+        int count = 0;
+        while(!itr->next().key.empty()) count++;
+        BOOST_TEST(count==20000);
+        for(int i=0;i<20000;i+=97) {
+            BOOST_TEST(ds->get(longkey+std::to_string(i))=="myvalue"+std::to_string(i));
+        }
+        auto estimate = ds->estimateRange("","");
+        BOOST_TEST(estimate.count > 15000);
+        BOOST_TEST(estimate.count < 25000);
+    }
+
+    options.blockSize = 1024;
+    itr = ms->lookup("","");
+    BOOST_CHECK_THROW(writeAndLoadSegment("test/segment.1.1",itr.get(),false,nullptr,options),IllegalState);
+    fs::remove_all("test");
+}
@@ -0,0 +1,50 @@
+#include "filecache.h"
+#include "memorymapped.h"
+
+void FileCache::opened(MemoryMappedFile* file) {
+    opens++;
+    clock++;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        file->position = files.insert(files.end(),file);
+        file->queuedAt = file->lastUsed;
+        openFiles = files.size();
+    }
+    trim(file);
+}
+
+void FileCache::trim(MemoryMappedFile* file) {
+    std::lock_guard<std::mutex> lock(mtx);
+
+    // each file is visited at most once, since the files moved to the back are not reached again
+    auto remaining = files.size();
+    for(auto itr = files.begin();files.size() > maxOpenFiles && remaining > 0;remaining--) {
+        auto f = *itr;
+        auto next = std::next(itr);
+        auto used = f->lastUsed.load(std::memory_order_relaxed);
+        if(used!=f->queuedAt) {
+            // the file was accessed since it was queued, so it is given another turn
+            f->queuedAt = used;
+            files.splice(files.end(),files,itr);
+        } else if(f!=file && f->users()==0 && f->tryUnmap()) {
+            // the files are unmapped with a try lock, since a file that is being mapped holds its
+            // lock while it calls opened()
+            files.erase(itr);
+            evictions++;
+        }
+        itr = next;
+    }
+    openFiles = files.size();
+}
+
+void FileCache::forget(MemoryMappedFile* file) {
+    std::lock_guard<std::mutex> lock(mtx);
+    // the file is only in the list while it is mapped
+    if(file->state.load()>=0) files.erase(file->position);
+    openFiles = files.size();
+}
+
+FileCacheStats FileCache::getStats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return FileCacheStats{.hits = hits, .opens = opens, .evictions = evictions, .openFiles = files.size()};
+}
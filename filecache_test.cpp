@@ -0,0 +1,116 @@
+#define BOOST_TEST_MODULE filecache
+#include <boost/test/included/unit_test.hpp>
+
+#include <fstream>
+#include <thread>
+
+#include "memorymapped.h"
+
+static const std::string dir = "test/filecache";
+
+static std::string createFile(int i) {
+    auto name = dir+"/file."+std::to_string(i);
+    std::ofstream out(name);
+    out << "contents" << i;
+    out.close();
+    return name;
+}
+
+static std::string read(MemoryMappedFile& file) {
+    auto pinned = file.pin();
+    return std::string(file.slice(0,file.length()));
+}
+
+BOOST_AUTO_TEST_CASE( filecache_lazy ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    auto cache = std::make_shared<FileCache>(2);
+    MemoryMappedFile file(createFile(0),cache);
+    // the file is not mapped until it is read
+    BOOST_TEST(cache->getStats().openFiles==0);
+    BOOST_TEST(read(file)=="contents0");
+    BOOST_TEST(read(file)=="contents0");
+    auto stats = cache->getStats();
+    BOOST_TEST(stats.opens==1);
+    BOOST_TEST(stats.hits==1);
+    BOOST_TEST(stats.openFiles==1);
+}
+
+BOOST_AUTO_TEST_CASE( filecache_evict ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    auto cache = std::make_shared<FileCache>(2);
+    std::vector<std::unique_ptr<MemoryMappedFile>> files;
+    for(int i=0;i<4;i++) files.push_back(std::make_unique<MemoryMappedFile>(createFile(i),cache));
+
+    read(*files[0]);
+    read(*files[1]);
+    read(*files[0]);
+    // file 1 is the least recently used
+    read(*files[2]);
+    auto stats = cache->getStats();
+    BOOST_TEST(stats.openFiles==2);
+    BOOST_TEST(stats.evictions==1);
+    BOOST_TEST(read(*files[0])=="contents0");
+    BOOST_TEST(cache->getStats().opens==3);
+
+    // an evicted file is mapped again when it is read
+    BOOST_TEST(read(*files[1])=="contents1");
+    BOOST_TEST(cache->getStats().opens==4);
+    BOOST_TEST(cache->getStats().openFiles==2);
+
+    // destroyed files leave the cache
+    files.clear();
+    BOOST_TEST(cache->getStats().openFiles==0);
+}
+
+BOOST_AUTO_TEST_CASE( filecache_pinned ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    auto cache = std::make_shared<FileCache>(1);
+    MemoryMappedFile file0(createFile(0),cache);
+    MemoryMappedFile file1(createFile(1),cache);
+
+    // pinned files are not unmapped, so the limit is exceeded until the other files are released
+    auto pinned = file0.pin();
+    Slice contents = file0.slice(0,file0.length());
+    auto pinned1 = file1.pin();
+    BOOST_TEST(cache->getStats().openFiles==2);
+    BOOST_TEST(cache->getStats().evictions==0);
+    pinned1 = MemoryMappedFile::Pin();
+    BOOST_TEST(cache->getStats().openFiles==1);
+    BOOST_TEST(cache->getStats().evictions==1);
+    BOOST_TEST(std::string(contents)=="contents0");
+    pinned = MemoryMappedFile::Pin();
+
+    MemoryMappedFile file2(createFile(2),cache);
+    BOOST_TEST(read(file2)=="contents2");
+    BOOST_TEST(read(file1)=="contents1");
+    BOOST_TEST(cache->getStats().openFiles==1);
+}
+
+BOOST_AUTO_TEST_CASE( filecache_concurrent ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    auto cache = std::make_shared<FileCache>(3);
+    std::vector<std::unique_ptr<MemoryMappedFile>> files;
+    for(int i=0;i<10;i++) files.push_back(std::make_unique<MemoryMappedFile>(createFile(i),cache));
+
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for(int t=0;t<4;t++) {
+        threads.push_back(std::thread([&,t]() {
+            for(int i=0;i<5000;i++) {
+                int index = (i*7+t) % files.size();
+                if(read(*files[index])!="contents"+std::to_string(index)) mismatches++;
+            }
+        }));
+    }
+    for(auto& thread : threads) thread.join();
+    BOOST_TEST(mismatches==0);
+    auto stats = cache->getStats();
+    // files mapped beyond the limit while others were pinned are unmapped once they are released
+    BOOST_TEST(stats.openFiles<=3);
+    BOOST_TEST(stats.hits+stats.opens==20000);
+    fs::remove_all(dir);
+}
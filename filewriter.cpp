@@ -0,0 +1,190 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "filewriter.h"
+#include "exceptions.h"
+
+// the file is preallocated in steps of at least this size
+static const uint64_t preallocateSize = 16*1024*1024;
+
+FileWriter::FileWriter(const std::string& path,bool directIO,int bufferSize,RateLimiter *limiter)
+    : directIO(directIO), bufferSize(((bufferSize + alignment - 1) / alignment) * alignment), limiter(limiter) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if(directIO) {
+        fd = ::open(path.c_str(),flags | O_DIRECT,0660);
+    }
+#endif
+    // not all filesystems support O_DIRECT
+    if(fd==-1) fd = ::open(path.c_str(),flags,0660);
+    if(fd==-1) throw IllegalState(("unable to create file "+path).c_str());
+#ifdef F_NOCACHE
+    if(directIO) fcntl(fd,F_NOCACHE,1);
+#endif
+    for(auto& buffer : buffers) {
+        if(posix_memalign((void**)&buffer.data,alignment,this->bufferSize)!=0) {
+            throw IllegalState("unable to allocate write buffer");
+        }
+    }
+    writer = std::thread([this](){ writeLoop(); });
+}
+
+FileWriter::~FileWriter() {
+    try {
+        finish();
+    } catch(...) {
+    }
+    if(fd!=-1) ::close(fd);
+    for(auto& buffer : buffers) free(buffer.data);
+}
+
+void FileWriter::write(const Slice& data) {
+    const uint8_t *p = data;
+    int remaining = data.length;
+    while(remaining > 0) {
+        Buffer& buffer = buffers[current];
+        int n = std::min(remaining,bufferSize-buffer.length);
+        memcpy(buffer.data+buffer.length,p,n);
+        buffer.length += n;
+        p += n;
+        remaining -= n;
+        if(buffer.length==bufferSize) flushBuffer();
+    }
+}
+
+void FileWriter::writeZeros(uint64_t length) {
+    while(length > 0) {
+        Buffer& buffer = buffers[current];
+        int n = std::min(length,(uint64_t)(bufferSize-buffer.length));
+        memset(buffer.data+buffer.length,0,n);
+        buffer.length += n;
+        length -= n;
+        if(buffer.length==bufferSize) flushBuffer();
+    }
+}
+
+void FileWriter::writeFile(const std::string& path) {
+    int in = ::open(path.c_str(),O_RDONLY);
+    if(in==-1) throw IllegalState(("unable to open file "+path).c_str());
+    while(true) {
+        Buffer& buffer = buffers[current];
+        auto n = ::read(in,buffer.data+buffer.length,bufferSize-buffer.length);
+        if(n < 0 && errno==EINTR) continue;
+        if(n < 0) {
+            ::close(in);
+            throw IllegalState(("unable to read file "+path).c_str());
+        }
+        if(n==0) break;
+        buffer.length += n;
+        if(buffer.length==bufferSize) flushBuffer();
+    }
+    ::close(in);
+}
+
+/**
+ * @brief hand the current buffer to the writer thread, once it has written the other buffer
+ */
+void FileWriter::flushBuffer() {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock,[this](){ return pending==nullptr; });
+    if(error) std::rethrow_exception(error);
+    pending = &buffers[current];
+    pendingOffset = flushed;
+    flushed += pending->length;
+    cv.notify_all();
+    current ^= 1;
+    buffers[current].length = 0;
+}
+
+void FileWriter::writeLoop() {
+    while(true) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock,[this](){ return pending!=nullptr || closing; });
+        if(pending==nullptr) return;
+        Buffer *buffer = pending;
+        uint64_t offset = pendingOffset;
+        lock.unlock();
+        try {
+            if(limiter!=nullptr) limiter->request(buffer->length);
+            if(offset+buffer->length > allocated) {
+                allocated = std::max(allocated*2,offset+buffer->length+preallocateSize);
+#if defined(__linux__)
+                // keep the file size, since the file is truncated to the written length on close
+                fallocate(fd,FALLOC_FL_KEEP_SIZE,0,allocated);
+#elif defined(F_PREALLOCATE)
+                fstore_t store = {F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t)(allocated-offset), 0};
+                fcntl(fd,F_PREALLOCATE,&store);
+#endif
+            }
+            writeFully(buffer->data,buffer->length);
+        } catch(...) {
+            lock.lock();
+            error = std::current_exception();
+            pending = nullptr;
+            cv.notify_all();
+            return;
+        }
+        lock.lock();
+        pending = nullptr;
+        cv.notify_all();
+    }
+}
+
+void FileWriter::writeFully(const uint8_t *data,int length) {
+    while(length > 0) {
+        auto n = ::write(fd,data,length);
+        if(n < 0 && errno==EINTR) continue;
+        if(n <= 0) throw IllegalState("unable to write file");
+        data += n;
+        length -= n;
+    }
+}
+
+/**
+ * @brief write the last buffer and stop the writer thread
+ */
+void FileWriter::finish() {
+    if(!writer.joinable()) return;
+    uint64_t length = position();
+    Buffer& buffer = buffers[current];
+    try {
+        if(buffer.length > 0) {
+            if(directIO) {
+                // direct writes must be a multiple of the alignment, the padding is truncated below
+                int padded = ((buffer.length + alignment - 1) / alignment) * alignment;
+                memset(buffer.data+buffer.length,0,padded-buffer.length);
+                buffer.length = padded;
+            }
+            flushBuffer();
+        }
+    } catch(...) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closing = true;
+            cv.notify_all();
+        }
+        writer.join();
+        throw;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock,[this](){ return pending==nullptr; });
+        closing = true;
+        cv.notify_all();
+    }
+    writer.join();
+    if(error) std::rethrow_exception(error);
+    // removes the direct IO padding and any preallocated space
+    if(ftruncate(fd,length)!=0) throw IllegalState("unable to truncate file");
+}
+
+void FileWriter::close() {
+    finish();
+    if(fd!=-1) {
+        ::close(fd);
+        fd = -1;
+    }
+}
@@ -0,0 +1,50 @@
+#define BOOST_TEST_MODULE filewriter
+#include <boost/test/included/unit_test.hpp>
+
+#include <filesystem>
+#include <fstream>
+
+#include "filewriter.h"
+#include "exceptions.h"
+
+namespace fs = std::filesystem;
+
+static std::string readFile(const std::string& path) {
+    std::ifstream in(path,std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in),std::istreambuf_iterator<char>());
+}
+
+BOOST_AUTO_TEST_CASE( filewriter ) {
+    fs::remove_all("test");
+    fs::create_directory("test");
+
+    for(bool directIO : {false,true}) {
+        std::string expected;
+        {
+            // a small buffer so that writes span several buffers
+            FileWriter writer("test/file",directIO,8192);
+            for(int i=0;i<10000;i++) {
+                std::string s = "value"+std::to_string(i);
+                writer.write(Slice((const uint8_t*)s.data(),s.length()));
+                expected += s;
+            }
+            writer.writeZeros(10000);
+            expected += std::string(10000,'\0');
+            BOOST_TEST(writer.position()==expected.length());
+            writer.close();
+        }
+        BOOST_TEST(readFile("test/file")==expected);
+
+        {
+            FileWriter writer("test/copy",directIO,8192);
+            writer.write((const uint8_t*)"header",6);
+            writer.writeFile("test/file");
+        }
+        BOOST_TEST(readFile("test/copy")=="header"+expected);
+    }
+    fs::remove_all("test");
+}
+
+BOOST_AUTO_TEST_CASE( filewriter_errors ) {
+    BOOST_CHECK_THROW(FileWriter("test/nodirectory/file"),IllegalState);
+}
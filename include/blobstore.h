@@ -0,0 +1,165 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "constants.h"
+#include "bytebuffer.h"
+#include "memorymapped.h"
+#include "segment.h"
+#include "deleter.h"
+
+/**
+ * @brief identifies a blob file. Blob files are named after the segment that created them.
+ */
+struct BlobFileID {
+    ID lower;
+    ID upper;
+    bool operator<(const BlobFileID& other) const {
+        return lower < other.lower || (lower==other.lower && upper < other.upper);
+    }
+    bool operator==(const BlobFileID& other) const {
+        return lower==other.lower && upper==other.upper;
+    }
+};
+
+/**
+ * @brief a reference to a value stored in a blob file. The reference is stored in the segment
+ * in place of the value.
+ */
+struct BlobRef {
+    BlobFileID file;
+    uint64_t offset;
+    uint32_t length;
+
+    static const int maxEncodedLength = 40;
+    ByteBuffer& encode(ByteBuffer& buffer) const;
+    static BlobRef decode(const Slice& buffer);
+};
+
+/**
+ * @brief the number of bytes a segment references in a blob file
+ */
+struct BlobUsage {
+    BlobFileID file;
+    uint64_t bytes;
+};
+
+class BlobStore;
+
+typedef std::shared_ptr<BlobStore> BlobStoreRef;
+
+/**
+ * @brief the blob files of a database. Blob files are append-only while they are written by a
+ * merge or flush, and immutable afterwards. They are opened lazily on first read.
+ */
+class BlobStore {
+private:
+    const std::string dbpath;
+    const std::shared_ptr<Deleter> deleter;
+    std::mutex mtx;
+    std::map<BlobFileID,std::shared_ptr<MemoryMappedFile>> files;
+    // the blob files referenced by the installed segments, and their sizes
+    std::map<BlobFileID,uint64_t> live;
+    // the number of open disk segments that reference each blob file
+    std::map<BlobFileID,int> references;
+    // the blob files that are no longer live, but are still referenced by an open segment
+    std::set<BlobFileID> obsolete;
+    std::shared_ptr<MemoryMappedFile> open(const BlobFileID& id);
+    /**
+     * @brief unmap the blob files and queue them for deletion
+     */
+    void remove(const std::vector<BlobFileID>& ids);
+public:
+    /**
+     * @param deleter if not null, deletes the blob files once they are no longer referenced,
+     * otherwise they are only deleted when the database is opened again
+     */
+    BlobStore(const std::string& dbpath,std::shared_ptr<Deleter> deleter = nullptr) : dbpath(dbpath), deleter(deleter) {}
+    std::string filename(const BlobFileID& id) const {
+        return "blob."+std::to_string(id.lower)+"."+std::to_string(id.upper);
+    }
+    std::string path(const BlobFileID& id) const { return dbpath+"/"+filename(id); }
+    /**
+     * @brief the bytes referenced in each blob file by the segment, empty if it is not a v2 disk segment
+     */
+    static const std::vector<BlobUsage>& usage(const SegmentRef& segment);
+    /**
+     * @brief read the value referenced by ref
+     */
+    ByteBuffer& read(const BlobRef& ref,ByteBuffer& value);
+    /**
+     * @brief true if the value referenced by ref was written more than ttlSeconds before now,
+     * reading only its write time, see Options::ttlSeconds
+     */
+    bool expired(const BlobRef& ref,int ttlSeconds,uint64_t now);
+    /**
+     * @brief called when the database is opened, removes any blob files that are not referenced
+     * by the segments, e.g. written by a merge that did not complete
+     */
+    void open(const std::vector<SegmentRef>& segments);
+    /**
+     * @brief track the blob files referenced by a newly installed segment
+     */
+    void installed(const SegmentRef& segment);
+    /**
+     * @brief the fraction of each live blob file that is not referenced by the segments
+     */
+    std::map<BlobFileID,double> garbageRatios(const std::vector<SegmentRef>& segments);
+    /**
+     * @brief called when a disk segment that references blob files is opened
+     */
+    void acquire(const std::vector<BlobUsage>& usage);
+    /**
+     * @brief called when a disk segment that references blob files is destroyed. The blob files
+     * that are no longer live are deleted once no open segment references them.
+     */
+    void release(const std::vector<BlobUsage>& usage);
+    /**
+     * @brief stop tracking the live blob files that are no longer referenced by the segments. The
+     * files are deleted once the segments of older snapshots that reference them are destroyed.
+     * @return the filenames of the blob files, which should be scheduled for deletion so that they
+     * are deleted after a crash
+     */
+    std::vector<std::string> unreferenced(const std::vector<SegmentRef>& segments);
+};
+
+/**
+ * @brief separates the large values of a segment being written into a new blob file. The blob
+ * file is created on the first separated value.
+ */
+class BlobWriter {
+private:
+    std::fstream file;
+    uint64_t offset = 0;
+    std::map<BlobFileID,uint64_t> usage;
+    ByteBuffer value;
+public:
+    const BlobStoreRef store;
+    const BlobFileID id;
+    const int threshold;
+    // references into these blob files are rewritten into the new blob file
+    const std::set<BlobFileID> relocate;
+
+    BlobWriter(BlobStoreRef store,const BlobFileID& id,int threshold,const std::set<BlobFileID>& relocate = {})
+        : store(store), id(id), threshold(threshold), relocate(relocate) {}
+    /**
+     * @brief determine how a value is stored in the segment
+     *
+     * @param value the value, or an encoded BlobRef if isRef is true
+     * @param isRef true if the value is an encoded reference from a raw lookup
+     * @param ref set to the encoded reference if the value is stored in a blob file
+     * @return true if the value is stored in a blob file
+     */
+    bool separate(const Slice& value,bool isRef,ByteBuffer& ref);
+    /**
+     * @brief close the blob file
+     * @return the bytes referenced by the segment in each blob file
+     */
+    std::vector<BlobUsage> finish();
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+#include "bytebuffer.h"
+#include "keyvalue.h"
+#include "lookupiterator.h"
+#include "options.h"
+
+/**
+ * @brief the length of the write time stored at the end of each value when Options::ttlSeconds
+ * is set
+ */
+constexpr int writeTimeLength = 8;
+
+/**
+ * @brief the current time in milliseconds, as stored with the values
+ */
+uint64_t currentWriteTime();
+/**
+ * @brief set the stored value to the value followed by the write time
+ */
+void appendWriteTime(ByteBuffer& stored,const Slice& value,uint64_t now);
+/**
+ * @brief true if the stored value was written more than ttlSeconds before now
+ */
+bool isExpired(const Slice& stored,int ttlSeconds,uint64_t now);
+/**
+ * @brief remove the write time from a stored value, or make it empty if it has expired. Deletions
+ * are unchanged.
+ */
+void removeWriteTime(ByteBuffer& value,int ttlSeconds,uint64_t now);
+/**
+ * @brief apply the TTL expiry and compaction filter of the options to an entry that is being
+ * written to a segment. A removed entry is left with an empty value, i.e. a deletion.
+ *
+ * @param newValue a buffer for the filter to store a changed value
+ */
+void applyCompactionFilter(const Options& options,uint64_t now,KeyValue& kv,ByteBuffer& newValue);
+
+/**
+ * @brief removes the write times from the values of a database with Options::ttlSeconds. Expired
+ * values are returned as deletions.
+ */
+class TtlIterator final : public LookupIterator {
+private:
+    LookupRef itr;
+    const int ttlSeconds;
+    const uint64_t now;
+public:
+    TtlIterator(LookupRef itr,int ttlSeconds) : itr(std::move(itr)), ttlSeconds(ttlSeconds), now(currentWriteTime()) {}
+    Slice peekKey() override { return itr->peekKey(); }
+    KeyValue& next(KeyValue& kv) override {
+        itr->next(kv);
+        removeWriteTime(kv.value,ttlSeconds,now);
+        return kv;
+    }
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief the counters of the merges chosen by a CompactionPolicy
+ */
+struct CompactionStats {
+    uint64_t merges = 0;
+    // the bytes of the merged segments, and of those that had not been merged before
+    uint64_t inputBytes = 0;
+    uint64_t freshBytes = 0;
+    // the bytes of the segments written by the merges
+    uint64_t outputBytes = 0;
+    // the bytes written by merges per byte of segments that had not been merged before
+    double writeAmplification = 0;
+};
+
+/**
+ * @brief a run of consecutive segments, oldest first, that is merged into a single segment
+ */
+struct SegmentRun {
+    int startAt;
+    int count;
+};
+
+/**
+ * @brief chooses the segments merged to keep the number of segments of a database that is not
+ * leveled within Options::maxSegments. May be shared by several databases.
+ */
+class CompactionPolicy {
+private:
+    std::atomic<uint64_t> merges{0};
+    std::atomic<uint64_t> inputBytes{0};
+    std::atomic<uint64_t> freshBytes{0};
+    std::atomic<uint64_t> outputBytes{0};
+public:
+    virtual ~CompactionPolicy() {}
+    /**
+     * @brief choose at most maxRuns disjoint runs of at least 2 segments to merge. Called while
+     * there are more than maxSegments segments; if no runs are returned the merging stops.
+     *
+     * @param sizes the sizes of the segments in bytes, oldest first
+     */
+    virtual std::vector<SegmentRun> selectRuns(const std::vector<uint64_t>& sizes,int maxSegments,int maxRuns) = 0;
+    /**
+     * @brief record a merge chosen by the policy
+     *
+     * @param fresh the bytes of the inputs that had not been merged before
+     */
+    void recordMerge(uint64_t input,uint64_t fresh,uint64_t output);
+    CompactionStats getStats();
+};
+
+/**
+ * @brief merges the runs that start at the smallest segments, extending each over up to half of
+ * the segments. This is the default policy.
+ */
+class SmallestFirstPolicy : public CompactionPolicy {
+public:
+    std::vector<SegmentRun> selectRuns(const std::vector<uint64_t>& sizes,int maxSegments,int maxRuns) override;
+};
+
+/**
+ * @brief a tiered policy that merges runs of the newest segments whose sizes are similar, so
+ * that a large segment is not rewritten to absorb much smaller ones. Starting from the newest
+ * segment, a run is extended over the next older segment while its size is at most
+ * (100+sizeRatio)% of the size of the run. If no run of 2 segments qualifies, the newest segments
+ * are merged.
+ */
+class SizeRatioPolicy : public CompactionPolicy {
+private:
+    const int sizeRatio;
+    const int maxMergeWidth;
+public:
+    /**
+     * @param sizeRatio the percentage by which an older segment may be larger than the run
+     * @param maxMergeWidth the maximum number of segments in a run
+     */
+    SizeRatioPolicy(int sizeRatio = 1,int maxMergeWidth = 32) : sizeRatio(sizeRatio), maxMergeWidth(std::max(maxMergeWidth,2)) {}
+    std::vector<SegmentRun> selectRuns(const std::vector<uint64_t>& sizes,int maxSegments,int maxRuns) override;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "bytebuffer.h"
+
+/**
+ * @brief the codecs used to compress the data blocks of a segment. The codec id is stored in the
+ * segment metadata, so the values must not change.
+ */
+enum Compression {
+    compressionNone = 0,
+    // built-in LZ77 codec with a byte oriented format similar to LZ4, always available
+    compressionLZ = 1,
+    // requires building with ZSTD=1
+    compressionZstd = 2,
+};
+
+/**
+ * @brief true if the codec is supported by this build
+ */
+bool compressionAvailable(int codec);
+
+/**
+ * @brief compress the input, replacing the contents of out
+ */
+void compress(int codec,const Slice& in,ByteBuffer& out);
+
+/**
+ * @brief decompress the input, replacing the contents of out
+ * 
+ * @param rawLength the length of the uncompressed data
+ */
+void decompress(int codec,const Slice& in,int rawLength,ByteBuffer& out);
@@ -1,13 +1,40 @@
 #pragma once
 
 #include <stddef.h>
+#include <cstdint>
 
 typedef unsigned long long ID;
 
 const int keyBlockSize = 4096;
 const int maxKeySize = 1000;
+const int maxKeyLength = 1024;
 const uint16_t endOfBlock = 0x8000;
 const uint16_t compressedBit = 0x8000;
 const uint16_t maxPrefixLen = 0xFF ^ 0x80;
 const uint16_t maxCompressedLen = 0xFF;
 const int keyIndexInterval = 16;
+// the range of key block sizes for v2 segments
+const int minKeyBlockSize = 2048;
+const int maxKeyBlockSize = 1024*1024;
+
+const int segmentFormatV1 = 1;
+const int segmentFormatV2 = 2;
+const uint64_t segmentMagic = 0x3267655362446C43ULL;
+// the v2 footer is the metadata offset (8), metadata length (4), format version (4) and magic (8)
+const int segmentFooterSize = 24;
+// the manifest is the magic (8) and format version (4), the entries, and the checksum of both (4)
+const uint64_t manifestMagic = 0x74736566696E614DULL;
+const uint32_t manifestVersion = 1;
+// the v2 key block header is the entry count (2) and the data offset of the first entry (8)
+const int keyBlockHeaderSize = 10;
+// the v2 key block trailer is the checksum of the block's data (4) and of the key block (4)
+const int keyBlockTrailerSize = 8;
+// when a v2 segment has tagged values, the low bits of each value length are the value kind
+const int valueKindBits = 2;
+const int valueKindData = 0;
+const int valueKindBlob = 1;
+// the value follows the length in the key block
+const int valueKindInline = 2;
+const int maxInlineValueLength = 512;
+// the uncompressed size at which the values of a compressed v2 segment are flushed as a data block
+const int dataBlockSize = 16*1024;
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "slice.h"
+
+/**
+ * @brief compute the CRC32C (Castagnoli) checksum, using the SSE4.2 or ARMv8 CRC instructions when
+ * the cpu supports them
+ * 
+ * @param crc the checksum of the preceding data, or 0
+ */
+uint32_t crc32c(uint32_t crc,const uint8_t *data,size_t length);
+inline uint32_t crc32c(const Slice& data) { return crc32c(0,data,data.length); }
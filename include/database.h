@@ -3,6 +3,7 @@
 #include <memory>
 #include <string>
 #include <atomic>
+#include <functional>
 
 #include "segment.h"
 #include "memorysegment.h"
@@ -12,20 +13,27 @@
 #include "lockfile.h"
 #include "writebatch.h"
 #include "deleter.h"
+#include "blobstore.h"
+#include "scrubber.h"
+#include "levels.h"
 
 class Merger;
 
 class DatabaseState {
 friend class Database;
 friend class Merger;
+friend class Scrubber;
 private:
     const std::vector<SegmentRef> segments;
     const MemorySegmentRef memory;
     const SegmentRef multi;
+    // for a leveled database, the disk segments of levels 1..n. The segments start with one
+    // segment per non-empty level, deepest first, followed by level 0.
+    const Levels levels;
 public:
-    DatabaseState(const std::vector<SegmentRef>& segments, const MemorySegmentRef& memory, const SegmentRef& multi)
-        : segments(segments), memory(memory), multi(multi) {}
-    DatabaseState(const DatabaseState& other) : segments(other.segments), memory(other.memory), multi(other.multi){}
+    DatabaseState(const std::vector<SegmentRef>& segments, const MemorySegmentRef& memory, const SegmentRef& multi, const Levels& levels = {})
+        : segments(segments), memory(memory), multi(multi), levels(levels) {}
+    DatabaseState(const DatabaseState& other) : segments(other.segments), memory(other.memory), multi(other.multi), levels(other.levels){}
 };
 
 class Database;
@@ -40,6 +48,10 @@ typedef std::shared_ptr<Snapshot> SnapshotRef;
 
 class Database {
 friend class Merger;
+friend class Scrubber;
+friend class Snapshot;
+friend class DiskSegment;
+friend SegmentRef writeSegmentToDisk(Database *db,Segment *seg);
 
 private:
     static constexpr int dbMemorySegment = 1024 * 1024;
@@ -53,6 +65,8 @@ private:
 
     bool _open;
     std::atomic<uint64_t> nextSegID{0};
+    // numbers the files staged by ingest()
+    std::atomic<uint64_t> stagedFiles{0};
     std::atomic<bool> closing;
     std::atomic<std::exception*> err;
     LockFile lockFile;
@@ -61,8 +75,14 @@ private:
     std::exception_ptr error; // if non-null and async error has occurred
     std::shared_ptr<const DatabaseState> state;
     std::weak_ptr<Database> weakRef;
+    // true if the segments are organized into levels, see Options::leveled
+    bool leveled = false;
     Merger merger;
-    Deleter deleter;
+    Scrubber scrubber;
+    std::shared_ptr<Deleter> deleter;
+    BlobStoreRef blobs;
+    // serializes the updates of the manifest, see saveManifest()
+    std::mutex manifest_lock;
 
 public:
     /**
@@ -103,6 +123,12 @@ public:
      * @return a reference to the provided ByteBuffer. The value will be empty if the key is not found 
      */
     ByteBuffer& get(const Slice& key,ByteBuffer& value);
+    /**
+     * @brief get the value associated with the key, using the read options
+     * 
+     * @throws DatabaseCorrupted if the options verify checksums and a checksum does not match
+     */
+    ByteBuffer& get(const Slice& key,ByteBuffer& value,const ReadOptions& options);
     /**
      * @brief put a key/value pair into the database
      * 
@@ -132,12 +158,92 @@ public:
      * @return a shared reference to the iterator
      */
     LookupRef lookup(const Slice& lower,const Slice& upper);
+    /**
+     * @brief get an Iterator for the Database using the read options
+     * 
+     * @throws DatabaseCorrupted from the iterator if the options verify checksums and a checksum does not match
+     */
+    LookupRef lookup(const Slice& lower,const Slice& upper,const ReadOptions& options);
+    /**
+     * @brief estimate the number of bytes used by a key range, without scanning it. The cost is
+     proportional to the number of segments times the log of the number of key blocks.
+     * 
+     * @param lower the lower range, or empty
+     * @param upper the upper range, or empty
+     */
+    uint64_t approximateSize(const Slice& lower,const Slice& upper);
+    /**
+     * @brief estimate the number of keys in a key range, without scanning it. Keys that exist in
+     multiple segments (updates and removes) are counted more than once.
+     * 
+     * @param lower the lower range, or empty
+     * @param upper the upper range, or empty
+     */
+    uint64_t approximateCount(const Slice& lower,const Slice& upper);
     /**
      * @brief get a read-only Snapshot of the database, which is constant after created
      * 
      * @return a reference to the Snapshot
      */
     SnapshotRef snapshot();
+    /**
+     * @brief create a copy of the database that can be opened as a separate database, while the
+     database remains open. The disk segment and blob files are immutable, so they are hard linked
+     into the directory, or copied if it is on another file system. The memory segment is rotated
+     and written to a segment file of the copy. Writes made before the call are included.
+     * 
+     * @param dir the directory of the copy, which must not exist
+     * @throws DatabaseException if the directory exists
+     */
+    void checkpoint(const std::string& dir);
+    /**
+     * @brief add segment files built by a SegmentWriter to the database without rewriting them,
+     for example to bulk load sorted data. The files are hard linked into the database directory, or
+     copied if it is on another file system, and assigned segment ids that are newer than every
+     write made before the call. Either all of the files are ingested or none are, also if the
+     process crashes during the call. The segments are merged like any other segment. The files
+     should be built with the options of the database.
+
+     A linked file shares its contents with the database, so it must never be modified after the
+     call, only removed or replaced. A SegmentWriter replaces an existing file rather than
+     writing into it, so a file may be rebuilt at the same path.
+     * 
+     * @param files the segment files, oldest first, so later files take precedence for a key in
+     more than one file. Empty segments are ignored.
+     * @throws DatabaseException if a file is not a segment file, references blob files, or was
+     not written with a TTL if and only if the database has one
+     */
+    void ingest(const std::vector<std::string>& files);
+    /**
+     * @brief merge the segments that overlap the key range while the database remains open, for
+     example to remove the deletions of a range that was deleted or reloaded. Writes made before the
+     call are included. For a leveled database, the overlapping segments of every level but the
+     deepest are compacted into the next level.
+     * 
+     * @param lower the lower range, or empty
+     * @param upper the upper range, or empty
+     * @param progress if set, called as the merges read their entries and after each merge
+     */
+    void compactRange(const Slice& lower,const Slice& upper,const CompactionProgress& progress = nullptr);
+    /**
+     * @brief verify the checksums of every disk segment now, rather than waiting for the background
+     scrub configured by Options::scrubIntervalSeconds
+     * 
+     * @return the scrub statistics, including prior scrubs
+     */
+    ScrubStats scrub();
+    /**
+     * @brief the statistics of the scrubs since the database was opened
+     */
+    ScrubStats scrubStats() { return scrubber.getStats(); }
+    /**
+     * @brief the files waiting to be deleted in the background, and those deleted since open
+     */
+    DeleterStats deleterStats() { return deleter->getStats(); }
+    /**
+     * @brief the counters of the cache of mapped segment files, all 0 if maxOpenFiles is 0
+     */
+    FileCacheStats fileCacheStats() { return options.fileCache ? options.fileCache->getStats() : FileCacheStats(); }
     /**
      * @brief close the database, compacting to the maximum number of segments configured when the
      database was opened.
@@ -149,14 +255,37 @@ public:
      * @param mergeCount if 0, then the database is closed without any compaction 
      */
     void closeWithMerge(int mergeCount);
+    ~Database();
 private:
     static void checkValidDatabase(const std::string& path);
+    /**
+     * @brief check that the database stores write times with its values if and only if the options
+     * have a TTL, and record the TTL in the database directory
+     *
+     * @throws DatabaseOpenFailed if the database was written with a TTL and the options have none,
+     * or the reverse
+     */
+    static void checkTtl(const std::string& path,const Options& options);
+    /**
+     * @brief complete the renames of an ingest that was interrupted after its files were
+     * validated, and remove the files staged by ingests that were not
+     */
+    static void finishIngest(const std::string& path);
     static DatabaseRef create(const std::string& path, const Options& options);
     static DatabaseRef openImpl(const std::string& path, const Options& options);
     Database(const std::string& path,const LockFile& lockFile,const Options& options);
     uint64_t nextSegmentID() { return ++nextSegID; }
     void maybeSwapMemory();
+    /**
+     * @brief make the memory segment immutable, and start a new one
+     */
+    void swapMemory();
     void maybeMerge();
+    /**
+     * @brief replace the manifest with the current disk segments, unless the database is leveled.
+     * Each update writes the state at the time it runs, so concurrent updates leave the latest.
+     */
+    void saveManifest();
     std::shared_ptr<const DatabaseState> getState() {
         return std::atomic_load(&state);
     }
@@ -190,6 +319,7 @@ public:
      * @return a reference to the provided ByteBuffer. The value will be empty if the key is not found 
      */
     ByteBuffer& get(const Slice& key,ByteBuffer& value);
+    ByteBuffer& get(const Slice& key,ByteBuffer& value,const ReadOptions& options);
     /**
      * @brief get an Iterator for the Snapshot
      * 
@@ -198,6 +328,20 @@ public:
      * @return a shared reference to the iterator
      */
     LookupRef lookup(const Slice& lower, const Slice& upper);
+    LookupRef lookup(const Slice& lower, const Slice& upper, const ReadOptions& options);
+    /**
+     * @brief scan the range using multiple threads. The range is partitioned using the key index
+     of the largest disk segment, and each partition is scanned by its own iterator on the database
+     executor. Removed keys are not reported.
+     * 
+     * @param lower the lower range, or empty
+     * @param upper the upper range, or empty
+     * @param nThreads the maximum number of partitions to scan concurrently
+     * @param callback invoked for each key/value, concurrently from multiple threads. Within a
+     partition the keys are in order, but there is no ordering across partitions.
+     * @throws the first exception thrown by a callback, after all partitions have completed
+     */
+    void parallelScan(const Slice& lower, const Slice& upper, int nThreads, const std::function<void(const KeyValue&)>& callback);
 };
 
 #define checkKey(x) if(x.empty()) throw EmptyKey(); if(x.length>1024) throw KeyTooLong();
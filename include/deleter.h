@@ -1,41 +1,90 @@
 #pragma once
 
+#include <chrono>
 #include <vector>
+#include <deque>
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include "ratelimiter.h"
 
 namespace fs = std::filesystem;
 
+/**
+ * @brief the counters of a Deleter, since the database was opened
+ */
+struct DeleterStats {
+    // the files waiting to be deleted in the background, and their remaining bytes
+    uint64_t pendingFiles = 0;
+    uint64_t pendingBytes = 0;
+    uint64_t deletedFiles = 0;
+    uint64_t deletedBytes = 0;
+};
+
+/**
+ * @brief deletes the files of merged segments and unreferenced blob files. The files are logged
+ * when they are replaced, so that the deletion survives a crash, and deleted once they are no
+ * longer read: the files of a disk segment when it is no longer referenced by any snapshot, a blob
+ * file when no open segment references it, and other files when the database is opened again. Pending files are renamed to deleting.*, and deleted in
+ * the background at a limited rate, truncating large files in steps, so that unlinking a large
+ * file does not stall the database. A deletion that must wait for the rate limit schedules its
+ * next step after the wait, rather than blocking a background thread.
+ */
 class Deleter {
-private:    
+private:
     const std::string dbpath;
     std::ofstream file;
+    // merges of disjoint segment runs schedule deletions concurrently
+    std::mutex mtx;
+    // the renamed files waiting for deletion
+    std::deque<std::string> pending;
+    DeleterStats stats;
+    std::unique_ptr<RateLimiter> limiter;
+    // schedules deletePending() in the background after a delay, null unless started
+    std::function<void(std::chrono::microseconds)> wakeup;
+    bool scheduled = false;
+    std::atomic<bool> stopping{false};
+
+    void queue(const std::string& name);
+    bool deleteStep(const std::string& name,std::chrono::microseconds& wait);
 public:
     Deleter(const std::string& dbpath) : dbpath(dbpath){};
     Deleter() : dbpath(""){};
-    void scheduleDeletion(std::vector<std::string>& files) {
-        if(dbpath=="") return;
-        if(!file.is_open()) {
-            file.open(dbpath+"/deleted",std::ios::out | std::ios::app);
-        }
-        for(auto f : files) {
-            file << f << "\n";
-        }
-        file.flush();
-    }
-    void deleteScheduled() {
-        if(file.is_open()) file.close();
-        std::fstream in;
-        in.open(dbpath+"/deleted",std::ios::in);
-        std::string entry;
-        while(std::getline(in,entry)) {
-            auto filepath = dbpath+"/"+entry;
-            if(fs::exists(filepath)) {
-                fs::remove(filepath);
-            }
-        }
-        in.close();
-        fs::remove(dbpath+"/deleted");
-    }
+    /**
+     * @brief log files that are deleted by deleteScheduled(), unless remove() deletes them first
+     */
+    void scheduleDeletion(std::vector<std::string>& files);
+    /**
+     * @brief queue the logged files, and those left pending when the database was last closed, for
+     * deletion in the background
+     */
+    void deleteScheduled();
+    /**
+     * @brief queue the files of a segment that is no longer referenced for deletion
+     */
+    void remove(const std::vector<std::string>& files);
+    /**
+     * @brief start deleting the queued files in the background
+     *
+     * @param wakeup schedules a call of deletePending() after the delay
+     * @param bytesPerSecond the rate at which files are deleted, unlimited if 0
+     */
+    void start(std::function<void(std::chrono::microseconds)> wakeup,int64_t bytesPerSecond);
+    /**
+     * @brief stop deleting in the background. The files that are still pending are deleted after
+     * the database is opened again.
+     */
+    void stop();
+    /**
+     * @brief delete the queued files until none are left, stop() is called, or the rate limit
+     * requires a wait, in which case the next call is scheduled by the wakeup
+     */
+    void deletePending();
+    DeleterStats getStats();
 };
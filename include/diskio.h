@@ -6,6 +6,9 @@
 
 #include "database.h"
 #include "disksegment.h"
+#include "blobstore.h"
+
+class DiskSegment;
 
 uint16_t readLEuint16(const unsigned char *buffer);
 uint32_t readLEuint32(const unsigned char *buffer);
@@ -16,7 +19,47 @@ uint64_t readLEuint64(std::istream& file);
 void writeLEuint16(ostream& fs,uint16_t value);
 void writeLEuint32(ostream& fs,uint32_t value);
 void writeLEuint64(ostream& fs,uint64_t value);
+void writeLEuint16(unsigned char *buffer,uint16_t value);
+void writeLEuint32(unsigned char *buffer,uint32_t value);
+void writeLEuint64(unsigned char *buffer,uint64_t value);
+int readVarint(const unsigned char *buffer,int length,uint64_t *value);
+int writeVarint(unsigned char *buffer,uint64_t value);
+int varintLength(uint64_t value);
+void appendVarint(ByteBuffer& buffer,uint64_t value);
 
-void writeSegmentToDisk(Database *db,Segment *seg);
-SegmentRef writeAndLoadSegment(std::string keyFilename,std::string dataFilename,LookupIterator *itr,bool purgeDeleted);
-KeyIndex writeSegmentFiles(std::string keyFilename,std::string dataFilename,LookupIterator *itr,bool purgeDeleted);
+/**
+ * @brief write a memory segment to a segment file, and remove its log file
+ *
+ * @return the written segment, or null if the memory segment was empty
+ */
+SegmentRef writeSegmentToDisk(Database *db,Segment *seg);
+/**
+ * @brief write a segment for the ID range into the database directory, using the segment format
+ * specified by the options
+ */
+SegmentRef writeAndLoadSegment(const std::string& dbpath,ID lowerId,ID upperId,LookupIterator *itr,bool purgeDeleted,const Options& options,BlobWriter *blobs = nullptr);
+SegmentRef writeAndLoadSegment(std::string keyFilename,std::string dataFilename,LookupIterator *itr,bool purgeDeleted,const Options& options = Options());
+SegmentRef writeAndLoadSegment(std::string filename,LookupIterator *itr,bool purgeDeleted,BlobWriter *blobs = nullptr,const Options& options = Options());
+KeyIndex writeSegmentFiles(std::string keyFilename,std::string dataFilename,LookupIterator *itr,bool purgeDeleted,const Options& options = Options());
+/**
+ * @brief write a v2 segment file
+ * 
+ * @param blobs if not null, separates large values into a blob file. It must be provided if the
+ * iterator is from a raw lookup.
+ * @param options the compression and inline value threshold of the segment
+ */
+KeyIndex writeSegmentFile(std::string filename,LookupIterator *itr,bool purgeDeleted,BlobWriter *blobs = nullptr,const Options& options = Options());
+/**
+ * @brief the disk segments of the segments and their partitions in key order, if their key ranges
+ * do not overlap and their key blocks can be copied unchanged into a segment written with the
+ * options. Otherwise, or if the entries must be filtered or deletions purged, empty.
+ */
+std::vector<DiskSegment*> copyableSegments(const std::vector<SegmentRef>& segments,bool purgeDeleted,const Options& options);
+/**
+ * @brief write a v2 segment file by copying the data and key blocks of segments that do not
+ * overlap, see copyableSegments(). Only the data offsets of the key blocks are changed.
+ *
+ * @throws DatabaseCorrupted if a key block checksum does not match
+ */
+KeyIndex copySegmentFile(std::string filename,const std::vector<DiskSegment*>& segments,const Options& options);
+SegmentRef copyAndLoadSegment(const std::string& dbpath,ID lowerId,ID upperId,const std::vector<DiskSegment*>& segments,const Options& options,BlobStoreRef blobs = nullptr);
@@ -2,11 +2,14 @@
 
 #include <vector>
 #include <memory.h>
+#include <atomic>
 
 #include "exceptions.h"
 #include "segment.h"
 #include "bytebuffer.h"
 #include "memorymapped.h"
+#include "blobstore.h"
+#include "compression.h"
 
 struct IDS {
     uint64_t lower;
@@ -18,34 +21,187 @@ IDS getSegmentIDs(const std::string& filename);
 
 typedef std::vector<const ByteBuffer> KeyIndex;
 
+/**
+ * @brief the metadata stored at the end of a v2 segment file. It is encoded as tagged fields so
+ * that fields can be added without changing the format version.
+ */
+struct SegmentMetadata {
+    uint64_t keyOffset = 0;
+    uint64_t keyBlocks = 0;
+    uint32_t blockSize = keyBlockSize;
+    uint32_t indexInterval = keyIndexInterval;
+    uint64_t indexOffset = 0;
+    uint64_t indexLength = 0;
+    uint64_t keyCount = 0;
+    // the number of keyCount entries that are deletions, if countsDeletes
+    uint64_t deleteCount = 0;
+    bool countsDeletes = false;
+    uint64_t dataLength = 0;
+    // true if the value lengths include the value kind
+    bool taggedValues = false;
+    std::vector<BlobUsage> blobUsage;
+    // the codec used for the data blocks, see Compression
+    int compression = compressionNone;
+    // true if the key blocks end with the key block and data checksums
+    bool checksums = false;
+    // the Options::ttlSeconds the segment was written with. If not 0, each value ends with its
+    // write time.
+    uint32_t ttlSeconds = 0;
+
+    ByteBuffer encode() const;
+    static SegmentMetadata decode(const Slice& buffer);
+};
+
+/**
+ * @brief decodes the entries of a key block in either segment format. The decoded key is only
+ * valid until the next call to next().
+ */
+class KeyBlockDecoder {
+private:
+    const uint8_t *block = nullptr;
+    int blockLength = 0;
+    int format = segmentFormatV1;
+    bool taggedValues = false;
+    int index = 0;
+    int remaining = 0;
+    uint64_t nextOffset = 0;
+    int keyLength = 0;
+    uint8_t keyBuffer[maxKeyLength];
+public:
+    uint64_t dataOffset = 0;
+    uint32_t dataLength = 0;
+    int valueKind = valueKindData;
+    // the data offset from the block header, for compressed segments the offset of the data block
+    uint64_t blockDataOffset = 0;
+    // the value if the value kind is valueKindInline, valid until the next call to next()
+    Slice inlineValue;
+
+    KeyBlockDecoder(int format,bool taggedValues=false) : format(format), taggedValues(taggedValues) {}
+    /**
+     * @brief start decoding a block. The block may be truncated, as long as it contains every
+     * entry that is decoded.
+     */
+    void reset(const uint8_t *block,int length);
+    /**
+     * @brief decode the next entry
+     * @return false if there are no more entries in the block
+     */
+    bool next();
+    Slice key() const { return Slice(keyBuffer,keyLength); }
+};
+
 #include "diskio.h"
 
 class DiskSegment final : public Segment {
+friend std::vector<DiskSegment*> copyableSegments(const std::vector<SegmentRef>& segments,bool purgeDeleted,const Options& options);
+friend KeyIndex copySegmentFile(std::string filename,const std::vector<DiskSegment*>& segments,const Options& options);
 private:
+    // the key file, or for v2 segments the single segment file
     MemoryMappedFile keyFile;
-    MemoryMappedFile dataFile;
-    const int64_t keyBlocks;
+    // only used by v1 segments, which store the values in a separate file
+    std::unique_ptr<MemoryMappedFile> separateDataFile;
+    MemoryMappedFile& dataFile;
+    const int format;
+    bool taggedValues = false;
+    int compression = compressionNone;
+    bool checksums = false;
+    // see SegmentMetadata::ttlSeconds
+    uint32_t ttlSeconds = 0;
+    uint64_t dataLength = 0;
+    uint64_t keyCount = 0;
+    uint64_t deleteCount = 0;
+    bool countsDeletes = false;
+    int64_t keyBlocks;
+    uint64_t keyOffset = 0;
+    // the location of the serialized key index in a v2 segment
+    uint64_t indexOffset = 0;
+    uint64_t indexLength = 0;
+    int blockSize = keyBlockSize;
+    int indexInterval = keyIndexInterval;
     ID _lowerID;
     ID _upperID;
     KeyIndex keyIndex;
+    const BlobStoreRef blobs;
+    std::vector<BlobUsage> blobUsage;
+    // the key blocks whose checksums have been verified
+    std::unique_ptr<std::atomic<bool>[]> verified;
+    std::atomic<int64_t> verifiedBlocks{0};
 
-    DiskSegment(const std::string& keyFilename,const std::string& dataFilename, const KeyIndex& keyIndex)
-        :   keyFile(keyFilename), dataFile(dataFilename), 
-            keyBlocks((keyFile.length()-1)/keyBlockSize + 1),
+    DiskSegment(const std::string& keyFilename,const std::string& dataFilename, const KeyIndex& keyIndex,FileCacheRef cache)
+        :   keyFile(keyFilename,cache), separateDataFile(new MemoryMappedFile(dataFilename,cache)), dataFile(*separateDataFile),
+            format(segmentFormatV1), keyBlocks(keyFile.length()==0 ? 0 : (keyFile.length()-1)/keyBlockSize + 1),
             keyIndex(keyIndex)
     {
             auto ids = getSegmentIDs(keyFilename);
             _lowerID = ids.lower;
             _upperID = ids.upper;
             if(keyIndex.size()==0) {
-                loadKeyIndex(this->keyIndex,keyFile,keyBlocks);
+                loadKeyIndex();
             }
     }
-    static void loadKeyIndex(KeyIndex &index,MemoryMappedFile &keyFile,int64_t keyBlocks);
+    /**
+     * @param cached the metadata of the segment if known, otherwise it is read from the file
+     */
+    DiskSegment(const std::string& filename, const SegmentMetadata* cached, const KeyIndex& keyIndex, BlobStoreRef blobs, FileCacheRef cache)
+        :   keyFile(filename,cache), dataFile(keyFile), format(segmentFormatV2), keyIndex(keyIndex), blobs(blobs)
+    {
+            auto ids = getSegmentIDs(fs::path(filename).filename());
+            _lowerID = ids.lower;
+            _upperID = ids.upper;
+            auto metadata = cached ? *cached : readMetadata();
+            keyBlocks = metadata.keyBlocks;
+            keyOffset = metadata.keyOffset;
+            blockSize = metadata.blockSize;
+            indexInterval = metadata.indexInterval;
+            taggedValues = metadata.taggedValues;
+            blobUsage = metadata.blobUsage;
+            compression = metadata.compression;
+            if(!compressionAvailable(compression)) throw IllegalState("unsupported segment compression");
+            checksums = metadata.checksums;
+            ttlSeconds = metadata.ttlSeconds;
+            dataLength = metadata.dataLength;
+            indexOffset = metadata.indexOffset;
+            indexLength = metadata.indexLength;
+            keyCount = metadata.keyCount;
+            deleteCount = metadata.deleteCount;
+            countsDeletes = metadata.countsDeletes;
+            verified.reset(new std::atomic<bool>[keyBlocks]());
+            if(!blobUsage.empty() && !blobs) throw IllegalState("segment references blob files");
+            if(blockSize < minKeyBlockSize || blockSize > maxKeyBlockSize || indexInterval < 1) throw IllegalState("invalid key block size");
+            if(keyIndex.size()==0) {
+                readKeyIndex(metadata);
+            }
+            if(blobs && !blobUsage.empty()) blobs->acquire(blobUsage);
+    }
+    SegmentMetadata readMetadata();
+    void loadKeyIndex();
+    void readKeyIndex(const SegmentMetadata& metadata);
+    uint64_t blockOffset(int64_t block) { return keyOffset + block*blockSize; }
+    /**
+     * @brief the mapped bytes of a key block
+     */
+    Slice keyBlock(int64_t block) { return keyFile.slice(blockOffset(block),blockSize); }
+    /**
+     * @brief keeps the files of a segment mapped while it is read
+     */
+    struct Pin {
+        MemoryMappedFile::Pin keys;
+        MemoryMappedFile::Pin data;
+    };
+    /**
+     * @brief map the files of the segment if needed. Every access of the contents of a segment
+     * whose files are cached must hold a pin.
+     */
+    Pin pin() {
+        return Pin{keyFile.pin(), separateDataFile ? separateDataFile->pin() : MemoryMappedFile::Pin()};
+    }
+    void readDataBlock(uint64_t offset,ByteBuffer& block);
 
-    void binarySearch(const Slice& key,int64_t *offset,uint32_t *length);
-    int64_t binarySearch0(int64_t lowBlock,int64_t highBlock,const ByteBuffer& key,unsigned char *buffer);
-    void scanBlock(int64_t block,const Slice& key, int64_t *offset,uint32_t *len);
+    int64_t findBlock(const Slice& key);
+    int64_t binarySearch0(int64_t lowBlock,int64_t highBlock,const Slice& key);
+    void scanBlock(int64_t block,const Slice& key, int64_t *offset,uint32_t *len,int *kind,uint64_t *dataBlock,ByteBuffer& value);
+    LookupRef lookup(const Slice& lower, const Slice& upper, bool resolveBlobs, bool verify);
+    void checkBlock(int64_t block) { if(!verifyBlock(block)) throw DatabaseCorrupted(); }
 
     class Iterator final : public LookupIterator {
     private:
@@ -57,16 +213,25 @@ private:
         uint64_t block;
         const ByteBuffer lower;
         const ByteBuffer upper;
-        ByteBuffer buffer;
-        ByteBuffer tmpKey,prevKey;
-        int bufferOffset = 0;
+        Slice buffer;
+        KeyBlockDecoder decoder;
+        const bool resolveBlobs;
+        const bool verify;
+        // keeps the key block of the buffer mapped
+        const Pin pinned;
+        int currentKind = valueKindData;
+        // the decompressed data block of the current key block, for compressed segments
+        ByteBuffer dataBlock;
+        uint64_t dataBlockOffset = UINT64_MAX;
 
         void nextKeyValue();
 
     public:
-        Iterator(SegmentRef ds,const Slice& lower,const Slice& upper,const ByteBuffer& buffer, uint64_t block) :
-            currentKey(64), ds(ds), block(block), lower(lower), upper(upper), buffer(buffer), tmpKey(64), prevKey(64) {
+        Iterator(SegmentRef ds,const Slice& lower,const Slice& upper,const Slice& buffer, uint64_t block,int format,bool taggedValues,bool resolveBlobs,bool verify,Pin&& pinned) :
+            currentKey(64), ds(ds), block(block), lower(lower), upper(upper), buffer(buffer), decoder(format,taggedValues), resolveBlobs(resolveBlobs), verify(verify), pinned(std::move(pinned)) {
+            decoder.reset(this->buffer,this->buffer.length);
         }
+        bool isBlobRef() override { return currentKind==valueKindBlob; }
         KeyValue& next(KeyValue& kv) override {
             if(valid) {
                 valid=false;
@@ -87,14 +252,59 @@ private:
         }
     };
 public:
-    static SegmentRef newDiskSegment(const std::string& keyFilename,const std::string& dataFilename,const KeyIndex& keyIndex) {
-        auto ref = SegmentRef(new DiskSegment(keyFilename,dataFilename,keyIndex));
+    ~DiskSegment() {
+        if(blobs && !blobUsage.empty()) blobs->release(blobUsage);
+        // no snapshot or iterator references the segment any more, so its files can be deleted
+        if(!shouldRemove) return;
+        if(auto d = deleter.lock()) d->remove(files());
+    }
+    /**
+     * @param cache if not null, the files are mapped on first access and bounded by the cache
+     */
+    static SegmentRef newDiskSegment(const std::string& keyFilename,const std::string& dataFilename,const KeyIndex& keyIndex,FileCacheRef cache = nullptr) {
+        auto ref = SegmentRef(new DiskSegment(keyFilename,dataFilename,keyIndex,cache));
+        ref->weakRef = ref;
+        return ref;
+    }
+    /**
+     * @brief open a v2 segment, which stores the keys, values and key index in a single file
+     * 
+     * @param blobs the blob files of the database, required if the segment references blob files
+     */
+    static SegmentRef newDiskSegment(const std::string& filename,const KeyIndex& keyIndex,BlobStoreRef blobs = nullptr,FileCacheRef cache = nullptr) {
+        auto ref = SegmentRef(new DiskSegment(filename,nullptr,keyIndex,blobs,cache));
+        ref->weakRef = ref;
+        return ref;
+    }
+    /**
+     * @brief open a v2 segment using its metadata and key index cached in the manifest, so that
+     * only the file is mapped
+     */
+    static SegmentRef newDiskSegment(const std::string& filename,const SegmentMetadata& metadata,const KeyIndex& keyIndex,BlobStoreRef blobs = nullptr,FileCacheRef cache = nullptr) {
+        auto ref = SegmentRef(new DiskSegment(filename,&metadata,keyIndex,blobs,cache));
         ref->weakRef = ref;
         return ref;
     }
     ID lowerID() override { return _lowerID; }
     ID upperID() override { return _upperID; }
-    uint64_t size() override { return keyFile.length() + dataFile.length(); }
+    uint64_t size() override { return keyFile.length() + (separateDataFile ? separateDataFile->length() : 0); }
+    /**
+     * @brief the first key of every indexInterval block, in key order
+     */
+    const KeyIndex& getKeyIndex() { return keyIndex; }
+    int getFormat() { return format; }
+    /**
+     * @brief the metadata of a v2 segment, as stored at the end of its file
+     */
+    SegmentMetadata getMetadata();
+    /**
+     * @brief the last key of the segment, or empty if the segment is empty
+     */
+    ByteBuffer lastKey();
+    /**
+     * @brief the bytes referenced in each blob file by this segment
+     */
+    const std::vector<BlobUsage>& getBlobUsage() { return blobUsage; }
     ByteBuffer put(const Slice& key,const Slice &value) override {
         throw IllegalState("disk segments are immutable, put is not allowed");
     }
@@ -103,32 +313,55 @@ public:
     }
     void close() override {
         keyFile.close();
-        dataFile.close();
+        if(separateDataFile) separateDataFile->close();
     }
     void removeSegment() override {
         close();
         keyFile.remove();
-        dataFile.remove();
+        if(separateDataFile) separateDataFile->remove();
     }
     std::vector<std::string> files() override {
-        return { keyFile.name(), dataFile.name() };
+        if(separateDataFile) return { keyFile.name(), separateDataFile->name() };
+        return { keyFile.name() };
     }
     LookupRef lookup(const Slice& lower, const Slice& upper) override {
-        if(keyFile.length()==0) return LookupRef(new EmptyIterator());
-        ByteBuffer buffer(keyBlockSize);
-        int64_t block = 0;
-        if(!lower.empty()) {
-            auto itr = std::upper_bound(keyIndex.begin(),keyIndex.end(),lower,ByteBuffer::less);
-            if(itr!=keyIndex.begin()) itr--;
-            int index = itr - keyIndex.begin();
-            block = index * keyIndexInterval;
-        }
-        int n = keyFile.readAt(buffer,block*keyBlockSize,keyBlockSize);
-        if(n != keyBlockSize) {
-            throw IllegalState("did not read block size");
-        }
-        return LookupRef(new Iterator(SegmentRef(weakRef),lower,upper,buffer,block));
+        return lookup(lower,upper,true,false);
+    }
+    LookupRef lookup(const Slice& lower, const Slice& upper,const ReadOptions& options) override {
+        return lookup(lower,upper,true,options.verifyChecksums);
+    }
+    LookupRef lookupRaw(const Slice& lower, const Slice& upper) override {
+        return lookup(lower,upper,false,false);
+    }
+    ByteBuffer& get(const Slice& key,ByteBuffer &value) override {
+        return get(key,value,ReadOptions());
+    }
+    ByteBuffer& get(const Slice& key,ByteBuffer &value,const ReadOptions& options) override;
+    /**
+     * @brief true if the segment stores key block and data checksums
+     */
+    bool hasChecksums() { return checksums; }
+    int64_t blockCount() { return keyBlocks; }
+    /**
+     * @brief true if the checksums of every key block have been verified
+     */
+    bool isVerified() { return verifiedBlocks==keyBlocks; }
+    /**
+     * @brief orders the segments by their last read, to the resolution of the file cache, see
+     * MemoryMappedFile::lastAccess()
+     */
+    uint64_t lastAccess() { return keyFile.lastAccess(); }
+    /**
+     * @brief verify the checksums of a key block and its data, unless they have been verified
+     * 
+     * @param bytes set to the number of bytes checked
+     * @return false if a checksum does not match
+     */
+    bool verifyBlock(int64_t block,uint64_t *bytes = nullptr);
+    RangeEstimate estimateRange(const Slice& lower, const Slice& upper) override;
+    void entryCounts(uint64_t *entries,uint64_t *deletes) override {
+        *entries = keyCount;
+        *deletes = deleteCount;
     }
-    ByteBuffer& get(const Slice& key,ByteBuffer &value) override;
-    static std::vector<SegmentRef> loadDiskSegments(std::string directory,Options options);
+    static std::vector<SegmentRef> loadDiskSegments(std::string directory,Options options,BlobStoreRef blobs = nullptr);
 };
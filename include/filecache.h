@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+
+class MemoryMappedFile;
+
+/**
+ * @brief the counters of a FileCache, since it was created
+ */
+struct FileCacheStats {
+    // the accesses of files that were already mapped
+    uint64_t hits = 0;
+    // the accesses that mapped a file
+    uint64_t opens = 0;
+    // the files unmapped to stay within the limit
+    uint64_t evictions = 0;
+    // the files that are mapped
+    uint64_t openFiles = 0;
+};
+
+/**
+ * @brief bounds the number of segment files that are mapped at the same time. The files are
+ * mapped on first access. When more than maxOpenFiles are mapped, the least recently used files
+ * that are not being read are unmapped, and mapped again on their next access. So that an access
+ * does not take a lock, recency is only tracked to the resolution of file opens: the files are
+ * kept in a list in the order they were mapped, and a file accessed since it was queued is moved
+ * to the back instead of being unmapped. A cache may be shared by several databases.
+ */
+class FileCache {
+friend class MemoryMappedFile;
+private:
+    const int maxOpenFiles;
+    std::mutex mtx;
+    // the mapped files, least recently queued first
+    std::list<MemoryMappedFile*> files;
+    // the number of mapped files, read without the lock
+    std::atomic<int> openFiles{0};
+    // advanced by every open, the recency of an access
+    std::atomic<uint64_t> clock{0};
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> opens{0};
+    std::atomic<uint64_t> evictions{0};
+
+    /**
+     * @brief add a file that was mapped, and unmap files until the limit is met
+     */
+    void opened(MemoryMappedFile* file);
+    /**
+     * @brief unmap files that are no longer pinned while the limit is exceeded
+     */
+    void released() {
+        if(openFiles.load(std::memory_order_relaxed) > maxOpenFiles) trim(nullptr);
+    }
+    /**
+     * @brief unmap the least recently used files that are not pinned, other than the given file,
+     * until the limit is met. Only the files up to the last one unmapped are visited.
+     */
+    void trim(MemoryMappedFile* file);
+    /**
+     * @brief remove a file that is destroyed
+     */
+    void forget(MemoryMappedFile* file);
+public:
+    FileCache(int maxOpenFiles) : maxOpenFiles(maxOpenFiles) {}
+    FileCacheStats getStats();
+};
+
+typedef std::shared_ptr<FileCache> FileCacheRef;
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "slice.h"
+#include "ratelimiter.h"
+
+/**
+ * @brief sequential file writer used to write segments. Data is copied into one of two aligned
+ * buffers, and full buffers are written by a writer thread while the other buffer is filled. The
+ * file space is preallocated ahead of the writes where the platform supports it.
+ */
+class FileWriter {
+private:
+    static const int alignment = 4096;
+    struct Buffer {
+        uint8_t *data = nullptr;
+        int length = 0;
+    };
+    int fd = -1;
+    const bool directIO;
+    const int bufferSize;
+    RateLimiter * const limiter;
+    Buffer buffers[2];
+    int current = 0;
+    uint64_t flushed = 0;
+    uint64_t allocated = 0;
+
+    std::thread writer;
+    std::mutex mtx;
+    std::condition_variable cv;
+    Buffer *pending = nullptr;
+    uint64_t pendingOffset = 0;
+    bool closing = false;
+    std::exception_ptr error;
+
+    void flushBuffer();
+    void writeLoop();
+    void writeFully(const uint8_t *data,int length);
+    void finish();
+public:
+    static const int defaultBufferSize = 1024*1024;
+    /**
+     * @brief create or truncate the file
+     * 
+     * @param directIO if true, the file is written with O_DIRECT where supported, bypassing the page cache
+     * @param limiter if not null, limits the rate at which the buffers are written
+     */
+    FileWriter(const std::string& path,bool directIO = false,int bufferSize = defaultBufferSize,RateLimiter *limiter = nullptr);
+    ~FileWriter();
+    FileWriter(const FileWriter&) = delete;
+    void write(const Slice& data);
+    void write(const uint8_t *data,int length) { write(Slice(data,length)); }
+    void writeZeros(uint64_t length);
+    /**
+     * @brief copy the contents of a file
+     */
+    void writeFile(const std::string& path);
+    /**
+     * @brief the number of bytes written
+     */
+    uint64_t position() const { return flushed + buffers[current].length; }
+    /**
+     * @brief write any buffered data and close the file
+     */
+    void close();
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "segment.h"
+#include "options.h"
+#include "blobstore.h"
+
+/**
+ * @brief the disk segments of levels 1..n of a leveled database, levels[0] being level 1. The
+ * segments of a level have disjoint key ranges and are in key order.
+ */
+typedef std::vector<std::vector<SegmentRef>> Levels;
+
+/**
+ * @brief the segments of a leveled database in read order: one segment per non-empty level,
+ * deepest first, followed by the level 0 segments oldest first. A level with several segments is
+ * combined into a PartitionedSegment, so that a get probes a single segment of the level.
+ */
+std::vector<SegmentRef> levelSegments(const Levels& levels,const std::vector<SegmentRef>& level0);
+/**
+ * @brief the number of segments for levels 1..n at the start of the database segments
+ */
+int levelSegmentCount(const Levels& levels);
+
+/**
+ * @brief the manifest of a leveled database, the file "levels" in the database directory, which
+ * lists the segment files of every level. It is replaced atomically when the levels change, so
+ * segment files that are not listed were written by a compaction that did not complete.
+ */
+class LevelManifest {
+public:
+    static std::string filename(const std::string& dbpath) { return dbpath+"/levels"; }
+    static bool exists(const std::string& dbpath);
+    /**
+     * @brief load the segments listed in the manifest, and remove the segment files that are not
+     * 
+     * @param level0 set to the level 0 segments, oldest first
+     */
+    static Levels load(const std::string& dbpath,const Options& options,BlobStoreRef blobs,std::vector<SegmentRef>& level0);
+    /**
+     * @brief replace the manifest
+     * 
+     * @param level0Files the level 0 segment files, oldest first
+     */
+    static void save(const std::string& dbpath,const Levels& levels,const std::vector<std::string>& level0Files);
+};
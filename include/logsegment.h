@@ -22,14 +22,24 @@ private:
     LogSegment(std::string path,Options options) : list(keyValueCompare(options)), path(path), options(options) {
     }
 public:
+    using Segment::get;
+    using Segment::lookup;
     static SegmentRef newLogSegment(const std::string& path,const Options& options) {
         auto ls = new LogSegment(path,options);
         readLogFile(ls->list,path,options);
+        ls->filesize = fs::file_size(path);
         auto ref =SegmentRef(ls);
         ref->weakRef = ref;
         return ref;
     }
     uint64_t size() override { return filesize; }
+    RangeEstimate estimateRange(const Slice& lower, const Slice& upper) override {
+        auto total = list.approximateCount(nullptr,nullptr);
+        if(total==0) return RangeEstimate();
+        KeyValue lowerKey = Key(lower), upperKey = Key(upper);
+        auto count = list.approximateCount(lower.empty() ? nullptr : &lowerKey,upper.empty() ? nullptr : &upperKey);
+        return RangeEstimate{.bytes = filesize * count / total, .count = count};
+    }
     ID lowerID() override { return id; }
     ID upperID() override { return id; }
     ByteBuffer& get(const Slice& key,ByteBuffer& value) override {
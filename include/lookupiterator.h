@@ -12,6 +12,11 @@ class LookupIterator {
         }
         virtual ~LookupIterator(){};
         virtual KeyValue& next(KeyValue& kv) = 0;
+        /**
+         * @brief true if the value returned by the last call to next() is an encoded BlobRef,
+         * which only occurs for iterators returned by Segment::lookupRaw()
+         */
+        virtual bool isBlobRef() { return false; }
 };
 
 struct EmptyIterator : public LookupIterator {
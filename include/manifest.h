@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "segment.h"
+#include "disksegment.h"
+
+/**
+ * @brief the cached metadata and key index of a segment file
+ */
+struct ManifestEntry {
+    int format = segmentFormatV2;
+    // the size of the segment files when the entry was written, the entry is ignored if it differs
+    uint64_t size = 0;
+    // only used by v2 segments
+    SegmentMetadata metadata;
+    KeyIndex keyIndex;
+};
+
+/**
+ * @brief the entries of a manifest, by segment file name. For v1 segments the name is that of the
+ * key file.
+ */
+typedef std::map<std::string,ManifestEntry> ManifestEntries;
+
+/**
+ * @brief the manifest of a database that is not leveled, the file "manifest" in the database
+ * directory. It lists the live disk segments with their metadata and key index, so that opening
+ * the database maps the segment files without reading them. It is replaced atomically after every
+ * merge and when the database is closed. The segment files remain the source of truth: a file that
+ * is not listed, or whose size changed, is read as if there were no manifest.
+ */
+class Manifest {
+public:
+    static std::string filename(const std::string& dbpath) { return dbpath+"/manifest"; }
+    /**
+     * @brief read the manifest
+     *
+     * @return the entries, or none if the manifest does not exist or is damaged
+     */
+    static ManifestEntries load(const std::string& dbpath);
+    /**
+     * @brief replace the manifest with the disk segments and partitions of the segments. Other
+     * segments are ignored.
+     */
+    static void save(const std::string& dbpath,const std::vector<SegmentRef>& segments);
+};
@@ -1,32 +1,121 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <filesystem>
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 
+#include "slice.h"
+#include "filecache.h"
+
 namespace fs = std::filesystem;
 namespace bip = boost::interprocess;
 
 /**
- * @brief memory mapped file using Boost
+ * @brief memory mapped file using Boost. The file descriptor is closed once the file is mapped.
+ * If the file has a FileCache, it is only mapped while pinned, see pin(), and may be unmapped by
+ * the cache otherwise.
  */
 class MemoryMappedFile {
+friend class FileCache;
 private:
     fs::path path;
     const uint64_t _length;
-    bip::file_mapping mapping;
+    const FileCacheRef cache;
     bip::mapped_region region;
+    uint8_t *address = nullptr;
+    // serializes mapping and unmapping the file
+    std::mutex mtx;
+    // -1 if the file is not mapped, otherwise the number of pins
+    std::atomic<int64_t> state{-1};
+    // the cache clock at the last access
+    std::atomic<uint64_t> lastUsed{0};
+    // the position in the list of mapped files of the cache, and the value of lastUsed when the file
+    // was queued there, guarded by the lock of the cache
+    std::list<MemoryMappedFile*>::iterator position;
+    uint64_t queuedAt = 0;
 
-public:
-    MemoryMappedFile(std::string path) 
-    :   path(path), 
-        _length(fs::file_size(path)),
-        mapping(path.c_str(), bip::read_only)
-    {
+    void map() {
         if(_length!=0) {
+            bip::file_mapping mapping(path.c_str(), bip::read_only);
             region = bip::mapped_region(mapping, bip::read_only);
+            address = (uint8_t*)region.get_address();
+        }
+    }
+    void acquire() {
+        int64_t s = state.load();
+        while(s>=0) {
+            if(state.compare_exchange_weak(s,s+1)) {
+                cache->hits.fetch_add(1,std::memory_order_relaxed);
+                auto now = cache->clock.load(std::memory_order_relaxed);
+                if(lastUsed.load(std::memory_order_relaxed)!=now) lastUsed.store(now,std::memory_order_relaxed);
+                return;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        // the file is only unmapped with the lock held, so once mapped it stays mapped
+        if(state.load()>=0) {
+            state++;
+            cache->hits.fetch_add(1,std::memory_order_relaxed);
+            return;
         }
+        map();
+        lastUsed = cache->clock.load();
+        state = 1;
+        cache->opened(this);
+    }
+    int64_t users() { return std::max(state.load(),(int64_t)0); }
+    /**
+     * @brief unmap the file unless it is pinned, called by the cache
+     */
+    bool tryUnmap() {
+        std::unique_lock<std::mutex> lock(mtx,std::try_to_lock);
+        if(!lock.owns_lock()) return false;
+        int64_t unpinned = 0;
+        if(!state.compare_exchange_strong(unpinned,-1)) return false;
+        region = bip::mapped_region();
+        address = nullptr;
+        return true;
+    }
+public:
+    /**
+     * @brief keeps a file mapped while its contents are read
+     */
+    class Pin {
+    private:
+        MemoryMappedFile* file = nullptr;
+    public:
+        Pin() {}
+        Pin(MemoryMappedFile* file) : file(file) {}
+        Pin(Pin&& other) : file(other.file) { other.file = nullptr; }
+        Pin(const Pin&) = delete;
+        Pin& operator=(Pin&& other) {
+            std::swap(file,other.file);
+            return *this;
+        }
+        ~Pin() {
+            if(file && file->state.fetch_sub(1)==1) file->cache->released();
+        }
+    };
 
+    /**
+     * @param cache if not null, the file is mapped on first access and bounded by the cache,
+     * otherwise it is mapped until it is destroyed
+     */
+    MemoryMappedFile(std::string path,FileCacheRef cache = nullptr)
+    :   path(path),
+        _length(fs::file_size(path)),
+        cache(cache)
+    {
+        if(!cache) {
+            map();
+            state = 0;
+        }
+    }
+    ~MemoryMappedFile() {
+        if(cache) cache->forget(this);
     }
     std::string name() {
         return path.filename();
@@ -39,8 +128,30 @@ public:
     uint64_t length() {
         return _length;
     }
+    /**
+     * @brief the cache clock when the file was last pinned, so that files can be ordered by their
+     * last access. Always 0 if the file has no cache.
+     */
+    uint64_t lastAccess() {
+        return lastUsed.load(std::memory_order_relaxed);
+    }
+    /**
+     * @brief map the file if needed, and keep it mapped until the pin is destroyed. The contents
+     * of a file with a cache may only be read while it is pinned.
+     */
+    Pin pin() {
+        if(!cache) return Pin();
+        acquire();
+        return Pin(this);
+    }
+    /**
+     * @brief a view of the mapped bytes, valid until the file is unmapped
+     */
+    Slice slice(uint64_t position,int length) {
+        return Slice(address+position,length);
+    }
     int readAt(unsigned char *buffer,uint64_t position,int length) {
-        memcpy(buffer,(uint8_t*)(region.get_address())+position,length);
+        memcpy(buffer,address+position,length);
         return MIN(length,_length-position);
     }
 };
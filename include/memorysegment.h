@@ -28,6 +28,7 @@ private:
     LogFile *log = nullptr;
     ID id;
     uint64_t bytes = 0;
+    uint64_t entries = 0;
     const std::string path;
     Options options;
 
@@ -35,6 +36,8 @@ private:
 
     MemorySegment(const std::string& path, const uint64_t id,const Options& options) : list(keyValueCompare(options)), id(id), path(path), options(options) {}
 public:
+    using Segment::get;
+    using Segment::lookup;
     ~MemorySegment() {
         if(shouldRemove) removeSegment();
     }
@@ -56,6 +59,7 @@ public:
         maybeCreateLogFile();
         auto prev = list.put(KeyValue(key,value));
         bytes += key.length + value.length - (prev.key.empty() ? 0 : (prev.key.length + prev.value.length));
+        if(prev.key.empty()) entries++;
         if(log) {
             log->write(key,value);
         }
@@ -71,6 +75,13 @@ public:
         return put(key, ByteBuffer::EMPTY());
     }
     void write(const WriteBatch& batch);
+    RangeEstimate estimateRange(const Slice& lower, const Slice& upper) override
+    {
+        if(entries==0) return RangeEstimate();
+        KeyValue lowerKey = Key(lower), upperKey = Key(upper);
+        auto count = std::min(list.approximateCount(lower.empty() ? nullptr : &lowerKey,upper.empty() ? nullptr : &upperKey),entries);
+        return RangeEstimate{.bytes = count * bytes / entries, .count = count};
+    }
 
     void close() override {}
     LookupRef lookup(const Slice& lower, const Slice& upper) override 
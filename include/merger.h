@@ -1,18 +1,146 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <functional>
+
 #include "segment.h"
+#include "options.h"
+#include "blobstore.h"
+#include "levels.h"
 
 class Database;
 class Deleter;
 
+/**
+ * @brief reports the progress of a compactRange(), as the bytes of the segments merged so far and
+ * the bytes of the segments that overlapped the range when it started
+ */
+typedef std::function<void(uint64_t bytes,uint64_t total)> CompactionProgress;
+/**
+ * @brief called with the bytes of the entries read by a merge since the last call, while it runs.
+ * Subcompactions call it from their own threads.
+ */
+typedef std::function<void(uint64_t bytes)> MergeProgress;
+
 class Merger {
+    // the delay before choosing the next merges once a background merge finishes
+    static constexpr std::chrono::milliseconds throttleDelay{100};
+
+    // held shared by the background merges of runs, and exclusively by the merges that choose
+    // their segments from the whole database
+    std::shared_mutex merger;
+    // guards merging and running
     std::mutex mtx;
-    std::condition_variable cv;
-    std::mutex merger;
+    // the segments of the runs scheduled for a background merge
+    std::set<Segment*> merging;
+    int running = 0;
+    // the wakeups since the scheduled merge started, if one is queued or running
+    std::atomic<int> pending{0};
+    // for each level, the last key of the segment most recently compacted into the next level
+    std::map<int,ByteBuffer> compactPointer;
 
 public:
-    void autoMerger(Database* db);
-    void wakeup();
-    void mergeSegments0(Database *db,int maxSegments,bool throttle);
-    SegmentRef mergeSegments1(Deleter &deleter, const std::string& dbpath, std::vector<SegmentRef>& segments,bool purgeDeleted);
+    /**
+     * @brief schedule a background merge of the database on its Options::scheduler. Each merge
+     * chooses the next ones when it finishes, until the segments are within the limits of the
+     * options.
+     *
+     * @param delay the time before the merges are chosen
+     */
+    void wakeup(Database* db,std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+    /**
+     * @brief merge until at most maxSegments segments remain, on the calling thread
+     */
+    void mergeSegments0(Database *db,int maxSegments);
+    /**
+     * @brief compact a leveled database on the calling thread, until level 0 has at most maxLevel0
+     * segments and every level is within its target size, see compactLevelStep()
+     */
+    void compactLevels(Database *db,int maxLevel0);
+    /**
+     * @brief merge the segments that overlap the key range, waiting for any background merge to
+     * finish, see Database::compactRange()
+     */
+    void compactRange(Database *db,const Slice& lower,const Slice& upper,const CompactionProgress& progress);
+    /**
+     * @brief merge segments into a single new segment. Merges of more than
+     * Options::minSubcompactionBytes are split by key range into subcompactions that are written
+     * in parallel, producing a PartitionedSegment.
+     * 
+     * @param blobs if not null, the new segment keeps the blob references of the segments
+     * @param relocate the blob files whose referenced values are copied into a new blob file
+     * @param progress if set, called as the entries are merged. Segments merged by copying their
+     * blocks are not reported.
+     */
+    SegmentRef mergeSegments1(Deleter &deleter, const std::string& dbpath, std::vector<SegmentRef>& segments,bool purgeDeleted,const Options& options = Options(),
+        BlobStoreRef blobs = nullptr,const std::set<BlobFileID>& relocate = {},const MergeProgress& progress = nullptr);
+private:
+    void schedule(Database *db,std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+    /**
+     * @brief schedule a job for each run chosen by the Options::compactionPolicy, up to
+     * Options::maxBackgroundMerges in total, that does not include a segment already being merged.
+     * Otherwise, a run chosen by blobRun() or tombstoneRun().
+     */
+    void startRuns(Database *db);
+    /**
+     * @brief schedule a job that merges and installs the run, unless its segments have been merged
+     * by then. The caller holds mtx.
+     *
+     * @param record true if the merge is counted by the compaction policy
+     */
+    void startRun(Database *db,const std::vector<SegmentRef>& segments,const SegmentRun& run,bool purgeDeleted,bool record,JobPriority priority);
+    /**
+     * @brief the run of segments that reference the blob file with the most garbage, if it
+     * exceeds Options::blobGarbageRatio, so that the blob file can be removed
+     */
+    bool blobRun(Database *db,const std::vector<SegmentRef>& segments,SegmentRun& run);
+    /**
+     * @brief the segment with the highest ratio of deletions, if it exceeds
+     * Options::tombstoneRatio, together with every older segment so that the deletions are removed
+     */
+    bool tombstoneRun(Database *db,const std::vector<SegmentRef>& segments,SegmentRun& run);
+    /**
+     * @brief write the merged segments as key range partitions in parallel, split at the keys
+     */
+    SegmentRef mergePartitions(const std::string& dbpath,ID lowerId,ID upperId,const SegmentRef& ms,const std::vector<ByteBuffer>& splits,bool purgeDeleted,
+        const Options& options,BlobStoreRef blobs,const MergeProgress& progress);
+    void mergeRun(Database *db,const std::vector<SegmentRef>& segments,int startAt,int count,bool purgeDeleted,const MergeProgress& progress = nullptr);
+    /**
+     * @brief write the merged segment of a run, without installing it
+     *
+     * @param purgeDeleted true if no older segment holds keys of the run, so its deletions can be
+     * removed
+     */
+    SegmentRef writeRun(Database *db,const std::vector<SegmentRef>& segments,int startAt,int count,bool purgeDeleted,const MergeProgress& progress = nullptr);
+    /**
+     * @brief replace the run with the merged segment in the database state. Runs merged
+     * concurrently may have been installed first, so the run is found by identity.
+     */
+    void installRun(Database *db,const std::vector<SegmentRef>& segments,int startAt,int count,const SegmentRef& newseg);
+    /**
+     * @brief merge segments of a level with the overlapping segments of the next level
+     * 
+     * @param level the level of the inputs, 0 for the level 0 segments
+     */
+    void compactLevel(Database *db,const std::vector<SegmentRef>& inputs,int level,const MergeProgress& progress = nullptr);
+    /**
+     * @brief compact a leveled database by one step. Level 0 is merged into level 1 if it has more
+     * than maxLevel0 segments, otherwise the level most over its target size merges one segment
+     * into the overlapping segments of the next level. The caller holds the merger lock.
+     *
+     * @return true if segments were compacted
+     */
+    bool compactLevelStep(Database *db,int maxLevel0);
+    /**
+     * @brief compact the segment of a leveled database with the highest ratio of deletions, if it
+     * exceeds Options::tombstoneRatio, into the next level
+     * 
+     * @return true if a segment was compacted
+     */
+    bool compactTombstones(Database *db,const std::vector<SegmentRef>& level0);
 };
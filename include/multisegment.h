@@ -28,6 +28,7 @@ public:
         ref->weakRef = ref;
         return ref;
     }
+    const std::vector<SegmentRef>& getSegments() { return segments; }
     ByteBuffer put(const Slice& key,const Slice& value) override
     {
         throw IllegalState("put() called on MultiSegment");
@@ -41,6 +42,15 @@ public:
         }
         return val;
     }
+    ByteBuffer& get(const Slice& key,ByteBuffer &val,const ReadOptions& options) override
+    {
+        for (auto s : boost::adaptors::reverse(segments))
+        {
+            s->get(key,val,options);
+            if (!val.empty()) return val;
+        }
+        return val;
+    }
     ByteBuffer remove(const Slice& key) override
     {
         throw IllegalState("remove() called on MultiSegment");
@@ -52,6 +62,13 @@ public:
         }
         return size;
     }
+    RangeEstimate estimateRange(const Slice& lower, const Slice& upper) override {
+        RangeEstimate estimate;
+        for(auto s : segments) {
+            estimate += s->estimateRange(lower,upper);
+        }
+        return estimate;
+    }
     ID lowerID() override {
         throw IllegalState("MultiSegment does not have a lower ID");
     }
@@ -66,7 +83,7 @@ public:
     {
         throw IllegalState("removeSegment() called on MultiSegment");
     }
-    void removeOnFinalize() override
+    void removeOnFinalize(const std::shared_ptr<Deleter>& deleter = nullptr) override
     {
         throw IllegalState("removeOnFinalize() called on MultiSegment");
     }
@@ -85,16 +102,42 @@ public:
         }
         return LookupRef(new Iterator(SegmentRef(weakRef),std::move(iterators)));
     }
+    LookupRef lookup(const Slice& lower, const Slice& upper,const ReadOptions& options) override
+    {
+        std::vector<LookupRef> iterators;
+        iterators.reserve(segments.size());
+
+        for (auto s : segments)
+        {
+            iterators.push_back(s->lookup(lower, upper, options));
+        }
+        return LookupRef(new Iterator(SegmentRef(weakRef),std::move(iterators)));
+    }
+    LookupRef lookupRaw(const Slice& lower, const Slice& upper) override
+    {
+        std::vector<LookupRef> iterators;
+        iterators.reserve(segments.size());
+
+        for (auto s : segments)
+        {
+            iterators.push_back(s->lookupRaw(lower, upper));
+        }
+        return LookupRef(new Iterator(SegmentRef(weakRef),std::move(iterators)));
+    }
 
     class Iterator : public LookupIterator {
     private:
         const SegmentRef ms;
         std::vector<LookupRef> iterators;
+        int lastIndex = -1;
     public:
         Iterator(SegmentRef ms, std::vector<LookupRef> iterators) :  ms(ms), iterators(std::move(iterators)) {}        
         Slice peekKey() override {
             throw IllegalState("peekKey called on MultiSegment::Iterator");
         }
+        bool isBlobRef() override {
+            return lastIndex!=-1 && iterators[lastIndex]->isBlobRef();
+        }
         KeyValue& next(KeyValue &kv) override {
             int currentIndex = -1;
 
@@ -113,6 +156,7 @@ public:
         		}
             }
 
+            lastIndex = currentIndex;
             if (currentIndex == -1) {
                 kv = KeyValue::EMPTY();
                 return kv;
@@ -1,7 +1,32 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <functional>
 #include "bytebuffer.h"
+#include "constants.h"
+#include "compression.h"
+#include "ratelimiter.h"
+#include "compactionpolicy.h"
+#include "scheduler.h"
+#include "filecache.h"
+
+/**
+ * @brief the result of a CompactionFilter for an entry
+ */
+enum class FilterDecision {
+    keep,
+    // the entry is written as a deletion, which is removed by merges that remove deletions
+    remove,
+    // the value is replaced by the new value
+    change
+};
+
+/**
+ * @brief decides whether an entry written by a flush or merge is kept, removed or changed. If
+ * the decision is change, newValue is set to the value to write.
+ */
+typedef std::function<FilterDecision(const Slice& key,const Slice& value,ByteBuffer& newValue)> CompactionFilter;
 
 class Options {
 public:
@@ -19,6 +44,15 @@ public:
     // If the number of segments exceeds 2x this value, producers are paused while the
     // segments are merged.
     int maxSegments = 0;
+    // Maximum number of merges of disjoint runs of segments that run in parallel, so that merging
+    // keeps up after a burst of writes.
+    int maxBackgroundMerges = 2;
+    // Chooses the segments merged to enforce maxSegments, see SizeRatioPolicy. Its counters give
+    // the write amplification of the merges. If null, the database uses a SmallestFirstPolicy.
+    std::shared_ptr<CompactionPolicy> compactionPolicy;
+    // Runs the background merges and flushes, and may be shared by many databases so they do not
+    // each need their own threads. If null, JobScheduler::shared() is used.
+    std::shared_ptr<JobScheduler> scheduler;
     // Maximum size of memory segment in bytes. Maximum memory usage per database is
     // roughly MaxSegments * MaxMemoryBytes but can be higher based on producer rate.
     int maxMemoryBytes = 0;
@@ -28,6 +62,79 @@ public:
     bool enableSyncWrite = false;
     // Determines handling of partial batches during Open()
     BatchReadMode batchReadMode = BatchReadMode::discardPartial;
+    // Format used when writing new segments. Version 2 stores the keys, values and key index in a
+    // single file with varint encoded entries. Version 1 segments are always readable.
+    int segmentFormat = segmentFormatV2;
+    // Values larger than this many bytes are stored in separate blob files, so merges only copy
+    // a small reference to them. If 0, values are always stored in the segment. Requires format 2.
+    int blobValueThreshold = 0;
+    // Blob files where more than this fraction of the bytes are no longer referenced are rewritten
+    // by a background merge of the segments that reference them.
+    double blobGarbageRatio = 0.5;
+    // A disk segment where more than this fraction of the entries are deletions is merged by a
+    // background merge that removes the deletions, so reads no longer skip over them. If 0,
+    // deletions are only removed by the merges that enforce maxSegments. Requires format 2.
+    double tombstoneRatio = 0.5;
+    // Segments with fewer deletions than this are not merged because of their deletions.
+    int minTombstones = 10000;
+    // Called for each key/value written to a segment by a flush or merge, so entries can be removed
+    // or rewritten without a separate pass over the database. Deletions are not passed to the
+    // filter, and values stored in blob files are read from the blob file to be passed to it. It is
+    // called from several threads at once.
+    CompactionFilter compactionFilter;
+    // If not 0, each value is stored with its write time. Values older than this many seconds are
+    // not returned by reads and are removed by flushes and merges, including values stored in blob
+    // files. The TTL may change, but a database written with a TTL must always be opened with one,
+    // and one written without a TTL without one, otherwise the open fails.
+    int ttlSeconds = 0;
+    // Codec used to compress the values of new segments, see Compression. Requires format 2.
+    int compression = compressionNone;
+    // Values up to this many bytes are stored in the key block, so reading them does not access the
+    // data region of the segment. At most maxInlineValueLength. Requires format 2.
+    int inlineValueThreshold = 0;
+    // Size of the key blocks of new segments, between minKeyBlockSize and maxKeyBlockSize. Larger
+    // blocks suit long keys and devices with large pages. Requires format 2.
+    int blockSize = keyBlockSize;
+    // The first key of every indexInterval key blocks is kept in memory. A larger interval uses
+    // less memory but searches more blocks on disk.
+    int indexInterval = keyIndexInterval;
+    // Write new segments with direct IO where supported, so that merges do not evict the page cache.
+    bool directIO = false;
+    // Merges are split by key range into at most this many subcompactions, which are written in
+    // parallel as the partitions of the merged segment. Requires format 2.
+    int maxSubcompactions = 4;
+    // A merge is only split if each subcompaction reads at least this many bytes.
+    int minSubcompactionBytes = 16 * 1024 * 1024;
+    // Organize the disk segments into levels. Level 0 holds the memory segments, and each deeper
+    // level holds segments with disjoint key ranges, levelSizeRatio times larger than the level
+    // above, so a get probes at most one segment per level below level 0. A database that has
+    // been opened leveled is always opened leveled. Requires format 2.
+    bool leveled = false;
+    // Level 0 is merged into level 1 when it has more than this many segments.
+    int level0Segments = 4;
+    // The target size of level 1. A level larger than its target is merged into the next level.
+    int levelBaseBytes = 64 * 1024 * 1024;
+    int levelSizeRatio = 10;
+    // The maximum size of the segments written to level 1 and deeper.
+    int levelSegmentBytes = 16 * 1024 * 1024;
+    // Limits the rate at which merges and flushes write segment files, so that they interfere less
+    // with foreground reads. May be shared by several databases. If null, writes are not limited.
+    std::shared_ptr<RateLimiter> rateLimiter;
+    // The checksums of the disk segments are verified in the background every this many seconds,
+    // so that corruption is detected before the data is read. If 0, only reads verify checksums.
+    int scrubIntervalSeconds = 0;
+    // The maximum rate at which the background scrub reads the disk segments.
+    int scrubBytesPerSecond = 16 * 1024 * 1024;
+    // The maximum rate at which the files of merged segments are deleted in the background, so that
+    // freeing the blocks of large files does not stall foreground IO. If 0, the rate is not limited.
+    int64_t deleteBytesPerSecond = 256 * 1024 * 1024;
+    // Maximum number of segment files that are memory mapped at the same time. Segment files are
+    // mapped on first access, and the least recently used are unmapped beyond the limit. If 0,
+    // every segment file is mapped while its segment is open.
+    int maxOpenFiles = 1000;
+    // Bounds the mapped segment files, and may be shared by several databases so that the limit
+    // applies to all of them. If null, each database has its own cache of maxOpenFiles files.
+    std::shared_ptr<FileCache> fileCache;
     // Key comparison function or nil to use standard bytes.Compare
     int (*userKeyCompare)(const Slice& a,const Slice& b) = nullptr;
 
@@ -38,3 +145,12 @@ public:
     }
 };
 
+/**
+ * @brief options for a single read
+ */
+class ReadOptions {
+public:
+    // If true, the checksums of the key blocks and data read are verified, unless the blocks have
+    // already been verified. A checksum mismatch throws DatabaseCorrupted.
+    bool verifyChecksums = false;
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "segment.h"
+#include "exceptions.h"
+#include "bytebuffer.h"
+#include "blobstore.h"
+
+/**
+ * @brief disk segments with disjoint key ranges, in key order, so a key is only read from the
+ * partition that covers it. These are the partitions of a merge that was split into key range
+ * subcompactions, each named segment.L.U.P, or the segments of a level of a leveled database.
+ */
+class PartitionedSegment final : public Segment
+{
+private:
+    const std::vector<SegmentRef> partitions;
+    // the first key of each partition
+    std::vector<ByteBuffer> firstKeys;
+    std::vector<BlobUsage> blobUsage;
+
+    PartitionedSegment(const std::vector<SegmentRef>& partitions);
+    /**
+     * @brief the index of the partition that would contain the key
+     */
+    int partitionFor(const Slice& key) {
+        auto itr = std::upper_bound(firstKeys.begin()+1,firstKeys.end(),key,Slice::less);
+        return (itr-firstKeys.begin())-1;
+    }
+    /**
+     * @brief the range of partitions [first,last] that overlap the key range
+     */
+    void partitionRange(const Slice& lower,const Slice& upper,int *first,int *last) {
+        *first = lower.empty() ? 0 : partitionFor(lower);
+        *last = upper.empty() ? partitions.size()-1 : partitionFor(upper);
+    }
+    template<typename F> LookupRef concat(const Slice& lower,const Slice& upper,F lookup);
+
+    class Iterator final : public LookupIterator {
+    private:
+        const SegmentRef ps;
+        std::vector<LookupRef> iterators;
+        int index = 0;
+    public:
+        Iterator(SegmentRef ps,std::vector<LookupRef> iterators) : ps(ps), iterators(std::move(iterators)) {}
+        Slice peekKey() override {
+            for(;index<iterators.size();index++) {
+                auto key = iterators[index]->peekKey();
+                if(!key.empty()) return key;
+            }
+            return Slice();
+        }
+        bool isBlobRef() override {
+            return index<iterators.size() && iterators[index]->isBlobRef();
+        }
+        KeyValue& next(KeyValue& kv) override {
+            for(;index<iterators.size();index++) {
+                iterators[index]->next(kv);
+                if(!kv.key.empty()) return kv;
+            }
+            kv = KeyValue::EMPTY();
+            return kv;
+        }
+    };
+public:
+    using Segment::get;
+    /**
+     * @brief combine the partitions of a subcompaction, in key order
+     */
+    static SegmentRef newPartitionedSegment(const std::vector<SegmentRef>& partitions) {
+        auto ref = SegmentRef(new PartitionedSegment(partitions));
+        ref->weakRef = ref;
+        return ref;
+    }
+    const std::vector<SegmentRef>& getPartitions() { return partitions; }
+    /**
+     * @brief the bytes referenced in each blob file by the partitions
+     */
+    const std::vector<BlobUsage>& getBlobUsage() { return blobUsage; }
+    ID lowerID() override {
+        ID id = partitions[0]->lowerID();
+        for(auto p : partitions) id = std::min(id,p->lowerID());
+        return id;
+    }
+    ID upperID() override {
+        ID id = partitions[0]->upperID();
+        for(auto p : partitions) id = std::max(id,p->upperID());
+        return id;
+    }
+    uint64_t size() override {
+        uint64_t size=0;
+        for(auto p : partitions) size += p->size();
+        return size;
+    }
+    ByteBuffer put(const Slice& key,const Slice &value) override {
+        throw IllegalState("disk segments are immutable, put is not allowed");
+    }
+    ByteBuffer remove(const Slice& key) override {
+        throw IllegalState("disk segments are immutable, remove is not allowed");
+    }
+    ByteBuffer& get(const Slice& key,ByteBuffer &value) override {
+        return partitions[partitionFor(key)]->get(key,value);
+    }
+    ByteBuffer& get(const Slice& key,ByteBuffer &value,const ReadOptions& options) override {
+        return partitions[partitionFor(key)]->get(key,value,options);
+    }
+    LookupRef lookup(const Slice& lower, const Slice& upper) override {
+        return concat(lower,upper,[&](const SegmentRef& p){ return p->lookup(lower,upper); });
+    }
+    LookupRef lookup(const Slice& lower, const Slice& upper,const ReadOptions& options) override {
+        return concat(lower,upper,[&](const SegmentRef& p){ return p->lookup(lower,upper,options); });
+    }
+    LookupRef lookupRaw(const Slice& lower, const Slice& upper) override {
+        return concat(lower,upper,[&](const SegmentRef& p){ return p->lookupRaw(lower,upper); });
+    }
+    RangeEstimate estimateRange(const Slice& lower, const Slice& upper) override {
+        RangeEstimate estimate;
+        int first,last;
+        partitionRange(lower,upper,&first,&last);
+        for(int i=first;i<=last;i++) {
+            estimate += partitions[i]->estimateRange(lower,upper);
+        }
+        return estimate;
+    }
+    void entryCounts(uint64_t *entries,uint64_t *deletes) override {
+        *entries = 0;
+        *deletes = 0;
+        for(auto p : partitions) {
+            uint64_t e,d;
+            p->entryCounts(&e,&d);
+            *entries += e;
+            *deletes += d;
+        }
+    }
+    void close() override {
+        for(auto p : partitions) p->close();
+    }
+    void removeSegment() override {
+        for(auto p : partitions) p->removeSegment();
+    }
+    void removeOnFinalize(const std::shared_ptr<Deleter>& deleter = nullptr) override {
+        for(auto p : partitions) p->removeOnFinalize(deleter);
+    }
+    std::vector<std::string> files() override {
+        std::vector<std::string> files;
+        for(auto p : partitions) {
+            for(auto& file : p->files()) files.push_back(file);
+        }
+        return files;
+    }
+};
+
+template<typename F> LookupRef PartitionedSegment::concat(const Slice& lower,const Slice& upper,F lookup) {
+    std::vector<LookupRef> iterators;
+    int first,last;
+    partitionRange(lower,upper,&first,&last);
+    for(int i=first;i<=last;i++) {
+        iterators.push_back(lookup(partitions[i]));
+    }
+    return LookupRef(new Iterator(SegmentRef(weakRef),std::move(iterators)));
+}
+
+/**
+ * @brief choose up to n-1 keys that split the range into n partitions of roughly the same
+ * number of key blocks, using the key index of the largest disk segment
+ */
+std::vector<ByteBuffer> splitRange(const std::vector<SegmentRef>& segments,const Slice& lower,const Slice& upper,int n);
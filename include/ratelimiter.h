@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+/**
+ * @brief the counters of a RateLimiter
+ */
+struct RateLimiterStats {
+    // the bytes requested
+    uint64_t bytes = 0;
+    // the number of requests that waited, and the total time waited
+    uint64_t throttledRequests = 0;
+    uint64_t throttledMicros = 0;
+    // the current rate in bytes per second, lower than the configured rate while auto tuning backs off
+    int64_t rate = 0;
+};
+
+/**
+ * @brief a token bucket limiting the rate of background writes, which may be shared by several
+ * databases. In auto tune mode the rate is lowered while the latency of foreground gets rises,
+ * and raised back towards the configured rate while it does not.
+ */
+class RateLimiter {
+private:
+    typedef std::chrono::steady_clock clock;
+
+    std::mutex mtx;
+    const int64_t maxRate;
+    const bool autoTune;
+    int64_t rate;
+    double tokens = 0;
+    clock::time_point lastRefill;
+
+    // the foreground latency samples of the current tuning interval
+    clock::time_point intervalStart;
+    uint64_t intervalMicros = 0;
+    uint64_t intervalSamples = 0;
+    // the typical foreground latency when the rate is not causing interference
+    double baseline = 0;
+    std::atomic<uint64_t> samples{0};
+
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> throttledRequests{0};
+    std::atomic<uint64_t> throttledMicros{0};
+
+    void refill(clock::time_point now);
+    void tune(clock::time_point now);
+public:
+    /**
+     * @param bytesPerSecond the maximum rate
+     * @param autoTune if true, the rate adapts to the foreground get latency
+     */
+    RateLimiter(int64_t bytesPerSecond,bool autoTune = false);
+    /**
+     * @brief wait until the bytes may be written
+     */
+    void request(int64_t bytes);
+    /**
+     * @brief take the bytes without waiting, for callers that reschedule themselves rather than
+     * block a thread
+     *
+     * @return the time to wait before the bytes may be written
+     */
+    std::chrono::microseconds reserve(int64_t bytes);
+    /**
+     * @brief true if the latency of the current get should be recorded, which is a sample of the
+     * gets when auto tuning
+     */
+    bool sampleLatency() { return autoTune && (samples++ % 16)==0; }
+    void recordLatency(std::chrono::nanoseconds latency);
+    RateLimiterStats getStats();
+};
+
+/**
+ * @brief lowers the IO priority of the current thread while in scope, and of the threads started
+ * from it. This is a hint that is ignored where the platform does not support it.
+ */
+class BackgroundIO {
+private:
+    int previous = -1;
+public:
+    BackgroundIO();
+    ~BackgroundIO();
+    BackgroundIO(const BackgroundIO&) = delete;
+};
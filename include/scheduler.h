@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief the priority classes of background jobs, highest first
+ */
+enum class JobPriority {
+    // writing memory segments to disk
+    flush,
+    // merges that reduce the number of level 0, or unmerged, segments
+    level0,
+    // all other merges
+    merge,
+    // verifying the checksums of the disk segments, see Options::scrubIntervalSeconds
+    scrub,
+    // deleting the files of merged segments, see Options::deleteBytesPerSecond
+    deletion
+};
+
+/**
+ * @brief runs the background jobs of several databases on a fixed set of threads. Jobs run in
+ * priority order, and the jobs of a priority are taken from the databases in turn, so one busy
+ * database does not starve the others. Merges are limited to the threads not reserved for
+ * flushes, so a flush does not wait for long running merges. Jobs may be scheduled to run after
+ * a delay, so that periodic work does not need a thread of its own.
+ */
+class JobScheduler {
+public:
+    typedef std::function<void()> Job;
+private:
+    static constexpr int priorities = 5;
+
+    // the owners with queued jobs in the order they are served, and their jobs
+    struct Queue {
+        std::deque<const void*> owners;
+        std::map<const void*,std::deque<Job>> jobs;
+    };
+    struct TimedJob {
+        const void* owner;
+        JobPriority priority;
+        Job job;
+    };
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    Queue queues[priorities];
+    // the delayed jobs by the time they are queued
+    std::multimap<std::chrono::steady_clock::time_point,TimedJob> timers;
+    const int mergeThreads;
+    int runningMerges = 0;
+    bool stop = false;
+    std::vector<std::thread> threads;
+
+    void enqueue(const void* owner,JobPriority priority,Job job);
+    /**
+     * @brief queue the delayed jobs that are due, or all of them if stopping
+     */
+    void queueTimers(bool all);
+    bool next(Job& job,bool& merge);
+    void run();
+public:
+    /**
+     * @param threads the number of threads
+     * @param flushThreads the number of threads that only run flushes, at most threads-1
+     */
+    JobScheduler(int threads,int flushThreads = 1);
+    ~JobScheduler();
+    JobScheduler(const JobScheduler&) = delete;
+    /**
+     * @brief queue a job
+     *
+     * @param owner identifies the database the job belongs to
+     */
+    void schedule(const void* owner,JobPriority priority,Job job);
+    /**
+     * @brief queue a job once the delay has passed
+     */
+    void scheduleAfter(const void* owner,JobPriority priority,std::chrono::milliseconds delay,Job job);
+    /**
+     * @brief remove the queued and delayed jobs of the owner and run them on the calling thread, so
+     * that a closing database does not wait for the jobs of other databases or for the delays
+     */
+    void drain(const void* owner);
+    /**
+     * @brief the scheduler used by databases that are not given one, with a thread per core
+     */
+    static std::shared_ptr<JobScheduler> shared();
+};
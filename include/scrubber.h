@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+class Database;
+
+/**
+ * @brief the results of scrubbing the database, accumulated since it was opened
+ */
+struct ScrubStats {
+    uint64_t segmentsScrubbed = 0;
+    // the blocks verified by the scrubs, not counting blocks verified earlier by reads
+    uint64_t blocksScrubbed = 0;
+    uint64_t bytesScrubbed = 0;
+    uint64_t corruptBlocks = 0;
+    // the segment files containing a corrupt block
+    std::vector<std::string> corruptFiles;
+};
+
+/**
+ * @brief verifies the checksums of the disk segments in the background, so that corruption of
+ * data that is rarely read is detected. The least recently read segments are scrubbed first, and
+ * blocks already verified by reads are skipped. The background passes run as timed jobs on the
+ * JobScheduler of the database, each verifying a tenth of a second's worth of
+ * Options::scrubBytesPerSecond.
+ */
+class Scrubber {
+    std::mutex mtx;
+    bool stopped = false;
+    std::mutex scrubber;
+    std::mutex statsMtx;
+    ScrubStats stats;
+    std::set<std::string> corrupt;
+    // the segment file in which a pass stopped at the rate limit, and its progress
+    std::string resumeFile;
+    int64_t resumeBlock = 0;
+    uint64_t resumeCorruptBlocks = 0;
+
+    void schedule(Database *db,std::chrono::milliseconds delay);
+public:
+    /**
+     * @brief schedule the background scrub every Options::scrubIntervalSeconds
+     */
+    void start(Database *db);
+    /**
+     * @brief stop scheduling background scrubs, before the jobs of the database are drained
+     */
+    void stop();
+    /**
+     * @brief verify every disk segment that has not been verified
+     * 
+     * @param throttle if true, stop once a tenth of Options::scrubBytesPerSecond is verified, so
+     * that the pass can be continued later
+     * @return true if the pass stopped before verifying every segment
+     */
+    bool scrub(Database *db,bool throttle);
+    ScrubStats getStats();
+};
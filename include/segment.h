@@ -10,17 +10,33 @@
 #include <typeinfo>
 
 #include "constants.h"
+#include "deleter.h"
 #include "bytebuffer.h"
 #include "lookupiterator.h"
+#include "options.h"
 
 class Segment;
 
 typedef std::shared_ptr<Segment> SegmentRef;
 
+/**
+ * @brief an estimate of the bytes used and the number of keys in a key range
+ */
+struct RangeEstimate {
+    uint64_t bytes = 0;
+    uint64_t count = 0;
+    RangeEstimate& operator+=(const RangeEstimate& other) {
+        bytes += other.bytes;
+        count += other.count;
+        return *this;
+    }
+};
 
 class Segment {
 protected:
     bool shouldRemove = false;
+    // deletes the files of a removed disk segment
+    std::weak_ptr<Deleter> deleter;
 public:
     Segment() : weakRef(){
     }
@@ -35,13 +51,42 @@ public:
         ByteBuffer value;
         return get(key,value);
     }
+    /**
+     * @brief like get(), applying the read options. Segments without checksums ignore them.
+     */
+    virtual ByteBuffer& get(const Slice& key,ByteBuffer &value,const ReadOptions& options) { return get(key,value); }
     virtual ByteBuffer remove(const Slice& key) = 0;
     virtual void close() = 0;
     virtual LookupRef lookup(const Slice& lower, const Slice& upper) = 0;
+    virtual LookupRef lookup(const Slice& lower, const Slice& upper,const ReadOptions& options) { return lookup(lower,upper); }
+    /**
+     * @brief like lookup(), but values stored in blob files are returned as the encoded reference,
+     * so that merges can copy the reference without reading the value
+     */
+    virtual LookupRef lookupRaw(const Slice& lower, const Slice& upper) { return lookup(lower,upper); }
     virtual void removeSegment() = 0;
-    virtual void removeOnFinalize() { shouldRemove = true; }
+    /**
+     * @brief remove the segment once it is no longer referenced. The files of a disk segment are
+     * queued on the deleter, if given, otherwise they are deleted by Deleter::deleteScheduled().
+     */
+    virtual void removeOnFinalize(const std::shared_ptr<Deleter>& deleter = nullptr) {
+        shouldRemove = true;
+        this->deleter = deleter;
+    }
     virtual std::vector<std::string> files() = 0;
     virtual uint64_t size() = 0;
+    /**
+     * @brief estimate the size of the range without scanning it
+     * 
+     * @param lower the lower range (inclusive), or empty
+     * @param upper the upper range (inclusive), or empty
+     */
+    virtual RangeEstimate estimateRange(const Slice& lower, const Slice& upper) = 0;
+    /**
+     * @brief the number of entries in the segment, and how many of them are deletions. Both are 0
+     * if the segment does not record them.
+     */
+    virtual void entryCounts(uint64_t *entries,uint64_t *deletes) { *entries = 0; *deletes = 0; }
 
     // used to obtain SegmentRef instances
     std::weak_ptr<Segment> weakRef;
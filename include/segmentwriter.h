@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+
+#include "bytebuffer.h"
+#include "disksegment.h"
+#include "filewriter.h"
+#include "options.h"
+
+class BlobWriter;
+class LookupIterator;
+
+/**
+ * @brief builds a v2 segment file from entries added in key order, so that segments can be built
+ * outside of a database and added to it with Database::ingest(). The values are written to the
+ * file as they are added, and the key blocks to a temporary file, so only the current key block
+ * and the key index are held in memory. The file is written under a temporary name and renamed
+ * once finished, so rebuilding a file replaces it with a new file rather than overwriting the one
+ * a database may have linked. See writeSegmentFile() for the format.
+ */
+class SegmentWriter {
+friend KeyIndex writeSegmentFile(std::string filename,LookupIterator *itr,bool purgeDeleted,BlobWriter *blobs,const Options& options);
+private:
+    // the file written, and the name it is renamed to once finished
+    const std::string filename;
+    const std::string target;
+    const std::string keysFilename;
+    const int compression;
+    const int inlineLimit;
+    const int blockSize;
+    const int indexInterval;
+    // the entries must leave room for the checksums at the end of the block
+    const int entriesSize;
+    const int ttlSeconds;
+    BlobWriter * const blobs;
+    KeyIndex keyIndex;
+    SegmentMetadata metadata;
+    FileWriter segF;
+    FileWriter keyF;
+    ByteBuffer blockData;
+    ByteBuffer compressed;
+    ByteBuffer ref;
+    ByteBuffer blockBuffer;
+    // a value followed by its write time, if the options have a TTL
+    ByteBuffer timedValue;
+    int blockLen;
+    int blockEntries = 0;
+    uint64_t blockDataOffset = 0;
+    uint64_t dataOffset = 0;
+    // the checksum of the data written since the start of the key block
+    uint32_t dataCrc = 0;
+    ByteBuffer prevKey;
+    bool finished = false;
+
+    SegmentWriter(const std::string& filename,const std::string& target,const Options& options,BlobWriter *blobs);
+    /**
+     * @brief add an entry without checking the key order
+     *
+     * @param isBlobRef true if the value is an encoded BlobRef from a raw lookup
+     */
+    void append(const Slice& key,const Slice& value,bool isBlobRef);
+    void flushBlock();
+    void checkOrder(const Slice& key);
+public:
+    /**
+     * @param filename the segment file, which is replaced by finish() if it exists
+     * @param options the options of the database the segment will be ingested into, for the
+     * compression, key block size, index interval, inline value threshold and TTL. Values are not
+     * separated into blob files.
+     * @throws IllegalState if the key block size or index interval is invalid
+     */
+    SegmentWriter(const std::string& filename,const Options& options = Options()) : SegmentWriter(filename+".tmp",filename,options,nullptr) {}
+    SegmentWriter(const SegmentWriter&) = delete;
+    /**
+     * @brief if finish() was not called, the partially written file is removed, and an existing
+     * file of the name is left unchanged
+     */
+    ~SegmentWriter();
+    /**
+     * @brief add a key/value pair
+     *
+     * @param key must be non-empty, and greater than the previous key
+     * @param value must be non-empty
+     * @throws IllegalState if the key is not greater than the previous key
+     */
+    void put(const Slice& key,const Slice& value);
+    /**
+     * @brief add a deletion, which removes the key from the older segments of the database the
+     * segment is ingested into
+     *
+     * @param key must be non-empty, and greater than the previous key
+     * @throws IllegalState if the key is not greater than the previous key
+     */
+    void remove(const Slice& key);
+    /**
+     * @brief the number of entries added, including deletions
+     */
+    uint64_t count() const { return metadata.keyCount; }
+    /**
+     * @brief write the key blocks, the key index and the metadata, close the file and rename it to
+     * the segment file
+     *
+     * @return the key index of the segment
+     */
+    KeyIndex finish();
+};
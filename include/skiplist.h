@@ -126,6 +126,36 @@ public:
         return K();
     }
 
+    /**
+     * @brief estimate the number of entries in a range by counting the nodes on the highest level
+     * that has enough of them, and scaling by the branching factor. Cost is O(log n).
+     *
+     * @param lower the lower bound (inclusive), or nullptr
+     * @param upper the upper bound (inclusive), or nullptr
+     */
+    uint64_t approximateCount(const K* lower,const K* upper) {
+        static const int minSamples = 16;
+        const int height = maxHeight;
+        uint64_t scale = 1;
+        for(int i=1;i<height;i++) scale *= kBranching;
+
+        for(int level=height-1;level>=0;level--,scale/=kBranching) {
+            Node* x = head_;
+            if(lower!=nullptr) {
+                for(int i=height-1;i>=level;i--) {
+                    while(keyIsAfterNode(*lower,x->next(i))) x = x->next(i);
+                }
+            }
+            uint64_t count = 0;
+            for(Node* n = x->next(level); n!=nullptr; n = n->next(level)) {
+                if(upper!=nullptr && cmp(n->key,*upper) > 0) break;
+                count++;
+            }
+            if(count >= minSamples || level==0) return count * scale;
+        }
+        return 0;
+    }
+
     class Iterator {
     friend class SkipList;
     private:
@@ -1,101 +1,151 @@
 #pragma once
 
 #include <stddef.h>
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <thread>
-#include <queue>
+#include <type_traits>
+#include <vector>
 
 using namespace std;
 
-class ThreadPool { 
-public: 
-    // // Constructor to creates a thread pool with given 
-    // number of threads 
-    ThreadPool(size_t num_threads 
-               = thread::hardware_concurrency()) 
-    { 
-  
-        // Creating worker threads 
-        for (size_t i = 0; i < num_threads; ++i) { 
-            threads_.emplace_back([this] { 
-                while (true) { 
-                    function<void()> task; 
-                    // The reason for putting the below code 
-                    // here is to unlock the queue before 
-                    // executing the task so that other 
-                    // threads can perform enqueue tasks 
-                    { 
-                        // Locking the queue so that data 
-                        // can be shared safely 
-                        unique_lock<mutex> lock( 
-                            queue_mutex_); 
-  
-                        // Waiting until there is a task to 
-                        // execute or the pool is stopped 
-                        cv_.wait(lock, [this] { 
-                            return !tasks_.empty() || stop_; 
-                        }); 
-  
-                        // exit the thread in case the pool 
-                        // is stopped and there are no tasks 
-                        if (stop_ && tasks_.empty()) { 
-                            return; 
-                        } 
-  
-                        // Get the next task from the queue 
-                        task = move(tasks_.front()); 
-                        tasks_.pop(); 
-                    } 
-  
-                    task(); 
-                } 
-            }); 
-        } 
-    } 
-  
-    // Destructor to stop the thread pool 
-    ~ThreadPool() 
-    { 
-        { 
-            // Lock the queue to update the stop flag safely 
-            unique_lock<mutex> lock(queue_mutex_); 
-            stop_ = true; 
-        } 
-  
-        // Notify all threads 
-        cv_.notify_all(); 
-  
-        // Joining all worker threads to ensure they have 
-        // completed their tasks 
-        for (auto& thread : threads_) { 
-            thread.join(); 
-        } 
-    } 
-  
-    // Enqueue task for execution by the thread pool 
-    void enqueue(function<void()> task) 
-    { 
-        { 
-            unique_lock<std::mutex> lock(queue_mutex_); 
-            tasks_.emplace(move(task)); 
-        } 
-        cv_.notify_one(); 
-    } 
-  
-private: 
-    // Vector to store worker threads 
-    vector<thread> threads_; 
-  
-    // Queue of tasks 
-    queue<function<void()> > tasks_; 
-  
-    // Mutex to synchronize access to shared data 
-    mutex queue_mutex_; 
-  
-    // Condition variable to signal changes in the state of 
-    // the tasks queue 
-    condition_variable cv_; 
-  
-    // Flag to indicate whether the thread pool should stop 
-    // or not 
-    bool stop_ = false; 
+/**
+ * @brief a callable stored in a fixed size buffer, so that forking tasks does not allocate. The
+ * callable is typically a lambda capturing a few references.
+ */
+class Task {
+friend class ThreadPool;
+public:
+    static constexpr size_t capacity = 48;
+private:
+    alignas(std::max_align_t) unsigned char storage[capacity];
+    void (*invoke)(void*) = nullptr;
+    void (*destroy)(void*) = nullptr;
+    // the tasks of the fork not yet finished
+    std::atomic<int> *pending = nullptr;
+public:
+    Task() {}
+    Task(const Task&) = delete;
+    ~Task() { if(destroy) destroy(storage); }
+    template<class F>
+    void set(F&& f,std::atomic<int>* pending) {
+        typedef std::decay_t<F> Fn;
+        static_assert(sizeof(Fn) <= capacity && alignof(Fn) <= alignof(std::max_align_t),"task too large, capture by reference");
+        if(destroy) destroy(storage);
+        new(storage) Fn(std::forward<F>(f));
+        invoke = [](void* p) { (*(Fn*)p)(); };
+        destroy = [](void* p) { ((Fn*)p)->~Fn(); };
+        this->pending = pending;
+    }
+    void run() { invoke(storage); }
+};
+
+/**
+ * @brief the Chase-Lev work stealing deque of a worker. The owner pushes and pops at the bottom
+ * without locking, while other threads steal from the top.
+ */
+class WorkDeque {
+private:
+    static constexpr int64_t capacity = 4096;
+    std::atomic<int64_t> top{0};
+    std::atomic<int64_t> bottom{0};
+    std::atomic<Task*> slots[capacity];
+public:
+    /**
+     * @brief push a task, only called by the owner. Returns false if the deque is full.
+     */
+    bool push(Task* task);
+    /**
+     * @brief pop the most recently pushed task, only called by the owner
+     */
+    Task* pop();
+    /**
+     * @brief take the oldest task, or nullptr if there is none or another thread took it first
+     */
+    Task* steal();
+    bool empty() { return bottom.load() <= top.load(); }
+};
+
+/**
+ * @brief a work stealing thread pool for fork/join parallelism. Each worker has its own deque, so
+ * the tasks forked by a task on a worker are pushed and taken without locking, and idle workers
+ * steal from the others. Tasks forked by other threads are handed to the workers in one batch.
+ * A worker waiting for a join runs other tasks meanwhile, so nested forks cannot deadlock.
+ */
+class ThreadPool {
+private:
+    // the forks of up to this many tasks keep them on the stack of the forking thread
+    static constexpr int inlineTasks = 8;
+    // the failed attempts to find a task before a joining worker blocks until it is woken
+    static constexpr int joinSpins = 64;
+
+    struct Worker {
+        WorkDeque deque;
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // the tasks forked by threads that are not workers of the pool
+    std::mutex mtx;
+    std::condition_variable cv;
+    // signalled when the last task of a fork finishes
+    std::condition_variable joined;
+    std::deque<Task*> injected;
+    std::atomic<int> injectedCount{0};
+    std::atomic<int> sleeping{0};
+    // the workers blocked in join(), which are woken by submitted tasks as well as finished forks
+    std::atomic<int> parked{0};
+    bool stop = false;
+
+    Worker* currentWorker();
+    void submit(Task* tasks,int n);
+    Task* find(Worker* self,unsigned& seed);
+    bool hasWork();
+    void execute(Task* task);
+    void run(Worker* self);
+    void join(std::atomic<int>& pending);
+public:
+    ThreadPool(size_t num_threads = thread::hardware_concurrency());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+
+    /**
+     * @brief run fn(i) for i in [0,n) in parallel and wait for all of them. The calling thread
+     * runs the last one. If any throw, the first exception is rethrown once all have finished.
+     */
+    template<class F>
+    void parallelFor(int n,const F& fn) {
+        if(n<=0) return;
+        std::atomic<int> pending{n-1};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        auto call = [&](int i) {
+            try {
+                fn(i);
+            } catch(...) {
+                if(!failed.exchange(true)) error = std::current_exception();
+            }
+        };
+        Task local[inlineTasks];
+        std::unique_ptr<Task[]> allocated;
+        Task* tasks = local;
+        if(n-1 > inlineTasks) {
+            allocated.reset(new Task[n-1]);
+            tasks = allocated.get();
+        }
+        for(int i=0;i<n-1;i++) {
+            tasks[i].set([&call,i]() { call(i); },&pending);
+        }
+        submit(tasks,n-1);
+        call(n-1);
+        join(pending);
+        if(error) std::rethrow_exception(error);
+    }
 };
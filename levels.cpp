@@ -0,0 +1,103 @@
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "levels.h"
+#include "disksegment.h"
+#include "partitionedsegment.h"
+
+namespace fs = std::filesystem;
+
+std::vector<SegmentRef> levelSegments(const Levels& levels,const std::vector<SegmentRef>& level0) {
+    std::vector<SegmentRef> segments;
+    for(int i=levels.size()-1;i>=0;i--) {
+        if(levels[i].empty()) continue;
+        if(levels[i].size()==1) {
+            segments.push_back(levels[i][0]);
+        } else {
+            segments.push_back(PartitionedSegment::newPartitionedSegment(levels[i]));
+        }
+    }
+    for(auto s : level0) segments.push_back(s);
+    return segments;
+}
+
+int levelSegmentCount(const Levels& levels) {
+    int count = 0;
+    for(auto& level : levels) {
+        if(!level.empty()) count++;
+    }
+    return count;
+}
+
+bool LevelManifest::exists(const std::string& dbpath) {
+    return fs::exists(filename(dbpath));
+}
+
+static SegmentRef loadSegment(const std::string& dbpath,const std::string& name,const Options& options,BlobStoreRef blobs) {
+    if(name.starts_with("keys.")) {
+        return DiskSegment::newDiskSegment(dbpath+"/"+name,dbpath+"/data."+name.substr(5),{},options.fileCache);
+    }
+    return DiskSegment::newDiskSegment(dbpath+"/"+name,{},blobs,options.fileCache);
+}
+
+Levels LevelManifest::load(const std::string& dbpath,const Options& options,BlobStoreRef blobs,std::vector<SegmentRef>& level0) {
+    Levels levels;
+    std::set<std::string> listed;
+    // the partitions of a level 0 subcompaction are listed consecutively
+    std::vector<SegmentRef> partitions;
+    auto endPartitions = [&]() {
+        if(partitions.size()==1) level0.push_back(partitions[0]);
+        if(partitions.size()>1) level0.push_back(PartitionedSegment::newPartitionedSegment(partitions));
+        partitions.clear();
+    };
+
+    std::ifstream in(filename(dbpath));
+    std::string line;
+    while(std::getline(in,line)) {
+        std::istringstream fields(line);
+        int level;
+        std::string name;
+        if(!(fields >> level >> name) || level < 0) throw IllegalState("invalid levels file");
+        listed.insert(name);
+        if(name.starts_with("data.")) continue;
+        auto segment = loadSegment(dbpath,name,options,blobs);
+        if(level==0) {
+            if(!partitions.empty() && (partitions[0]->lowerID()!=segment->lowerID() || partitions[0]->upperID()!=segment->upperID())) {
+                endPartitions();
+            }
+            partitions.push_back(segment);
+            continue;
+        }
+        if(levels.size() < level) levels.resize(level);
+        levels[level-1].push_back(segment);
+    }
+    endPartitions();
+
+    for(auto file : fs::directory_iterator(dbpath)) {
+        auto name = file.path().filename().string();
+        if(!name.starts_with("segment.") && !name.starts_with("keys.") && !name.starts_with("data.")) continue;
+        if(!listed.contains(name)) fs::remove(file.path());
+    }
+    return levels;
+}
+
+void LevelManifest::save(const std::string& dbpath,const Levels& levels,const std::vector<std::string>& level0Files) {
+    auto tmp = filename(dbpath)+".tmp";
+    std::ofstream out;
+    out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    out.open(tmp,std::ios::out | std::ios::trunc);
+    for(auto& file : level0Files) {
+        out << 0 << " " << fs::path(file).filename().string() << "\n";
+    }
+    for(int i=0;i<levels.size();i++) {
+        for(auto s : levels[i]) {
+            for(auto& file : s->files()) {
+                out << (i+1) << " " << fs::path(file).filename().string() << "\n";
+            }
+        }
+    }
+    out.close();
+    fs::rename(tmp,filename(dbpath));
+}
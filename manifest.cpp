@@ -0,0 +1,106 @@
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+
+#include "manifest.h"
+#include "partitionedsegment.h"
+#include "diskio.h"
+#include "crc32c.h"
+
+namespace fs = std::filesystem;
+
+static void appendBytes(ByteBuffer& buffer,const Slice& bytes) {
+    appendVarint(buffer,bytes.length);
+    buffer.append(bytes);
+}
+
+void Manifest::save(const std::string& dbpath,const std::vector<SegmentRef>& segments) {
+    std::vector<DiskSegment*> disksegments;
+    for(auto& s : segments) {
+        if(auto ps = dynamic_cast<PartitionedSegment*>(s.get())) {
+            for(auto& p : ps->getPartitions()) {
+                if(auto ds = dynamic_cast<DiskSegment*>(p.get())) disksegments.push_back(ds);
+            }
+        } else if(auto ds = dynamic_cast<DiskSegment*>(s.get())) {
+            disksegments.push_back(ds);
+        }
+    }
+
+    ByteBuffer buffer;
+    uint8_t header[12];
+    writeLEuint64(header,manifestMagic);
+    writeLEuint32(header+8,manifestVersion);
+    buffer.append(Slice(header,sizeof(header)));
+    appendVarint(buffer,disksegments.size());
+    for(auto ds : disksegments) {
+        auto name = fs::path(ds->files()[0]).filename().string();
+        appendBytes(buffer,Slice((const uint8_t*)name.data(),name.size()));
+        appendVarint(buffer,ds->getFormat());
+        appendVarint(buffer,ds->size());
+        if(ds->getFormat()==segmentFormatV1) {
+            appendVarint(buffer,0);
+        } else {
+            appendBytes(buffer,ds->getMetadata().encode());
+        }
+        auto& keyIndex = ds->getKeyIndex();
+        appendVarint(buffer,keyIndex.size());
+        for(auto& key : keyIndex) appendBytes(buffer,key);
+    }
+    uint8_t checksum[4];
+    writeLEuint32(checksum,crc32c(buffer));
+    buffer.append(Slice(checksum,sizeof(checksum)));
+
+    auto tmp = filename(dbpath)+".tmp";
+    std::ofstream out;
+    out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    out.open(tmp,std::ios::out | std::ios::trunc | std::ios::binary);
+    out.write((const char*)(uint8_t*)buffer,buffer.length);
+    out.close();
+    fs::rename(tmp,filename(dbpath));
+}
+
+ManifestEntries Manifest::load(const std::string& dbpath) {
+    std::ifstream in(filename(dbpath),std::ios::binary);
+    if(!in) return {};
+    std::string contents((std::istreambuf_iterator<char>(in)),std::istreambuf_iterator<char>());
+    const uint8_t *buffer = (const uint8_t*)contents.data();
+    int length = contents.size();
+
+    if(length < 16) return {};
+    if(readLEuint64(buffer)!=manifestMagic || readLEuint32(buffer+8)!=manifestVersion) return {};
+    length -= 4;
+    if(crc32c(0,buffer,length)!=readLEuint32(buffer+length)) return {};
+
+    ManifestEntries entries;
+    int index = 12;
+    auto varint = [&]() {
+        uint64_t value;
+        index += readVarint(buffer+index,length-index,&value);
+        return value;
+    };
+    auto bytes = [&]() {
+        uint64_t n = varint();
+        if(index+n > (uint64_t)length) throw IllegalState("invalid manifest");
+        Slice slice(buffer+index,n);
+        index += n;
+        return slice;
+    };
+    try {
+        uint64_t count = varint();
+        for(uint64_t i=0;i<count;i++) {
+            auto name = bytes();
+            ManifestEntry entry;
+            entry.format = varint();
+            entry.size = varint();
+            auto metadata = bytes();
+            if(entry.format!=segmentFormatV1) entry.metadata = SegmentMetadata::decode(metadata);
+            uint64_t keys = varint();
+            for(uint64_t k=0;k<keys;k++) entry.keyIndex.push_back(bytes());
+            entries[std::string((const char*)name.ptr,name.length)] = std::move(entry);
+        }
+    } catch(IllegalState&) {
+        // the manifest is only a cache of the segment files, so the files are read instead
+        return {};
+    }
+    return entries;
+}
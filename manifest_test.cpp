@@ -0,0 +1,96 @@
+#define BOOST_TEST_MODULE manifest
+#include <boost/test/included/unit_test.hpp>
+
+#include <filesystem>
+#include <fstream>
+
+#include "manifest.h"
+#include "disksegment.h"
+#include "memorysegment.h"
+
+namespace fs = std::filesystem;
+
+static const std::string dir = "test/manifest";
+
+static SegmentRef writeSegment(const std::string& name,int count) {
+    auto ms = MemorySegment::newMemoryOnlySegment();
+    for(int i=0;i<count;i++) ms->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+    auto itr = ms->lookup("","");
+    return writeAndLoadSegment(dir+"/"+name,itr.get(),false);
+}
+
+BOOST_AUTO_TEST_CASE( manifest_save_load ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    auto segment = writeSegment("segment.1.1",20000);
+    auto ms = MemorySegment::newMemoryOnlySegment();
+    ms->put("mykey","myvalue");
+    auto itr = ms->lookup("","");
+    auto v1 = writeAndLoadSegment(dir+"/keys.2.2",dir+"/data.2.2",itr.get(),false);
+    Manifest::save(dir,{segment,v1,ms});
+
+    auto entries = Manifest::load(dir);
+    BOOST_REQUIRE(entries.size()==2);
+    auto& entry = entries["segment.1.1"];
+    auto ds = dynamic_cast<DiskSegment*>(segment.get());
+    BOOST_TEST(entry.format==segmentFormatV2);
+    BOOST_TEST(entry.size==fs::file_size(dir+"/segment.1.1"));
+    BOOST_TEST(entry.metadata.keyCount==20000);
+    BOOST_TEST(entry.metadata.keyBlocks==ds->blockCount());
+    BOOST_REQUIRE(entry.keyIndex.size()==ds->getKeyIndex().size());
+    BOOST_TEST(entry.keyIndex.size() > 1);
+    for(int i=0;i<entry.keyIndex.size();i++) BOOST_TEST(entry.keyIndex[i]==ds->getKeyIndex()[i]);
+    BOOST_TEST(entries["keys.2.2"].format==segmentFormatV1);
+
+    // a segment opened from the entry does not read the metadata or key index from the file
+    auto cached = DiskSegment::newDiskSegment(dir+"/segment.1.1",entry.metadata,entry.keyIndex);
+    BOOST_TEST(cached->get("mykey12345").compareTo("myvalue12345")==0);
+    uint64_t entriesCount,deletes;
+    cached->entryCounts(&entriesCount,&deletes);
+    BOOST_TEST(entriesCount==20000);
+}
+
+BOOST_AUTO_TEST_CASE( manifest_damaged ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    auto segment = writeSegment("segment.1.1",100);
+    Manifest::save(dir,{segment});
+    BOOST_TEST(Manifest::load(dir).size()==1);
+
+    std::fstream file(Manifest::filename(dir),std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(20);
+    file.put('x');
+    file.close();
+    BOOST_TEST(Manifest::load(dir).empty());
+
+    fs::remove(Manifest::filename(dir));
+    BOOST_TEST(Manifest::load(dir).empty());
+}
+
+BOOST_AUTO_TEST_CASE( manifest_load_segments ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    auto s1 = writeSegment("segment.1.1",100);
+    auto s2 = writeSegment("segment.2.2",100);
+    auto merged = writeSegment("segment.1.2",200);
+    Manifest::save(dir,{merged});
+    // written after the manifest was saved, so it is read from the file
+    auto s3 = writeSegment("segment.3.3",300);
+
+    // the segments contained in the merged segment are ignored
+    auto segments = DiskSegment::loadDiskSegments(dir,Options());
+    BOOST_REQUIRE(segments.size()==2);
+    BOOST_TEST(segments[0]->lowerID()==1);
+    BOOST_TEST(segments[0]->upperID()==2);
+    BOOST_TEST(segments[1]->lowerID()==3);
+    BOOST_TEST(segments[1]->get("mykey299").compareTo("myvalue299")==0);
+    BOOST_TEST(segments[0]->get("mykey199").compareTo("myvalue199")==0);
+
+    // without the manifest the same segments are loaded
+    fs::remove(Manifest::filename(dir));
+    segments = DiskSegment::loadDiskSegments(dir,Options());
+    BOOST_REQUIRE(segments.size()==2);
+    BOOST_TEST(segments[0]->upperID()==2);
+    BOOST_TEST(segments[1]->upperID()==3);
+    fs::remove_all(dir);
+}
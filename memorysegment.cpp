@@ -14,6 +14,7 @@ void MemorySegment::write(const WriteBatch& batch){
     for(auto kv : batch.entries) {
         auto prev = list.put(kv);
         bytes += kv.key.length + kv.value.length - prev.key.length - prev.value.length;
+        if(prev.key.empty()) entries++;
         if(log) {
             log->write(kv.key,kv.value);
         }
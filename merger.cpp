@@ -1,4 +1,5 @@
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
 #include <iostream>
 
@@ -7,99 +8,796 @@
 #include "merger.h"
 #include "multisegment.h"
 #include "diskio.h"
+#include "partitionedsegment.h"
+#include "levels.h"
 
 /**
- * @brief starts the auto segment merger for the database.
+ * @brief schedule a background merge of the database, unless one is already queued. A merge that
+ * is running when woken is scheduled again when it finishes.
  * @param db it's ok to pass a pointer here, since the Database instance uses the
  * WaitGroup to guard against usage after close
  */
-void Merger::autoMerger(Database* db) {
-    auto runnable = [=]() {
+void Merger::wakeup(Database* db,std::chrono::milliseconds delay) {
+    if(pending++ > 0) return;
+    schedule(db,delay);
+}
+
+void Merger::schedule(Database* db,std::chrono::milliseconds delay) {
+    auto state = db->getState();
+    auto priority = JobPriority::merge;
+    if(db->leveled) {
+        if(state->segments.size()-levelSegmentCount(state->levels) > db->options.level0Segments) priority = JobPriority::level0;
+    } else if(state->segments.size() > db->options.maxSegments) {
+        priority = JobPriority::level0;
+    }
+
+    db->wg.add(1);
+    auto job = [this,db]() {
         WaitGroupDone done(db->wg);
-        while(true) {
-            {
-                std::unique_lock<std::mutex> lock(mtx);
-                cv.wait_for(lock,chrono::seconds(1));
-            }
-            if(db->closing || db->err) {
-                break;
-            }
-            UseWaitGroup use(db->wg);
-            try {
-                mergeSegments0(db,db->options.maxSegments,true);
-            } catch(std::exception& ex) {
-                db->err = &ex;
+        // wakeups from now on are handled by this run
+        pending = 1;
+        if(db->closing || db->err) {
+            pending = 0;
+            return;
+        }
+        // a leveled database compacts one segment per job, and schedules the next compaction after
+        // a delay rather than holding the worker
+        bool compacted = false;
+        try {
+            if(db->leveled) {
+                std::unique_lock<std::shared_mutex> lock(merger,std::try_to_lock);
+                if(lock.owns_lock()) compacted = compactLevelStep(db,db->options.level0Segments);
+            } else {
+                startRuns(db);
             }
+        } catch(std::exception& ex) {
+            db->err = &ex;
+        }
+        if(--pending > 0) {
+            schedule(db);
+        } else if(compacted && !db->closing) {
+            wakeup(db,throttleDelay);
         }
     };
+    if(delay.count() > 0) {
+        db->options.scheduler->scheduleAfter(db,priority,delay,job);
+    } else {
+        db->options.scheduler->schedule(db,priority,job);
+    }
+}
+
+/**
+ * @brief add a merge to the counters of the policy. Segments that have not been merged before,
+ * i.e. flushed memory segments, cover a single segment id.
+ */
+static void recordRun(CompactionPolicy& policy,const std::vector<SegmentRef>& segments,const SegmentRun& run,const SegmentRef& newseg) {
+    uint64_t input = 0, fresh = 0;
+    for(int i=run.startAt;i<run.startAt+run.count;i++) {
+        auto size = segments[i]->size();
+        input += size;
+        if(segments[i]->lowerID()==segments[i]->upperID()) fresh += size;
+    }
+    policy.recordMerge(input,fresh,newseg->size());
+}
+
+void Merger::startRuns(Database* db) {
+    auto& policy = *db->options.compactionPolicy;
+    std::vector<SegmentRef> segments(db->getState()->segments);
+
+    std::lock_guard<std::mutex> guard(mtx);
+    int slots = std::max(db->options.maxBackgroundMerges,1) - running;
+    if(slots <= 0) return;
+
+    // consecutive segments that are being merged count as the single segment they become, and
+    // cannot be part of another run
+    std::vector<uint64_t> sizes;
+    std::vector<int> first;
+    std::vector<bool> busy;
+    for(int i=0;i<segments.size();i++) {
+        bool inflight = merging.contains(segments[i].get());
+        if(inflight && !busy.empty() && busy.back()) {
+            sizes.back() += segments[i]->size();
+            continue;
+        }
+        sizes.push_back(segments[i]->size());
+        first.push_back(i);
+        busy.push_back(inflight);
+    }
+    first.push_back(segments.size());
+
+    if(sizes.size() > db->options.maxSegments) {
+        for(auto run : policy.selectRuns(sizes,db->options.maxSegments,slots)) {
+            if(std::find(busy.begin()+run.startAt,busy.begin()+run.startAt+run.count,true)!=busy.begin()+run.startAt+run.count) continue;
+            SegmentRun selected{.startAt = first[run.startAt], .count = first[run.startAt+run.count]-first[run.startAt]};
+            startRun(db,segments,selected,selected.startAt==0,true,JobPriority::level0);
+        }
+        return;
+    }
 
-    std::thread runner(runnable);
-    runner.detach();
+    auto idle = [&](const SegmentRun& run) {
+        for(int i=run.startAt;i<run.startAt+run.count;i++) {
+            if(merging.contains(segments[i].get())) return false;
+        }
+        return true;
+    };
+    SegmentRun run;
+    if(blobRun(db,segments,run) && idle(run)) {
+        startRun(db,segments,run,run.startAt==0,false,JobPriority::merge);
+    } else if(tombstoneRun(db,segments,run) && idle(run)) {
+        startRun(db,segments,run,true,false,JobPriority::merge);
+    }
 }
 
-void Merger::wakeup() {
-    std::unique_lock<std::mutex> lock(mtx, std::try_to_lock);
-    if(!lock.owns_lock()) return;
-    cv.notify_one();
+void Merger::startRun(Database* db,const std::vector<SegmentRef>& segments,const SegmentRun& run,bool purgeDeleted,bool record,JobPriority priority) {
+    std::vector<SegmentRef> mergable(segments.begin()+run.startAt,segments.begin()+run.startAt+run.count);
+    for(auto& s : mergable) merging.insert(s.get());
+    running++;
+
+    db->wg.add(1);
+    db->options.scheduler->schedule(db,priority,[this,db,mergable,purgeDeleted,record]() {
+        WaitGroupDone done(db->wg);
+        try {
+            std::shared_lock<std::shared_mutex> lock(merger,std::try_to_lock);
+            // merges of the whole database, which wake up the merger when done, may have merged the run
+            auto segments = db->getState()->segments;
+            int startAt = std::find(segments.begin(),segments.end(),mergable[0])-segments.begin();
+            bool current = startAt+mergable.size() <= segments.size() && std::equal(mergable.begin(),mergable.end(),segments.begin()+startAt);
+            if(lock.owns_lock() && current && !db->closing && !db->err) {
+                auto newseg = writeRun(db,segments,startAt,mergable.size(),purgeDeleted);
+                installRun(db,segments,startAt,mergable.size(),newseg);
+                if(record) recordRun(*db->options.compactionPolicy,segments,SegmentRun{.startAt = startAt, .count = (int)mergable.size()},newseg);
+            }
+        } catch(std::exception& ex) {
+            db->err = &ex;
+        }
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            for(auto& s : mergable) merging.erase(s.get());
+            running--;
+        }
+        // the next merges are chosen after a delay, so that merging does not monopolize the disk
+        if(!db->closing) wakeup(db,throttleDelay);
+    });
 }
 
-void Merger::mergeSegments0(Database* db,int maxSegments,bool throttle) {
-    std::unique_lock<std::mutex> lock(merger, std::try_to_lock);
-    if(!lock.owns_lock()) return;
+void Merger::mergeSegments0(Database* db,int maxSegments) {
+    std::unique_lock<std::shared_mutex> lock(merger);
+
+    auto& policy = *db->options.compactionPolicy;
 
     while(true) {
         std::vector<SegmentRef> segments(db->getState()->segments);
         if(segments.size() <= maxSegments) return;
-        int maxMergeSize = std::max(segments.size() / 2, (unsigned long)4);
 
-        auto itr = segments.begin();
-        auto smallest = itr;
-        while(itr < segments.end()-1) {
-            if((*itr)->size() < (*smallest)->size()) smallest = itr;
-            itr++;
+        std::vector<uint64_t> sizes;
+        for(auto& s : segments) sizes.push_back(s->size());
+        auto runs = policy.selectRuns(sizes,maxSegments,std::max(db->options.maxBackgroundMerges,1));
+        if(runs.empty()) return;
+
+        if(runs.size()==1) {
+            auto newseg = writeRun(db,segments,runs[0].startAt,runs[0].count,runs[0].startAt==0);
+            installRun(db,segments,runs[0].startAt,runs[0].count,newseg);
+            recordRun(policy,segments,runs[0],newseg);
+            continue;
+        }
+        // the runs are written by dedicated threads, since the subcompactions of each merge wait
+        // on the executor, and installed by this thread, which holds the db_lock when closing
+        std::vector<SegmentRef> merged(runs.size());
+        std::vector<std::exception_ptr> errors(runs.size());
+        std::vector<std::thread> jobs;
+        for(int i=0;i<runs.size();i++) {
+            jobs.emplace_back([&,i]() {
+                try {
+                    merged[i] = writeRun(db,segments,runs[i].startAt,runs[i].count,runs[i].startAt==0);
+                } catch(...) {
+                    errors[i] = std::current_exception();
+                }
+            });
         }
+        for(auto& job : jobs) job.join();
+        for(int i=0;i<runs.size();i++) {
+            if(!merged[i]) continue;
+            installRun(db,segments,runs[i].startAt,runs[i].count,merged[i]);
+            recordRun(policy,segments,runs[i],merged[i]);
+        }
+        for(auto& error : errors) {
+            if(error) std::rethrow_exception(error);
+        }
+    }
+}
 
-        auto last = std::min(smallest+maxMergeSize,segments.end());
-        std::vector<SegmentRef> mergable(smallest,last);
+bool Merger::blobRun(Database* db,const std::vector<SegmentRef>& segments,SegmentRun& run) {
+    BlobFileID worst;
+    double worstRatio = db->options.blobGarbageRatio;
+    bool found = false;
+    for(auto [file,ratio] : db->blobs->garbageRatios(segments)) {
+        if(ratio > worstRatio) {
+            worst = file;
+            worstRatio = ratio;
+            found = true;
+        }
+    }
+    if(!found) return false;
 
-        auto newseg = mergeSegments1(db->deleter,db->path,mergable,smallest==segments.begin());
+    int first = -1, last = -1;
+    for(int i=0;i<segments.size();i++) {
+        for(auto& usage : BlobStore::usage(segments[i])) {
+            if(usage.file==worst) {
+                if(first<0) first = i;
+                last = i;
+            }
+        }
+    }
+    if(first<0) return false;
+    // a merge must include at least two segments, since the new segment and its blob file are
+    // named using the id range
+    if(first==last) {
+        if(last+1 < segments.size()) last++;
+        else if(first>0) first--;
+        else return false;
+    }
+    run = SegmentRun{.startAt = first, .count = last-first+1};
+    return true;
+}
 
-        std::unique_lock lock(db->db_lock);
+/**
+ * @brief the fraction of the entries of the segment that are deletions, or 0 if it has fewer than
+ * minTombstones deletions
+ */
+static double tombstoneRatio(const SegmentRef& segment,int minTombstones) {
+    uint64_t entries,deletes;
+    segment->entryCounts(&entries,&deletes);
+    if(deletes==0 || deletes < minTombstones) return 0;
+    return double(deletes) / entries;
+}
 
-        auto state = db->getState();
-        int startAt = smallest - segments.begin();
-        int index = startAt;
-        for(auto s : mergable) {
-            if(s!=state->segments[index++]) throw IllegalState("unexpected segment change");
+bool Merger::tombstoneRun(Database* db,const std::vector<SegmentRef>& segments,SegmentRun& run) {
+    if(db->options.tombstoneRatio <= 0) return false;
+
+    int worst = -1;
+    double worstRatio = db->options.tombstoneRatio;
+    for(int i=0;i<segments.size();i++) {
+        auto ratio = tombstoneRatio(segments[i],db->options.minTombstones);
+        if(ratio > worstRatio) {
+            worst = i;
+            worstRatio = ratio;
         }
-        for(auto s : mergable) {
-            s->removeOnFinalize();
+    }
+    if(worst<0) return false;
+
+    // deletions are only removed by a merge that includes the oldest segment, and a merge must
+    // include at least two segments
+    int last = std::max(worst,1);
+    if(last >= segments.size()) return false;
+    run = SegmentRun{.startAt = 0, .count = last+1};
+    return true;
+}
+
+void Merger::mergeRun(Database* db,const std::vector<SegmentRef>& segments,int startAt,int count,bool purgeDeleted,const MergeProgress& progress) {
+    installRun(db,segments,startAt,count,writeRun(db,segments,startAt,count,purgeDeleted,progress));
+}
+
+SegmentRef Merger::writeRun(Database* db,const std::vector<SegmentRef>& segments,int startAt,int count,bool purgeDeleted,const MergeProgress& progress) {
+    std::vector<SegmentRef> mergable(segments.begin()+startAt,segments.begin()+startAt+count);
+
+    std::set<BlobFileID> relocate;
+    for(auto [file,ratio] : db->blobs->garbageRatios(segments)) {
+        if(ratio > db->options.blobGarbageRatio) relocate.insert(file);
+    }
+
+    return mergeSegments1(*db->deleter,db->path,mergable,purgeDeleted,db->options,db->blobs,relocate,progress);
+}
+
+void Merger::installRun(Database* db,const std::vector<SegmentRef>& segments,int startAt,int count,const SegmentRef& newseg) {
+    std::vector<SegmentRef> mergable(segments.begin()+startAt,segments.begin()+startAt+count);
+
+    std::unique_lock lock(db->db_lock);
+
+    // merges of other runs may have been installed since the run was chosen, moving its position
+    auto state = db->getState();
+    startAt = std::find(state->segments.begin(),state->segments.end(),mergable[0])-state->segments.begin();
+    int index = startAt;
+    for(auto s : mergable) {
+        if(index>=state->segments.size() || s!=state->segments[index++]) throw IllegalState("unexpected segment change");
+    }
+    for(auto s : mergable) {
+        s->removeOnFinalize(db->deleter);
+    }
+
+    std::vector<SegmentRef> newsegments;
+    for(int i=0;i<startAt;i++) {
+        newsegments.push_back(state->segments[i]);
+    }
+    newsegments.push_back(newseg);
+    for(auto itr = state->segments.begin()+(startAt+mergable.size());itr<state->segments.end();itr++) {
+        newsegments.push_back(*itr);
+    }
+
+    DatabaseState newstate(newsegments,state->memory,MultiSegment::newMultiSegment(copyAndAppend(newsegments,state->memory)));
+    db->setState(newstate);
+
+    db->blobs->installed(newseg);
+    auto unreferenced = db->blobs->unreferenced(newsegments);
+    if(!unreferenced.empty()) db->deleter->scheduleDeletion(unreferenced);
+    lock.unlock();
+
+    db->saveManifest();
+}
+/**
+ * @brief the first and last keys of a segment, both empty if the segment is empty
+ */
+static void keyRange(const SegmentRef& segment,ByteBuffer& first,ByteBuffer& last) {
+    first = ByteBuffer::EMPTY();
+    last = ByteBuffer::EMPTY();
+    if(auto ds = dynamic_cast<DiskSegment*>(segment.get())) {
+        if(ds->getKeyIndex().empty()) return;
+        first = ds->getKeyIndex()[0];
+        last = ds->lastKey();
+        return;
+    }
+    // the partitions are in key order and never empty
+    if(auto ps = dynamic_cast<PartitionedSegment*>(segment.get())) {
+        ByteBuffer unused;
+        keyRange(ps->getPartitions().front(),first,unused);
+        keyRange(ps->getPartitions().back(),unused,last);
+        return;
+    }
+    auto itr = segment->lookupRaw(Slice(),Slice());
+    KeyValue kv;
+    while(!itr->next(kv).key.empty()) {
+        if(first.empty()) first = kv.key;
+        last = kv.key;
+    }
+}
+
+/**
+ * @brief limits an iterator to roughly the number of bytes, ending after the entry that reaches
+ * the limit, so that the remaining entries can be read by another SizeLimitIterator
+ */
+class SizeLimitIterator final : public LookupIterator {
+private:
+    LookupIterator *itr;
+    const uint64_t limit;
+    uint64_t bytes = 0;
+    bool _finished = false;
+public:
+    SizeLimitIterator(LookupIterator *itr,uint64_t limit) : itr(itr), limit(limit) {}
+    /**
+     * @brief true if the underlying iterator has no more entries
+     */
+    bool finished() { return _finished; }
+    Slice peekKey() override {
+        if(bytes >= limit) return Slice();
+        return itr->peekKey();
+    }
+    bool isBlobRef() override { return itr->isBlobRef(); }
+    KeyValue& next(KeyValue& kv) override {
+        if(bytes >= limit) {
+            kv = KeyValue::EMPTY();
+            return kv;
         }
+        itr->next(kv);
+        if(kv.key.empty()) _finished = true;
+        bytes += kv.key.length + kv.value.length;
+        return kv;
+    }
+};
 
-        std::vector<SegmentRef> newsegments;
-        for(int i=0;i<startAt;i++) {
-            newsegments.push_back(state->segments[i]);
+/**
+ * @brief reports the bytes of the entries read from an iterator, in batches of roughly a megabyte,
+ * so that the progress of a merge can be reported while it runs
+ */
+class ProgressIterator final : public LookupIterator {
+private:
+    static constexpr uint64_t interval = 1024*1024;
+    LookupIterator *itr;
+    const MergeProgress& progress;
+    uint64_t bytes = 0;
+public:
+    ProgressIterator(LookupIterator *itr,const MergeProgress& progress) : itr(itr), progress(progress) {}
+    Slice peekKey() override { return itr->peekKey(); }
+    bool isBlobRef() override { return itr->isBlobRef(); }
+    KeyValue& next(KeyValue& kv) override {
+        itr->next(kv);
+        if(!progress) return kv;
+        bytes += kv.key.length + kv.value.length;
+        if(bytes >= interval || (kv.key.empty() && bytes > 0)) {
+            progress(bytes);
+            bytes = 0;
         }
-        newsegments.push_back(newseg);
-        for(auto itr = state->segments.begin()+(startAt+mergable.size());itr<state->segments.end();itr++) {
-            newsegments.push_back(*itr);
+        return kv;
+    }
+};
+
+void Merger::compactLevels(Database* db,int maxLevel0) {
+    std::unique_lock<std::shared_mutex> lock(merger);
+    while(compactLevelStep(db,maxLevel0));
+}
+
+bool Merger::compactLevelStep(Database* db,int maxLevel0) {
+    auto state = db->getState();
+    auto& levels = state->levels;
+    std::vector<SegmentRef> level0(state->segments.begin()+levelSegmentCount(levels),state->segments.end());
+
+    if(level0.size() > maxLevel0) {
+        compactLevel(db,level0,0);
+        return true;
+    }
+
+    // the level that exceeds its target size by the largest factor
+    int level = -1;
+    double worst = 1.0;
+    double target = db->options.levelBaseBytes;
+    for(int i=0;i<levels.size();i++) {
+        uint64_t bytes = 0;
+        for(auto s : levels[i]) bytes += s->size();
+        if(bytes/target > worst) {
+            worst = bytes/target;
+            level = i+1;
+        }
+        target *= db->options.levelSizeRatio;
+    }
+    if(level<0) return compactTombstones(db,level0);
+
+    // the segments of the level are compacted in turn, in key order
+    auto& segments = levels[level-1];
+    auto& pointer = compactPointer[level];
+    SegmentRef next = segments[0];
+    for(auto s : segments) {
+        ByteBuffer first,last;
+        keyRange(s,first,last);
+        if(pointer.empty() || Slice::less(pointer,first)) {
+            next = s;
+            break;
+        }
+    }
+    ByteBuffer first;
+    keyRange(next,first,pointer);
+    compactLevel(db,{next},level);
+    return true;
+}
+
+bool Merger::compactTombstones(Database* db,const std::vector<SegmentRef>& level0) {
+    if(db->options.tombstoneRatio <= 0) return false;
+    auto state = db->getState();
+    auto& levels = state->levels;
+    int minTombstones = db->options.minTombstones;
+
+    // the deletions move down with each compaction until they reach the deepest level, where they
+    // are removed, so the deepest level is not a candidate
+    int worstLevel = -1;
+    SegmentRef worst;
+    double worstRatio = db->options.tombstoneRatio;
+    for(auto s : level0) {
+        auto ratio = tombstoneRatio(s,minTombstones);
+        if(ratio > worstRatio) {
+            worstLevel = 0;
+            worstRatio = ratio;
+        }
+    }
+    for(int i=0;i+1<levels.size();i++) {
+        for(auto s : levels[i]) {
+            auto ratio = tombstoneRatio(s,minTombstones);
+            if(ratio > worstRatio) {
+                worstLevel = i+1;
+                worst = s;
+                worstRatio = ratio;
+            }
+        }
+    }
+    if(worstLevel<0) return false;
+    if(worstLevel==0) {
+        compactLevel(db,level0,0);
+    } else {
+        compactLevel(db,{worst},worstLevel);
+    }
+    return true;
+}
+
+void Merger::compactRange(Database* db,const Slice& lower,const Slice& upper,const CompactionProgress& progress) {
+    std::unique_lock<std::shared_mutex> lock(merger);
+
+    auto intersects = [](const SegmentRef& segment,const Slice& lower,const Slice& upper) {
+        ByteBuffer first,last;
+        keyRange(segment,first,last);
+        if(first.empty()) return false;
+        return (upper.empty() || !Slice::less(upper,first)) && (lower.empty() || !Slice::less(last,lower));
+    };
+    auto overlaps = [&](const SegmentRef& segment) { return intersects(segment,lower,upper); };
+    // the bytes of the merges that finished, and the input bytes of the merge in progress, of which
+    // the entries read so far are reported while it runs
+    uint64_t bytes = 0, total = 0, merging = 0, consumed = 0;
+    std::mutex reporting;
+    auto start = [&](const std::vector<SegmentRef>& inputs) {
+        merging = consumed = 0;
+        for(auto s : inputs) merging += s->size();
+    };
+    MergeProgress consume;
+    if(progress) consume = [&](uint64_t n) {
+        std::lock_guard<std::mutex> guard(reporting);
+        consumed += n;
+        progress(std::min(bytes+std::min(consumed,merging),total),total);
+    };
+    auto report = [&]() {
+        bytes += merging;
+        merging = consumed = 0;
+        if(progress) progress(std::min(bytes,total),total);
+    };
+
+    auto state = db->getState();
+    if(!db->leveled) {
+        auto& segments = state->segments;
+        int first = -1, last = -1;
+        for(int i=0;i<segments.size();i++) {
+            if(!overlaps(segments[i])) continue;
+            if(first<0) first = i;
+            last = i;
+        }
+        if(first<0) return;
+        // a merge must include at least two segments, since the new segment is named using the
+        // id range
+        if(first==last) {
+            if(last+1 < segments.size()) last++;
+            else if(first>0) first--;
+            else return;
+        }
+        // the merged segments must be consecutive, so the run includes any segments between
+        std::vector<SegmentRef> run(segments.begin()+first,segments.begin()+last+1);
+        for(auto s : run) total += s->size();
+        // the deletions can be removed if no older segment holds keys in the key range of the run,
+        // which cannot change while the merger lock is held
+        ByteBuffer runFirst,runLast;
+        for(auto s : run) {
+            ByteBuffer f,l;
+            keyRange(s,f,l);
+            if(f.empty()) continue;
+            if(runFirst.empty() || Slice::less(f,runFirst)) runFirst = f;
+            if(runLast.empty() || Slice::less(runLast,l)) runLast = l;
+        }
+        bool purgeDeleted = true;
+        for(int i=0;i<first && !runFirst.empty();i++) {
+            if(intersects(segments[i],runFirst,runLast)) purgeDeleted = false;
+        }
+        start(run);
+        mergeRun(db,segments,first,run.size(),purgeDeleted,consume);
+        report();
+        return;
+    }
+
+    auto count = levelSegmentCount(state->levels);
+    std::vector<SegmentRef> level0(state->segments.begin()+count,state->segments.end());
+    bool level0Overlaps = false;
+    for(auto s : level0) {
+        if(overlaps(s)) level0Overlaps = true;
+    }
+    if(level0Overlaps) {
+        for(auto s : level0) total += s->size();
+    }
+    for(auto& segments : state->levels) {
+        for(auto s : segments) {
+            if(overlaps(s)) total += s->size();
+        }
+    }
+
+    // the segments of level 0 overlap each other, so they are compacted together
+    if(level0Overlaps) {
+        start(level0);
+        compactLevel(db,level0,0,consume);
+        report();
+    }
+    // each level is compacted into the next, so the range ends in the deepest level, where the
+    // deletions are removed
+    for(int level=1;level<db->getState()->levels.size();level++) {
+        auto current = db->getState();
+        std::vector<SegmentRef> inputs;
+        for(auto s : current->levels[level-1]) {
+            if(overlaps(s)) inputs.push_back(s);
+        }
+        if(inputs.empty()) continue;
+        start(inputs);
+        compactLevel(db,inputs,level,consume);
+        report();
+    }
+}
+
+void Merger::compactLevel(Database* db,const std::vector<SegmentRef>& inputs,int level,const MergeProgress& progress) {
+    auto state = db->getState();
+    Levels levels = state->levels;
+    if(levels.size() < level+1) levels.resize(level+1);
+
+    ByteBuffer lower,upper;
+    for(auto s : inputs) {
+        ByteBuffer first,last;
+        keyRange(s,first,last);
+        if(first.empty()) continue;
+        if(lower.empty() || Slice::less(first,lower)) lower = first;
+        if(upper.empty() || Slice::less(upper,last)) upper = last;
+    }
+
+    // the segments of the next level that overlap the inputs are rewritten, the others are kept
+    std::vector<SegmentRef> overlapping, kept;
+    for(auto s : levels[level]) {
+        ByteBuffer first,last;
+        keyRange(s,first,last);
+        if(!lower.empty() && !Slice::less(last,lower) && !Slice::less(upper,first)) {
+            overlapping.push_back(s);
+        } else {
+            kept.push_back(s);
+        }
+    }
+
+    // deleted keys can only be dropped if no deeper level has an older value
+    bool purgeDeleted = true;
+    for(int i=level+1;i<levels.size();i++) {
+        if(!levels[i].empty()) purgeDeleted = false;
+    }
+
+    std::set<BlobFileID> relocate;
+    for(auto [file,ratio] : db->blobs->garbageRatios(state->segments)) {
+        if(ratio > db->options.blobGarbageRatio) relocate.insert(file);
+    }
+
+    // inputs that overlap neither each other nor the next level are moved to the next level
+    // unchanged, since the manifest lists the segment files of each level
+    // level 0 may hold partitioned segments, which copyableSegments() counts by partition
+    bool move = overlapping.empty();
+    for(auto& s : inputs) {
+        if(dynamic_cast<DiskSegment*>(s.get())==nullptr) move = false;
+    }
+    move = move && copyableSegments(inputs,purgeDeleted,db->options).size()==inputs.size();
+    for(auto& s : inputs) {
+        for(auto& usage : BlobStore::usage(s)) {
+            if(relocate.contains(usage.file)) move = false;
         }
+    }
 
-        DatabaseState newstate(newsegments,state->memory,MultiSegment::newMultiSegment(copyAndAppend(newsegments,state->memory)));
-        db->setState(newstate);
+    // the inputs are newer than the segments of the next level
+    std::vector<SegmentRef> merging;
+    std::vector<SegmentRef> outputs;
+    if(move) {
+        outputs = inputs;
+    } else {
+        merging = overlapping;
+        merging.insert(merging.end(),inputs.begin(),inputs.end());
+        auto ms = MultiSegment::newMultiSegment(merging);
+        auto itr = ms->lookupRaw(Slice(),Slice());
+        ProgressIterator counted(itr.get(),progress);
 
-        lock.unlock();
-        if(throttle) usleep(std::chrono::microseconds(100ms).count());
+        while(true) {
+            auto id = db->nextSegmentID();
+            BlobWriter writer(db->blobs,BlobFileID{.lower = id, .upper = id},db->options.blobValueThreshold,relocate);
+            SizeLimitIterator limited(&counted,db->options.levelSegmentBytes);
+            auto seg = writeAndLoadSegment(db->path,id,id,&limited,purgeDeleted,db->options,&writer);
+            if(((DiskSegment*)seg.get())->getKeyIndex().empty()) {
+                seg->removeSegment();
+            } else {
+                outputs.push_back(seg);
+            }
+            if(limited.finished()) break;
+        }
     }
+
+    std::unique_lock lock(db->db_lock);
+
+    auto current = db->getState();
+    int count = levelSegmentCount(current->levels);
+    std::vector<SegmentRef> level0(current->segments.begin()+count,current->segments.end());
+    if(level==0) {
+        for(int i=0;i<inputs.size();i++) {
+            if(i>=level0.size() || inputs[i]!=level0[i]) throw IllegalState("unexpected segment change");
+        }
+        level0.erase(level0.begin(),level0.begin()+inputs.size());
+    } else {
+        auto& from = levels[level-1];
+        for(auto s : inputs) from.erase(std::remove(from.begin(),from.end(),s),from.end());
+    }
+    kept.insert(kept.end(),outputs.begin(),outputs.end());
+    std::vector<std::pair<ByteBuffer,SegmentRef>> ordered;
+    for(auto s : kept) {
+        ByteBuffer first,last;
+        keyRange(s,first,last);
+        ordered.push_back({first,s});
+    }
+    std::sort(ordered.begin(),ordered.end(),[](const auto& a,const auto& b) { return Slice::less(a.first,b.first); });
+    levels[level].clear();
+    for(auto& [first,s] : ordered) levels[level].push_back(s);
+    while(!levels.empty() && levels.back().empty()) levels.pop_back();
+
+    std::vector<std::string> level0Files;
+    for(auto s : level0) {
+        for(auto& file : s->files()) level0Files.push_back(file);
+    }
+    LevelManifest::save(db->path,levels,level0Files);
+
+    auto newsegments = levelSegments(levels,level0);
+    DatabaseState newstate(newsegments,current->memory,MultiSegment::newMultiSegment(copyAndAppend(newsegments,current->memory)),levels);
+    db->setState(newstate);
+
+    std::vector<std::string> files;
+    for(auto s : merging) {
+        s->removeOnFinalize(db->deleter);
+        for(auto& file : s->files()) files.push_back(file);
+    }
+    db->deleter->scheduleDeletion(files);
+
+    for(auto s : outputs) db->blobs->installed(s);
+    auto unreferenced = db->blobs->unreferenced(newsegments);
+    if(!unreferenced.empty()) db->deleter->scheduleDeletion(unreferenced);
 }
 
-SegmentRef Merger::mergeSegments1(Deleter &deleter, const std::string& dbpath, std::vector<SegmentRef>& segments,bool purgeDeleted){
+/**
+ * @brief limits an iterator to the keys before the upper bound, since the upper bound of a
+ * lookup is inclusive
+ */
+class UpperBoundIterator final : public LookupIterator {
+private:
+    LookupIterator *itr;
+    const Slice upper;
+    bool beyond(const Slice& key) { return !upper.empty() && !key.empty() && key.compareTo(upper) >= 0; }
+public:
+    UpperBoundIterator(LookupIterator *itr,const Slice& upper) : itr(itr), upper(upper) {}
+    Slice peekKey() override {
+        auto key = itr->peekKey();
+        return beyond(key) ? Slice() : key;
+    }
+    bool isBlobRef() override { return itr->isBlobRef(); }
+    KeyValue& next(KeyValue& kv) override {
+        itr->next(kv);
+        if(beyond(kv.key)) kv = KeyValue::EMPTY();
+        return kv;
+    }
+};
+
+SegmentRef Merger::mergePartitions(const std::string& dbpath,ID lowerId,ID upperId,const SegmentRef& ms,const std::vector<ByteBuffer>& splits,bool purgeDeleted,
+    const Options& options,BlobStoreRef blobs,const MergeProgress& progress) {
+    int n = splits.size()+1;
+    auto filename = [&](int partition) {
+        return dbpath+"/segment."+std::to_string(lowerId)+"."+std::to_string(upperId)+"."+std::to_string(partition);
+    };
+
+    std::vector<KeyIndex> keyIndexes(n);
+    try {
+        Database::executor.parallelFor(n,[&](int i) {
+            BackgroundIO background;
+            Slice lower = i==0 ? Slice() : (Slice)splits[i-1];
+            Slice upper = i==n-1 ? Slice() : (Slice)splits[i];
+            if(blobs) {
+                BlobWriter writer(blobs,BlobFileID{.lower = lowerId, .upper = upperId},options.blobValueThreshold);
+                auto itr = ms->lookupRaw(lower,upper);
+                UpperBoundIterator range(itr.get(),upper);
+                ProgressIterator counted(&range,progress);
+                keyIndexes[i] = writeSegmentFile(filename(i)+".tmp",&counted,purgeDeleted,&writer,options);
+            } else {
+                auto itr = ms->lookup(lower,upper);
+                UpperBoundIterator range(itr.get(),upper);
+                ProgressIterator counted(&range,progress);
+                keyIndexes[i] = writeSegmentFile(filename(i)+".tmp",&counted,purgeDeleted,nullptr,options);
+            }
+        });
+    } catch(...) {
+        for(int i=0;i<n;i++) fs::remove(filename(i)+".tmp");
+        throw;
+    }
+
+    // the partitions are only renamed once all are written, see DiskSegment::loadDiskSegments
+    std::vector<SegmentRef> partitions;
+    for(int i=0;i<n;i++) {
+        if(keyIndexes[i].empty() && (i<n-1 || !partitions.empty())) {
+            fs::remove(filename(i)+".tmp");
+            continue;
+        }
+        fs::rename(filename(i)+".tmp",filename(i));
+        partitions.push_back(DiskSegment::newDiskSegment(filename(i),keyIndexes[i],blobs,options.fileCache));
+    }
+    if(partitions.size()==1) return partitions[0];
+    return PartitionedSegment::newPartitionedSegment(partitions);
+}
+
+SegmentRef Merger::mergeSegments1(Deleter &deleter, const std::string& dbpath, std::vector<SegmentRef>& segments,bool purgeDeleted,const Options& options,
+    BlobStoreRef blobs,const std::set<BlobFileID>& relocate,const MergeProgress& progress){
     auto lowerId = segments[0]->lowerID();
     auto upperId = (*(segments.end()-1))->upperID();
 
-    auto keyFilename = dbpath+"/keys."+std::to_string(lowerId)+"."+std::to_string(upperId);
-    auto dataFilename = dbpath+"/data."+std::to_string(lowerId)+"."+std::to_string(upperId);
-
     std::vector<std::string> files;
 
     for(auto s : segments) {
@@ -108,9 +806,46 @@ SegmentRef Merger::mergeSegments1(Deleter &deleter, const std::string& dbpath, s
         }
     }
 
+    // segments whose key ranges do not overlap, such as sequentially loaded data, are merged by
+    // copying their blocks rather than decoding and encoding every entry
+    auto sources = copyableSegments(segments,purgeDeleted,options);
+    for(auto& s : segments) {
+        for(auto& usage : BlobStore::usage(s)) {
+            if(relocate.contains(usage.file)) sources.clear();
+        }
+    }
+    if(!sources.empty()) {
+        auto seg = copyAndLoadSegment(dbpath,lowerId,upperId,sources,options,blobs);
+        deleter.scheduleDeletion(files);
+        return seg;
+    }
+
     auto ms = MultiSegment::newMultiSegment(segments);
-    auto itr = ms->lookup("","");
-    auto seg = writeAndLoadSegment(keyFilename,dataFilename,itr.get(),purgeDeleted);
+    SegmentRef seg;
+
+    uint64_t inputBytes = 0;
+    for(auto s : segments) inputBytes += s->size();
+    int parts = std::min(inputBytes / std::max(options.minSubcompactionBytes,1),(uint64_t)std::max(options.maxSubcompactions,1));
+    // the subcompactions share the blob file id, so they can only copy existing blob references
+    bool writesBlobs = blobs && (options.blobValueThreshold > 0 || !relocate.empty());
+    std::vector<ByteBuffer> splits;
+    if(parts > 1 && !writesBlobs && options.segmentFormat!=segmentFormatV1) {
+        splits = splitRange(segments,Slice(),Slice(),parts);
+    }
+
+    if(!splits.empty()) {
+        seg = mergePartitions(dbpath,lowerId,upperId,ms,splits,purgeDeleted,options,blobs,progress);
+    } else if(blobs && options.segmentFormat!=segmentFormatV1) {
+        // the blob references are copied rather than the values
+        BlobWriter writer(blobs,BlobFileID{.lower = lowerId, .upper = upperId},options.blobValueThreshold,relocate);
+        auto itr = ms->lookupRaw("","");
+        ProgressIterator counted(itr.get(),progress);
+        seg = writeAndLoadSegment(dbpath,lowerId,upperId,&counted,purgeDeleted,options,&writer);
+    } else {
+        auto itr = ms->lookup("","");
+        ProgressIterator counted(itr.get(),progress);
+        seg = writeAndLoadSegment(dbpath,lowerId,upperId,&counted,purgeDeleted,options);
+    }
     deleter.scheduleDeletion(files);
     return seg;
 
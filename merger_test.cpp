@@ -3,8 +3,11 @@
 
 #include <filesystem>
 #include <vector>
+#include <numeric>
 
 #include "database.h"
+#include "disksegment.h"
+#include "partitionedsegment.h"
 
 namespace fs = std::filesystem;
 
@@ -33,3 +36,160 @@ BOOST_AUTO_TEST_CASE( merger ) {
     }
     BOOST_TEST( count==200000);
 }
+
+BOOST_AUTO_TEST_CASE( merger_subcompactions ) {
+    fs::remove_all("test");
+    fs::create_directory("test");
+    auto m1 = MemorySegment::newMemoryOnlySegment();
+    for(int i=0;i<100000;i++) {
+        m1->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+    }
+    auto m2 = MemorySegment::newMemoryOnlySegment();
+    for(int i=0;i<100000;i+=2) {
+        m2->put("mykey"+std::to_string(i),"updated"+std::to_string(i));
+    }
+    m2->remove("mykey7");
+    auto itr = m1->lookup("","");
+    auto s1 = writeAndLoadSegment("test/segment.1.1",itr.get(),false);
+    itr = m2->lookup("","");
+    auto s2 = writeAndLoadSegment("test/segment.2.2",itr.get(),false);
+    uint64_t entries,deletes;
+    s2->entryCounts(&entries,&deletes);
+    BOOST_TEST(entries==50001);
+    BOOST_TEST(deletes==1);
+
+    Options options;
+    options.minSubcompactionBytes = 1;
+    options.maxSubcompactions = 4;
+
+    Merger merger;
+    Deleter deleter;
+
+    auto segments = std::vector<SegmentRef>{s1,s2};
+    auto merged = merger.mergeSegments1(deleter,"test",segments,true,options);
+    auto ps = dynamic_cast<PartitionedSegment*>(merged.get());
+    BOOST_REQUIRE(ps!=nullptr);
+    BOOST_TEST(ps->getPartitions().size()==4);
+    BOOST_TEST(merged->lowerID()==1);
+    BOOST_TEST(merged->upperID()==2);
+
+    auto verify = [](SegmentRef seg) {
+        auto itr = seg->lookup("","");
+        int count=0;
+        ByteBuffer prev;
+        KeyValue kv;
+        while(!itr->next(kv).key.empty()) {
+            BOOST_TEST(prev.compareTo(kv.key) < 0);
+            prev = kv.key;
+            count++;
+        }
+        BOOST_TEST( count==99999);
+        BOOST_TEST(seg->get("mykey0")=="updated0");
+        BOOST_TEST(seg->get("mykey1")=="myvalue1");
+        BOOST_TEST(seg->get("mykey7").empty());
+        BOOST_TEST(seg->get("mykey99998")=="updated99998");
+        BOOST_TEST(seg->get("mykey99999")=="myvalue99999");
+        itr = seg->lookup("mykey5","mykey6");
+        count=0;
+        while(!itr->next(kv).key.empty()) count++;
+        BOOST_TEST(count==11112);
+    };
+    verify(merged);
+
+    for(auto s : segments) s->removeSegment();
+    auto loaded = DiskSegment::loadDiskSegments("test",options);
+    BOOST_REQUIRE(loaded.size()==1);
+    BOOST_TEST(dynamic_cast<PartitionedSegment*>(loaded[0].get())!=nullptr);
+    verify(loaded[0]);
+}
+
+BOOST_AUTO_TEST_CASE( merger_block_copy ) {
+    fs::remove_all("test");
+    fs::create_directory("test");
+    auto key = [](int i) {
+        char buffer[32];
+        snprintf(buffer,sizeof(buffer),"mykey%06d",i);
+        return std::string(buffer);
+    };
+    Options options;
+
+    // segments of consecutive key ranges, as written by sequential loading
+    std::vector<SegmentRef> segments;
+    for(int s=0;s<3;s++) {
+        auto m = MemorySegment::newMemoryOnlySegment();
+        for(int i=s*10000;i<(s+1)*10000;i++) m->put(key(i),"myvalue"+std::to_string(i));
+        if(s==1) m->remove(key(15000)+"x");
+        auto itr = m->lookup("","");
+        auto filename = "test/segment."+std::to_string(s+1)+"."+std::to_string(s+1);
+        segments.push_back(writeAndLoadSegment(filename,itr.get(),false,nullptr,options));
+    }
+    BOOST_TEST(copyableSegments(segments,false,options).size()==3);
+    BOOST_TEST(copyableSegments(segments,true,options).empty());
+
+    // the key blocks are copied, so each segment keeps its partially filled last block
+    int64_t blocks = 0;
+    for(auto s : segments) blocks += ((DiskSegment*)s.get())->blockCount();
+
+    Merger merger;
+    Deleter deleter;
+    auto merged = merger.mergeSegments1(deleter,"test",segments,false,options);
+    auto ds = (DiskSegment*)merged.get();
+    BOOST_TEST(ds->blockCount()==blocks);
+    for(int64_t b=0;b<ds->blockCount();b++) BOOST_TEST(ds->verifyBlock(b));
+    uint64_t entries,deletes;
+    merged->entryCounts(&entries,&deletes);
+    BOOST_TEST(entries==30001);
+    BOOST_TEST(deletes==1);
+
+    auto itr = merged->lookup("","");
+    int count = 0;
+    KeyValue kv;
+    while(!itr->next(kv).key.empty()) {
+        if(kv.value.empty()) continue;
+        BOOST_TEST(kv.key==key(count));
+        BOOST_TEST(kv.value=="myvalue"+std::to_string(count));
+        count++;
+    }
+    BOOST_TEST(count==30000);
+    BOOST_TEST(merged->get(key(12345))=="myvalue12345");
+    BOOST_TEST(merged->get(key(15000)+"x").empty());
+
+    // overlapping segments are merged by decoding the entries
+    auto m = MemorySegment::newMemoryOnlySegment();
+    m->put(key(5),"updated");
+    auto mitr = m->lookup("","");
+    auto overlapping = writeAndLoadSegment("test/segment.4.4",mitr.get(),false,nullptr,options);
+    segments = {merged,overlapping};
+    BOOST_TEST(copyableSegments(segments,false,options).empty());
+    merged = merger.mergeSegments1(deleter,"test",segments,true,options);
+    BOOST_TEST(merged->get(key(5))=="updated");
+    merged->entryCounts(&entries,&deletes);
+    BOOST_TEST(entries==30000);
+}
+
+BOOST_AUTO_TEST_CASE( merger_progress ) {
+    fs::remove_all("test");
+    fs::create_directory("test");
+    auto m1 = MemorySegment::newMemoryOnlySegment();
+    auto m2 = MemorySegment::newMemoryOnlySegment();
+    for(int i=0;i<100000;i++) {
+        m1->put("mykey"+std::to_string(i),"myvalue"+std::to_string(i));
+        m2->put("mykey"+std::to_string(i),"updated"+std::to_string(i));
+    }
+
+    Merger merger;
+    Deleter deleter;
+
+    // the entries are reported in batches while they are merged
+    std::vector<uint64_t> reported;
+    auto segments = std::vector<SegmentRef>{m1,m2};
+    auto merged = merger.mergeSegments1(deleter,"test",segments,false,Options(),nullptr,{},[&](uint64_t bytes) {
+        reported.push_back(bytes);
+    });
+    uint64_t bytes = 0;
+    auto itr = merged->lookup("","");
+    KeyValue kv;
+    while(!itr->next(kv).key.empty()) bytes += kv.key.length + kv.value.length;
+    BOOST_TEST(reported.size()>1);
+    BOOST_TEST(std::accumulate(reported.begin(),reported.end(),uint64_t(0))==bytes);
+}
@@ -0,0 +1,53 @@
+#include <map>
+
+#include "partitionedsegment.h"
+#include "disksegment.h"
+
+PartitionedSegment::PartitionedSegment(const std::vector<SegmentRef>& partitions) : partitions(partitions) {
+    if(partitions.empty()) throw IllegalState("partitioned segment without partitions");
+    std::map<BlobFileID,uint64_t> usage;
+    for(auto p : partitions) {
+        auto ds = dynamic_cast<DiskSegment*>(p.get());
+        if(ds==nullptr) throw IllegalState("partition is not a disk segment");
+        auto& keyIndex = ds->getKeyIndex();
+        if(keyIndex.empty()) throw IllegalState("empty partition");
+        firstKeys.push_back(keyIndex[0]);
+        for(auto& u : ds->getBlobUsage()) usage[u.file] += u.bytes;
+    }
+    for(auto [file,bytes] : usage) {
+        blobUsage.push_back(BlobUsage{.file = file, .bytes = bytes});
+    }
+}
+
+static void appendKeyIndex(const SegmentRef& segment,std::vector<Slice>& keys) {
+    if(auto ps = dynamic_cast<PartitionedSegment*>(segment.get())) {
+        for(auto& p : ps->getPartitions()) appendKeyIndex(p,keys);
+    } else if(auto ds = dynamic_cast<DiskSegment*>(segment.get())) {
+        for(auto& key : ds->getKeyIndex()) keys.push_back(key);
+    }
+}
+
+std::vector<ByteBuffer> splitRange(const std::vector<SegmentRef>& segments,const Slice& lower,const Slice& upper,int n) {
+    SegmentRef largest;
+    for(auto s : segments) {
+        if(dynamic_cast<DiskSegment*>(s.get())==nullptr && dynamic_cast<PartitionedSegment*>(s.get())==nullptr) continue;
+        if(!largest || s->size() > largest->size()) largest = s;
+    }
+    std::vector<ByteBuffer> splits;
+    if(!largest || n<=1) return splits;
+
+    std::vector<Slice> keyIndex;
+    appendKeyIndex(largest,keyIndex);
+
+    std::vector<Slice> candidates;
+    for(auto& key : keyIndex) {
+        if(!lower.empty() && !Slice::less(lower,key)) continue;
+        if(!upper.empty() && !Slice::less(key,upper)) break;
+        candidates.push_back(key);
+    }
+    int partitions = std::min(n,(int)candidates.size()+1);
+    for(int i=1;i<partitions;i++) {
+        splits.push_back(candidates[(i*candidates.size())/partitions]);
+    }
+    return splits;
+}
@@ -0,0 +1,114 @@
+#include <thread>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "ratelimiter.h"
+
+// the tokens that may accumulate while idle, as a fraction of a second
+static const double maxBurst = 0.1;
+// the period over which the foreground latency is averaged when auto tuning
+static const auto tuneInterval = std::chrono::milliseconds(500);
+
+RateLimiter::RateLimiter(int64_t bytesPerSecond,bool autoTune)
+    : maxRate(std::max(bytesPerSecond,(int64_t)1)), autoTune(autoTune), rate(maxRate) {
+    lastRefill = intervalStart = clock::now();
+}
+
+void RateLimiter::refill(clock::time_point now) {
+    double elapsed = std::chrono::duration<double>(now-lastRefill).count();
+    lastRefill = now;
+    tokens = std::min(tokens + elapsed*rate, maxBurst*rate);
+}
+
+void RateLimiter::request(int64_t n) {
+    auto wait = reserve(n);
+    if(wait.count() > 0) std::this_thread::sleep_for(wait);
+}
+
+std::chrono::microseconds RateLimiter::reserve(int64_t n) {
+    bytes += n;
+    std::unique_lock<std::mutex> lock(mtx);
+    auto now = clock::now();
+    if(autoTune) tune(now);
+    refill(now);
+    // the tokens may go negative, so large requests are admitted after waiting for the deficit
+    tokens -= n;
+    if(tokens >= 0) return std::chrono::microseconds(0);
+    auto wait = std::chrono::microseconds((int64_t)(-tokens*1000000/rate));
+    lock.unlock();
+
+    throttledRequests++;
+    throttledMicros += wait.count();
+    return wait;
+}
+
+void RateLimiter::recordLatency(std::chrono::nanoseconds latency) {
+    std::lock_guard<std::mutex> lock(mtx);
+    intervalMicros += std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    intervalSamples++;
+    tune(clock::now());
+}
+
+/**
+ * @brief at the end of each interval, halve the rate if the average foreground latency is more
+ * than twice the baseline, otherwise raise it by a tenth of the maximum
+ */
+void RateLimiter::tune(clock::time_point now) {
+    if(now-intervalStart < tuneInterval) return;
+    intervalStart = now;
+    if(intervalSamples==0) {
+        rate = std::min(maxRate,rate+maxRate/10);
+        return;
+    }
+    double average = (double)intervalMicros/intervalSamples;
+    intervalMicros = intervalSamples = 0;
+    if(baseline==0) {
+        baseline = average;
+    } else if(average > 2*baseline) {
+        rate = std::max(maxRate/16,rate/2);
+        // follow a sustained change in the foreground latency slowly
+        baseline = 0.95*baseline + 0.05*average;
+        return;
+    } else {
+        baseline = 0.8*baseline + 0.2*average;
+    }
+    rate = std::min(maxRate,rate+maxRate/10);
+}
+
+RateLimiterStats RateLimiter::getStats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return RateLimiterStats{.bytes = bytes, .throttledRequests = throttledRequests, .throttledMicros = throttledMicros, .rate = rate};
+}
+
+#if defined(__linux__) && defined(SYS_ioprio_set)
+static const int ioprioWhoProcess = 1;
+static const int ioprioClassShift = 13;
+static const int ioprioClassBestEffort = 2;
+static const int ioprioLowest = 7;
+#endif
+
+BackgroundIO::BackgroundIO() {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    // a thread id of 0 is the calling thread
+    previous = syscall(SYS_ioprio_get,ioprioWhoProcess,0);
+    syscall(SYS_ioprio_set,ioprioWhoProcess,0,(ioprioClassBestEffort << ioprioClassShift) | ioprioLowest);
+#elif defined(__APPLE__)
+    previous = getiopolicy_np(IOPOL_TYPE_DISK,IOPOL_SCOPE_THREAD);
+    setiopolicy_np(IOPOL_TYPE_DISK,IOPOL_SCOPE_THREAD,IOPOL_THROTTLE);
+#endif
+}
+
+BackgroundIO::~BackgroundIO() {
+    if(previous < 0) return;
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    syscall(SYS_ioprio_set,ioprioWhoProcess,0,previous);
+#elif defined(__APPLE__)
+    setiopolicy_np(IOPOL_TYPE_DISK,IOPOL_SCOPE_THREAD,previous);
+#endif
+}
@@ -0,0 +1,84 @@
+#define BOOST_TEST_MODULE ratelimiter
+#include <boost/test/included/unit_test.hpp>
+
+#include <chrono>
+#include <thread>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "ratelimiter.h"
+
+using namespace std::chrono;
+
+BOOST_AUTO_TEST_CASE( ratelimiter_rate ) {
+    RateLimiter limiter(10*1024*1024);
+    auto start = steady_clock::now();
+    for(int i=0;i<5;i++) limiter.request(1024*1024);
+    auto elapsed = duration_cast<milliseconds>(steady_clock::now()-start).count();
+    // the first request only waits for its own deficit
+    BOOST_TEST(elapsed >= 400);
+    BOOST_TEST(elapsed < 2000);
+    auto stats = limiter.getStats();
+    BOOST_TEST(stats.bytes==5*1024*1024);
+    BOOST_TEST(stats.throttledRequests==5);
+    BOOST_TEST(stats.throttledMicros >= 400000);
+    BOOST_TEST(stats.rate==10*1024*1024);
+}
+
+BOOST_AUTO_TEST_CASE( ratelimiter_autotune ) {
+    RateLimiter limiter(16*1024*1024,true);
+    int sampled = 0;
+    for(int i=0;i<32;i++) {
+        if(limiter.sampleLatency()) sampled++;
+    }
+    BOOST_TEST(sampled==2);
+
+    auto run = [&](microseconds latency,milliseconds duration) {
+        auto start = steady_clock::now();
+        while(steady_clock::now()-start < duration) {
+            limiter.recordLatency(latency);
+            std::this_thread::sleep_for(milliseconds(10));
+        }
+    };
+    // establish the baseline, then a latency spike backs off
+    run(microseconds(100),milliseconds(1100));
+    BOOST_TEST(limiter.getStats().rate==16*1024*1024);
+    run(microseconds(1000),milliseconds(1100));
+    auto backedOff = limiter.getStats().rate;
+    BOOST_TEST(backedOff <= 8*1024*1024);
+    BOOST_TEST(backedOff >= 1024*1024);
+    // recovers while the latency is normal
+    run(microseconds(100),milliseconds(2100));
+    BOOST_TEST(limiter.getStats().rate > backedOff);
+
+    RateLimiter fixed(1024,false);
+    BOOST_TEST(!fixed.sampleLatency());
+}
+
+#if defined(__linux__) && defined(SYS_ioprio_set)
+// the IO priority of the calling thread
+static int ioPriority() { return syscall(SYS_ioprio_get,1,0); }
+#else
+static int ioPriority() { return -1; }
+#endif
+
+BOOST_AUTO_TEST_CASE( ratelimiter_background_io ) {
+    int before = ioPriority();
+    // the lowest best effort priority, where the platform supports IO priorities
+    const int lowest = (2 << 13) | 7;
+    {
+        BackgroundIO background;
+        if(before >= 0) BOOST_TEST(ioPriority()==lowest);
+        int nested = -1;
+        std::thread t([&](){
+            BackgroundIO background;
+            nested = ioPriority();
+        });
+        t.join();
+        if(before >= 0) BOOST_TEST(nested==lowest);
+    }
+    BOOST_TEST(ioPriority()==before);
+}
@@ -0,0 +1,138 @@
+#include <algorithm>
+
+#include "scheduler.h"
+#include "ratelimiter.h"
+
+JobScheduler::JobScheduler(int nthreads,int flushThreads)
+    : mergeThreads(std::max(nthreads-flushThreads,1)) {
+    nthreads = std::max(nthreads,1);
+    for(int i=0;i<nthreads;i++) {
+        threads.emplace_back([this]{ run(); });
+    }
+}
+
+JobScheduler::~JobScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cv.notify_all();
+    for(auto& thread : threads) thread.join();
+}
+
+void JobScheduler::enqueue(const void* owner,JobPriority priority,Job job) {
+    auto& queue = queues[int(priority)];
+    auto& jobs = queue.jobs[owner];
+    if(jobs.empty()) queue.owners.push_back(owner);
+    jobs.push_back(std::move(job));
+}
+
+void JobScheduler::schedule(const void* owner,JobPriority priority,Job job) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        enqueue(owner,priority,std::move(job));
+    }
+    cv.notify_one();
+}
+
+void JobScheduler::scheduleAfter(const void* owner,JobPriority priority,std::chrono::milliseconds delay,Job job) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        timers.emplace(std::chrono::steady_clock::now()+delay,TimedJob{owner,priority,std::move(job)});
+    }
+    // a waiting thread must wake up by the new deadline
+    cv.notify_one();
+}
+
+void JobScheduler::queueTimers(bool all) {
+    auto now = std::chrono::steady_clock::now();
+    while(!timers.empty() && (all || timers.begin()->first <= now)) {
+        auto& timed = timers.begin()->second;
+        enqueue(timed.owner,timed.priority,std::move(timed.job));
+        timers.erase(timers.begin());
+    }
+}
+
+void JobScheduler::drain(const void* owner) {
+    std::vector<Job> drained;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for(auto& queue : queues) {
+            auto itr = queue.jobs.find(owner);
+            if(itr==queue.jobs.end()) continue;
+            for(auto& job : itr->second) drained.push_back(std::move(job));
+            queue.jobs.erase(itr);
+            queue.owners.erase(std::find(queue.owners.begin(),queue.owners.end(),owner));
+        }
+        for(auto itr = timers.begin();itr!=timers.end();) {
+            if(itr->second.owner!=owner) {
+                itr++;
+                continue;
+            }
+            drained.push_back(std::move(itr->second.job));
+            itr = timers.erase(itr);
+        }
+    }
+    for(auto& job : drained) job();
+}
+
+/**
+ * @brief take the next job that may run, serving the owners of a priority in turn
+ */
+bool JobScheduler::next(Job& job,bool& merge) {
+    for(int priority=0;priority<priorities;priority++) {
+        auto& queue = queues[priority];
+        if(queue.owners.empty()) continue;
+        merge = priority!=int(JobPriority::flush);
+        if(merge && runningMerges >= mergeThreads) return false;
+
+        auto owner = queue.owners.front();
+        queue.owners.pop_front();
+        auto& jobs = queue.jobs[owner];
+        job = std::move(jobs.front());
+        jobs.pop_front();
+        if(jobs.empty()) {
+            queue.jobs.erase(owner);
+        } else {
+            queue.owners.push_back(owner);
+        }
+        if(merge) runningMerges++;
+        return true;
+    }
+    return false;
+}
+
+void JobScheduler::run() {
+    BackgroundIO background;
+    std::unique_lock<std::mutex> lock(mtx);
+    while(true) {
+        // queued and delayed jobs are run before stopping
+        queueTimers(stop);
+        Job job;
+        bool merge;
+        if(!next(job,merge)) {
+            if(stop && std::all_of(std::begin(queues),std::end(queues),[](auto& queue){ return queue.owners.empty(); })) return;
+            if(timers.empty()) {
+                cv.wait(lock);
+            } else {
+                cv.wait_until(lock,timers.begin()->first);
+            }
+            continue;
+        }
+        lock.unlock();
+        job();
+        // the captures are released without the lock, since releasing a segment may schedule its
+        // deletion
+        job = nullptr;
+        lock.lock();
+        if(merge) {
+            runningMerges--;
+            cv.notify_all();
+        }
+    }
+}
+
+std::shared_ptr<JobScheduler> JobScheduler::shared() {
+    static auto scheduler = std::make_shared<JobScheduler>(std::max((int)std::thread::hardware_concurrency(),2));
+    return scheduler;
+}
@@ -0,0 +1,133 @@
+#define BOOST_TEST_MODULE scheduler
+#include <boost/test/included/unit_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "scheduler.h"
+#include "waitgroup.h"
+
+using namespace std::chrono;
+
+/**
+ * @brief occupy the threads of the scheduler until released, so that jobs queue up
+ */
+struct Blocker {
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool released = false;
+    void wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock,[this]{ return released; });
+    }
+    void release() {
+        std::lock_guard<std::mutex> lock(mtx);
+        released = true;
+        cv.notify_all();
+    }
+};
+
+BOOST_AUTO_TEST_CASE( scheduler_priority ) {
+    JobScheduler scheduler(1,0);
+    Blocker blocker;
+    WaitGroup wg;
+    std::mutex mtx;
+    std::string order;
+    auto job = [&](char c) {
+        return [&,c]() {
+            std::lock_guard<std::mutex> lock(mtx);
+            order += c;
+            wg.done();
+        };
+    };
+
+    int a, b;
+    wg.add(7);
+    scheduler.schedule(&a,JobPriority::merge,[&]{ blocker.wait(); wg.done(); });
+    std::this_thread::sleep_for(milliseconds(50));
+    scheduler.schedule(&a,JobPriority::merge,job('m'));
+    scheduler.schedule(&a,JobPriority::level0,job('l'));
+    scheduler.schedule(&a,JobPriority::flush,job('f'));
+    // the owners of a priority are served in turn
+    scheduler.schedule(&a,JobPriority::merge,job('a'));
+    scheduler.schedule(&a,JobPriority::merge,job('a'));
+    scheduler.schedule(&b,JobPriority::merge,job('b'));
+    blocker.release();
+    wg.waitEmpty();
+    BOOST_TEST(order=="flmbaa");
+}
+
+BOOST_AUTO_TEST_CASE( scheduler_flush_threads ) {
+    JobScheduler scheduler(2,1);
+    Blocker blocker;
+    WaitGroup wg;
+    std::atomic<int> merges{0};
+    int a;
+
+    // a long merge does not delay the next merge past the flush
+    wg.add(3);
+    scheduler.schedule(&a,JobPriority::merge,[&]{ merges++; blocker.wait(); wg.done(); });
+    scheduler.schedule(&a,JobPriority::merge,[&]{ merges++; wg.done(); });
+    std::this_thread::sleep_for(milliseconds(50));
+    BOOST_TEST(merges==1);
+
+    std::atomic<bool> flushed{false};
+    scheduler.schedule(&a,JobPriority::flush,[&]{ flushed = true; wg.done(); });
+    auto start = steady_clock::now();
+    while(!flushed && steady_clock::now()-start < seconds(5)) std::this_thread::sleep_for(milliseconds(1));
+    BOOST_TEST(flushed);
+    BOOST_TEST(merges==1);
+
+    blocker.release();
+    wg.waitEmpty();
+    BOOST_TEST(merges==2);
+}
+
+BOOST_AUTO_TEST_CASE( scheduler_drain ) {
+    JobScheduler scheduler(1,0);
+    Blocker blocker;
+    WaitGroup wg;
+    int a, b;
+    std::atomic<int> ran{0};
+
+    wg.add(1);
+    scheduler.schedule(&b,JobPriority::merge,[&]{ blocker.wait(); wg.done(); });
+    scheduler.schedule(&a,JobPriority::merge,[&]{ ran++; });
+    scheduler.schedule(&a,JobPriority::flush,[&]{ ran++; });
+
+    // the queued jobs of the owner run on the calling thread, without waiting for the blocked job
+    scheduler.drain(&a);
+    BOOST_TEST(ran==2);
+
+    blocker.release();
+    wg.waitEmpty();
+}
+
+BOOST_AUTO_TEST_CASE( scheduler_delayed ) {
+    JobScheduler scheduler(1,0);
+    WaitGroup wg;
+    std::mutex mtx;
+    std::string order;
+    int a, b;
+
+    // delayed jobs are queued in the order they are due
+    wg.add(2);
+    auto start = steady_clock::now();
+    scheduler.scheduleAfter(&a,JobPriority::scrub,milliseconds(200),[&]{ std::lock_guard<std::mutex> lock(mtx); order += 's'; wg.done(); });
+    scheduler.scheduleAfter(&a,JobPriority::merge,milliseconds(100),[&]{ std::lock_guard<std::mutex> lock(mtx); order += 'm'; wg.done(); });
+    wg.waitEmpty();
+    BOOST_TEST(order=="ms");
+    BOOST_TEST((steady_clock::now()-start >= milliseconds(200)));
+
+    // a drain runs the delayed jobs of the owner without waiting for them to be due
+    std::atomic<int> ran{0};
+    scheduler.scheduleAfter(&a,JobPriority::scrub,seconds(60),[&]{ ran++; });
+    scheduler.scheduleAfter(&b,JobPriority::scrub,seconds(60),[&]{ ran += 10; });
+    start = steady_clock::now();
+    scheduler.drain(&a);
+    BOOST_TEST(ran==1);
+    BOOST_TEST((steady_clock::now()-start < seconds(10)));
+    scheduler.drain(&b);
+    BOOST_TEST(ran==11);
+}
@@ -0,0 +1,111 @@
+#include <chrono>
+#include <algorithm>
+
+#include "scrubber.h"
+#include "database.h"
+#include "disksegment.h"
+#include "partitionedsegment.h"
+
+void Scrubber::start(Database* db) {
+    schedule(db,std::chrono::seconds(db->options.scrubIntervalSeconds));
+}
+
+void Scrubber::schedule(Database* db,std::chrono::milliseconds delay) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if(stopped) return;
+    db->wg.add(1);
+    db->options.scheduler->scheduleAfter(db,JobPriority::scrub,delay,[this,db]() {
+        WaitGroupDone done(db->wg);
+        if(db->closing || db->err) return;
+        bool more;
+        try {
+            more = scrub(db,true);
+        } catch(std::exception& ex) {
+            db->err = &ex;
+            return;
+        }
+        // a pass limited by the rate continues after a tenth of a second
+        if(more) schedule(db,std::chrono::milliseconds(100));
+        else schedule(db,std::chrono::seconds(db->options.scrubIntervalSeconds));
+    });
+}
+
+void Scrubber::stop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    stopped = true;
+}
+
+bool Scrubber::scrub(Database* db,bool throttle) {
+    std::unique_lock<std::mutex> lock(scrubber);
+
+    // the bytes that may be verified in each tenth of a second
+    const uint64_t budget = std::max(db->options.scrubBytesPerSecond / 10, 1);
+    uint64_t used = 0;
+
+    std::vector<std::pair<uint64_t,SegmentRef>> segments;
+    for(auto s : db->getState()->segments) {
+        std::vector<SegmentRef> parts{s};
+        if(auto ps = dynamic_cast<PartitionedSegment*>(s.get())) parts = ps->getPartitions();
+        for(auto& p : parts) {
+            auto ds = dynamic_cast<DiskSegment*>(p.get());
+            if(ds!=nullptr) segments.push_back({ds->lastAccess(),p});
+        }
+    }
+    // the least recently read segments are scrubbed first, since reads are less likely to have
+    // verified their blocks or to detect their corruption
+    std::stable_sort(segments.begin(),segments.end(),[](auto& a,auto& b) { return a.first < b.first; });
+    // but the segment an earlier pass stopped in is finished first
+    std::stable_partition(segments.begin(),segments.end(),[this](auto& entry) {
+        return ((DiskSegment*)entry.second.get())->files()[0]==resumeFile;
+    });
+    for(auto& [lastAccess,s] : segments) {
+        auto ds = (DiskSegment*)s.get();
+        if(!ds->hasChecksums() || ds->isVerified()) continue;
+        auto file = ds->files()[0];
+        {
+            std::unique_lock<std::mutex> lock(statsMtx);
+            if(corrupt.count(file)) continue;
+        }
+        int64_t block = 0;
+        uint64_t blocks = 0, bytes = 0, corruptBlocks = 0;
+        if(file==resumeFile) {
+            block = resumeBlock;
+            corruptBlocks = resumeCorruptBlocks;
+        }
+        resumeFile.clear();
+        for(;block<ds->blockCount();block++) {
+            if(throttle && used >= budget) {
+                resumeFile = file;
+                resumeBlock = block;
+                resumeCorruptBlocks = corruptBlocks;
+                std::unique_lock<std::mutex> lock(statsMtx);
+                stats.blocksScrubbed += blocks;
+                stats.bytesScrubbed += bytes;
+                return true;
+            }
+            uint64_t n;
+            bool valid = ds->verifyBlock(block,&n);
+            // a block verified by an earlier read is not read again
+            if(n==0) continue;
+            if(!valid) corruptBlocks++;
+            blocks++;
+            bytes += n;
+            used += n;
+        }
+        std::unique_lock<std::mutex> lock(statsMtx);
+        stats.segmentsScrubbed++;
+        stats.blocksScrubbed += blocks;
+        stats.bytesScrubbed += bytes;
+        if(corruptBlocks>0) {
+            stats.corruptBlocks += corruptBlocks;
+            stats.corruptFiles.push_back(file);
+            corrupt.insert(file);
+        }
+    }
+    return false;
+}
+
+ScrubStats Scrubber::getStats() {
+    std::unique_lock<std::mutex> lock(statsMtx);
+    return stats;
+}
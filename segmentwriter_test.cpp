@@ -0,0 +1,127 @@
+#define BOOST_TEST_MODULE segmentwriter
+#include <boost/test/included/unit_test.hpp>
+
+#include <filesystem>
+
+#include "segmentwriter.h"
+#include "diskio.h"
+#include "exceptions.h"
+
+namespace fs = std::filesystem;
+
+static const std::string dir = "test/segmentwriter";
+
+static std::string key(int i) {
+    auto digits = std::to_string(i);
+    return "mykey"+std::string(6-digits.length(),'0')+digits;
+}
+
+BOOST_AUTO_TEST_CASE( segmentwriter ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    SegmentWriter writer(dir+"/segment.1.1");
+    for(int i=0;i<20000;i++) {
+        if(i%10==0) {
+            writer.remove(key(i));
+        } else {
+            writer.put(key(i),"myvalue"+std::to_string(i));
+        }
+    }
+    BOOST_TEST(writer.count()==20000);
+    // the file is written under a temporary name until it is finished
+    BOOST_TEST(!fs::exists(dir+"/segment.1.1"));
+    auto keyIndex = writer.finish();
+    BOOST_TEST(!fs::exists(dir+"/segment.1.1.keys.tmp"));
+    BOOST_TEST(!fs::exists(dir+"/segment.1.1.tmp"));
+
+    auto segment = DiskSegment::newDiskSegment(dir+"/segment.1.1",{});
+    auto ds = (DiskSegment*)segment.get();
+    BOOST_REQUIRE(ds->getKeyIndex().size()==keyIndex.size());
+    BOOST_TEST(ds->getKeyIndex()[0].compareTo(key(0))==0);
+    BOOST_TEST(segment->get(key(12345)).compareTo("myvalue12345")==0);
+    BOOST_TEST(ds->lastKey().compareTo(key(19999))==0);
+    uint64_t entries,deletes;
+    segment->entryCounts(&entries,&deletes);
+    BOOST_TEST(entries==20000);
+    BOOST_TEST(deletes==2000);
+
+    // the deletions are returned by a raw lookup as empty values
+    auto itr = segment->lookupRaw(Slice(),Slice());
+    int count = 0;
+    KeyValue kv;
+    while(!itr->next(kv).key.empty()) {
+        BOOST_TEST(kv.value.empty()==(count%10==0));
+        count++;
+    }
+    BOOST_TEST(count==20000);
+}
+
+BOOST_AUTO_TEST_CASE( segmentwriter_order ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    SegmentWriter writer(dir+"/segment.1.1");
+    writer.put("mykey2","myvalue2");
+    BOOST_CHECK_THROW(writer.put("mykey1","myvalue1"),IllegalState);
+    BOOST_CHECK_THROW(writer.put("mykey2","myvalue2"),IllegalState);
+    BOOST_CHECK_THROW(writer.remove(""),EmptyKey);
+    writer.put("mykey3","myvalue3");
+    writer.finish();
+    BOOST_CHECK_THROW(writer.put("mykey4","myvalue4"),IllegalState);
+
+    auto segment = DiskSegment::newDiskSegment(dir+"/segment.1.1",{});
+    BOOST_TEST(segment->get("mykey3").compareTo("myvalue3")==0);
+    BOOST_TEST(segment->get("mykey1").empty());
+}
+
+BOOST_AUTO_TEST_CASE( segmentwriter_options ) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    Options options;
+    options.compression = compressionLZ;
+    options.blockSize = 0;
+    BOOST_CHECK_THROW(SegmentWriter(dir+"/segment.1.1",options),IllegalState);
+    BOOST_TEST(!fs::exists(dir+"/segment.1.1"));
+
+    options.blockSize = 8192;
+    {
+        SegmentWriter writer(dir+"/segment.1.1",options);
+        for(int i=0;i<1000;i++) writer.put(key(i),std::string(100,'a'+i%26));
+        writer.finish();
+    }
+    auto segment = DiskSegment::newDiskSegment(dir+"/segment.1.1",{});
+    auto metadata = ((DiskSegment*)segment.get())->getMetadata();
+    BOOST_TEST(metadata.compression==compressionLZ);
+    BOOST_TEST(metadata.blockSize==8192);
+    BOOST_TEST(segment->get(key(27)).compareTo(std::string(100,'b'))==0);
+
+    // a writer that is not finished removes its files
+    {
+        SegmentWriter writer(dir+"/segment.2.2",options);
+        writer.put("mykey","myvalue");
+    }
+    BOOST_TEST(!fs::exists(dir+"/segment.2.2"));
+    BOOST_TEST(!fs::exists(dir+"/segment.2.2.tmp"));
+    BOOST_TEST(!fs::exists(dir+"/segment.2.2.keys.tmp"));
+
+    // and leaves an existing file unchanged, while a finished writer replaces it with a new file
+    auto size = fs::file_size(dir+"/segment.1.1");
+    fs::create_hard_link(dir+"/segment.1.1",dir+"/segment.3.3");
+    {
+        SegmentWriter writer(dir+"/segment.1.1",options);
+        writer.put("mykey","myvalue");
+    }
+    BOOST_TEST(fs::file_size(dir+"/segment.1.1")==size);
+    {
+        SegmentWriter writer(dir+"/segment.1.1",options);
+        writer.put("mykey","myvalue");
+        writer.finish();
+    }
+    BOOST_TEST(fs::hard_link_count(dir+"/segment.3.3")==1);
+    BOOST_TEST(fs::file_size(dir+"/segment.3.3")==size);
+    segment = DiskSegment::newDiskSegment(dir+"/segment.3.3",{});
+    BOOST_TEST(segment->get(key(27)).compareTo(std::string(100,'b'))==0);
+    fs::remove_all(dir);
+}
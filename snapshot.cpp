@@ -1,6 +1,12 @@
+#include <mutex>
+
 #include "database.h"
 #include "bytebuffer.h"
 #include "exceptions.h"
+#include "multisegment.h"
+#include "disksegment.h"
+#include "partitionedsegment.h"
+#include "compactionfilter.h"
 
 ByteBuffer Snapshot::get(const Slice& key) {
     ByteBuffer buffer;
@@ -8,11 +14,59 @@ ByteBuffer Snapshot::get(const Slice& key) {
 }
 
 ByteBuffer& Snapshot::get(const Slice& key,ByteBuffer& value) {
-    if(multi.get()==nullptr) throw SnapshotClosed();
-    return multi->get(key,value);
+    return get(key,value,ReadOptions());
 }
 
 LookupRef Snapshot::lookup(const Slice& lower,const Slice& upper) {
+    return lookup(lower,upper,ReadOptions());
+}
+
+ByteBuffer& Snapshot::get(const Slice& key,ByteBuffer& value,const ReadOptions& options) {
+    if(multi.get()==nullptr) throw SnapshotClosed();
+    multi->get(key,value,options);
+    auto ttl = db->options.ttlSeconds;
+    if(ttl > 0) removeWriteTime(value,ttl,currentWriteTime());
+    return value;
+}
+
+LookupRef Snapshot::lookup(const Slice& lower,const Slice& upper,const ReadOptions& options) {
+    if(multi.get()==nullptr) throw SnapshotClosed();
+    auto itr = multi->lookup(lower,upper,options);
+    auto ttl = db->options.ttlSeconds;
+    if(ttl > 0) return LookupRef(new TtlIterator(std::move(itr),ttl));
+    return itr;
+}
+
+void Snapshot::parallelScan(const Slice& lower,const Slice& upper,int nThreads,const std::function<void(const KeyValue&)>& callback) {
     if(multi.get()==nullptr) throw SnapshotClosed();
-    return multi->lookup(lower,upper);
-}
\ No newline at end of file
+
+    auto splits = splitRange(((MultiSegment*)multi.get())->getSegments(),lower,upper,nThreads);
+
+    std::vector<ByteBuffer> bounds;
+    bounds.push_back(lower);
+    for(auto& split : splits) bounds.push_back(split);
+    bounds.push_back(upper);
+
+    // the upper bound of a lookup is inclusive, so all but the last partition skip their upper bound
+    auto scan = [this,&callback](const ByteBuffer& from,const ByteBuffer& to,bool last) {
+        auto itr = lookup(from,to);
+        KeyValue kv;
+        while(true) {
+            itr->next(kv);
+            if(kv.key.empty()) return;
+            if(!last && kv.key.compareTo(to)==0) return;
+            if(kv.value.empty()) continue;
+            callback(kv);
+        }
+    };
+
+    int partitions = bounds.size()-1;
+    if(partitions==1) {
+        scan(bounds[0],bounds[1],true);
+        return;
+    }
+
+    Database::executor.parallelFor(partitions,[&](int i) {
+        scan(bounds[i],bounds[i+1],i==partitions-1);
+    });
+}
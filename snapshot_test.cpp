@@ -21,3 +21,35 @@ BOOST_AUTO_TEST_CASE( snapshot ) {
     BOOST_TEST(s->get("mykey")=="myvalue");
     BOOST_TEST(s->get("mykey1").empty());
 }
+
+BOOST_AUTO_TEST_CASE( snapshot_parallel_scan ) {
+    Options options(true);
+    options.disableAutoMerge=true;
+
+    try { Database::remove("test/mydb"); } catch(DatabaseNotFound){}
+
+    auto db = Database::open("test/mydb",options);
+    for(int i=0;i<200000;i++) {
+        char key[16];
+        snprintf(key,sizeof(key),"mykey%07d",i);
+        db->put(key,"myvalue"+std::to_string(i));
+    }
+    db->closeWithMerge(1);
+    db = Database::open("test/mydb",options);
+    db->remove(Slice("mykey0000010"));
+    db->put("mykey9999999","myvalue");
+
+    auto s = db->snapshot();
+    std::atomic<int> count{0};
+    s->parallelScan("","",4,[&](const KeyValue& kv) {
+        count++;
+    });
+    BOOST_TEST(count==200000);
+
+    count=0;
+    s->parallelScan("mykey0001000","mykey0100999",4,[&](const KeyValue& kv) {
+        count++;
+    });
+    BOOST_TEST(count==100000);
+    db->close();
+}
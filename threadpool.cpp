@@ -0,0 +1,187 @@
+#include <algorithm>
+
+#include "threadpool.h"
+
+bool WorkDeque::push(Task* task) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if(b-t >= capacity) return false;
+    slots[b % capacity].store(task,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b+1,std::memory_order_relaxed);
+    return true;
+}
+
+Task* WorkDeque::pop() {
+    int64_t b = bottom.load(std::memory_order_relaxed)-1;
+    bottom.store(b,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if(t > b) {
+        bottom.store(b+1,std::memory_order_relaxed);
+        return nullptr;
+    }
+    Task* task = slots[b % capacity].load(std::memory_order_relaxed);
+    if(t==b) {
+        // the last task, which a thief may be taking
+        if(!top.compare_exchange_strong(t,t+1,std::memory_order_seq_cst,std::memory_order_relaxed)) task = nullptr;
+        bottom.store(b+1,std::memory_order_relaxed);
+    }
+    return task;
+}
+
+Task* WorkDeque::steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if(t >= b) return nullptr;
+    Task* task = slots[t % capacity].load(std::memory_order_relaxed);
+    if(!top.compare_exchange_strong(t,t+1,std::memory_order_seq_cst,std::memory_order_relaxed)) return nullptr;
+    return task;
+}
+
+// the worker running on the current thread, and its pool
+static thread_local void* threadPool = nullptr;
+static thread_local void* threadWorker = nullptr;
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    num_threads = std::max(num_threads,(size_t)1);
+    for(size_t i=0;i<num_threads;i++) workers.push_back(std::make_unique<Worker>());
+    for(auto& worker : workers) {
+        worker->thread = std::thread([this,w = worker.get()]{ run(w); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cv.notify_all();
+    for(auto& worker : workers) worker->thread.join();
+}
+
+ThreadPool::Worker* ThreadPool::currentWorker() {
+    return threadPool==this ? (Worker*)threadWorker : nullptr;
+}
+
+void ThreadPool::submit(Task* tasks,int n) {
+    if(n==0) return;
+    auto self = currentWorker();
+    int pushed = 0;
+    if(self) {
+        while(pushed<n && self->deque.push(&tasks[pushed])) pushed++;
+    }
+    if(pushed<n) {
+        std::lock_guard<std::mutex> lock(mtx);
+        for(int i=pushed;i<n;i++) injected.push_back(&tasks[i]);
+        injectedCount += n-pushed;
+    }
+    // a worker going to sleep checks for work after announcing it, see run() and join()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleeping.load() > 0 || parked.load() > 0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if(n==1) cv.notify_one(); else cv.notify_all();
+        if(parked.load() > 0) joined.notify_all();
+    }
+}
+
+/**
+ * @brief take a task from the worker's own deque, then from the tasks of other threads, then
+ * steal from the other workers starting at a random one
+ */
+Task* ThreadPool::find(Worker* self,unsigned& seed) {
+    if(self) {
+        if(auto task = self->deque.pop()) return task;
+    }
+    if(injectedCount.load() > 0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if(!injected.empty()) {
+            auto task = injected.front();
+            injected.pop_front();
+            injectedCount--;
+            return task;
+        }
+    }
+    seed = seed*1103515245 + 12345;
+    int n = workers.size();
+    int start = (seed >> 16) % n;
+    for(int i=0;i<n;i++) {
+        auto worker = workers[(start+i) % n].get();
+        if(worker==self) continue;
+        if(auto task = worker->deque.steal()) return task;
+    }
+    return nullptr;
+}
+
+bool ThreadPool::hasWork() {
+    if(!injected.empty()) return true;
+    for(auto& worker : workers) {
+        if(!worker->deque.empty()) return true;
+    }
+    return false;
+}
+
+void ThreadPool::execute(Task* task) {
+    auto pending = task->pending;
+    task->run();
+    // the task and its counter belong to the forking thread, which may return once it is 0
+    if(pending->fetch_sub(1)==1) {
+        std::lock_guard<std::mutex> lock(mtx);
+        joined.notify_all();
+    }
+}
+
+void ThreadPool::run(Worker* self) {
+    threadPool = this;
+    threadWorker = self;
+    unsigned seed = std::hash<std::thread::id>()(std::this_thread::get_id());
+    while(true) {
+        if(auto task = find(self,seed)) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mtx);
+        sleeping++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!hasWork()) {
+            if(stop) {
+                sleeping--;
+                return;
+            }
+            cv.wait(lock);
+        }
+        sleeping--;
+    }
+}
+
+void ThreadPool::join(std::atomic<int>& pending) {
+    auto self = currentWorker();
+    if(self) {
+        // run other tasks while the forked ones are running, rather than blocking a worker
+        unsigned seed = 0;
+        int failures = 0;
+        while(pending.load() > 0) {
+            if(auto task = find(self,seed)) {
+                execute(task);
+                failures = 0;
+                continue;
+            }
+            if(++failures < joinSpins) {
+                std::this_thread::yield();
+                continue;
+            }
+            // the forked tasks are running on other workers, so block until they finish or more
+            // tasks are submitted
+            std::unique_lock<std::mutex> lock(mtx);
+            parked++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(pending.load() > 0 && !hasWork()) joined.wait(lock);
+            parked--;
+            failures = 0;
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    joined.wait(lock,[&]{ return pending.load()==0; });
+}
@@ -0,0 +1,110 @@
+#define BOOST_TEST_MODULE threadpool
+#include <boost/test/included/unit_test.hpp>
+
+#include <chrono>
+#include <ctime>
+#include <set>
+#include <stdexcept>
+
+#include "threadpool.h"
+
+BOOST_AUTO_TEST_CASE( threadpool_deque ) {
+    WorkDeque deque;
+    Task tasks[3];
+    BOOST_TEST(deque.empty());
+    for(auto& task : tasks) BOOST_TEST(deque.push(&task));
+    // the owner pops the newest, thieves take the oldest
+    BOOST_TEST(deque.pop()==&tasks[2]);
+    BOOST_TEST(deque.steal()==&tasks[0]);
+    BOOST_TEST(deque.pop()==&tasks[1]);
+    BOOST_TEST(deque.pop()==nullptr);
+    BOOST_TEST(deque.steal()==nullptr);
+    BOOST_TEST(deque.empty());
+}
+
+BOOST_AUTO_TEST_CASE( threadpool_deque_concurrent ) {
+    WorkDeque deque;
+    const int n = 100000;
+    std::vector<Task> tasks(n);
+    std::vector<std::atomic<int>> taken(n);
+    std::atomic<bool> done{false};
+
+    // every task is taken exactly once, by the owner or one of the thieves
+    auto thief = [&]() {
+        while(!done) {
+            if(auto task = deque.steal()) taken[task-tasks.data()]++;
+        }
+    };
+    std::thread t1(thief), t2(thief);
+    for(int i=0;i<n;i++) {
+        while(!deque.push(&tasks[i])) {
+            if(auto task = deque.pop()) taken[task-tasks.data()]++;
+        }
+        if(i%3==0) {
+            if(auto task = deque.pop()) taken[task-tasks.data()]++;
+        }
+    }
+    while(auto task = deque.pop()) taken[task-tasks.data()]++;
+    while(!deque.empty()) std::this_thread::yield();
+    done = true;
+    t1.join();
+    t2.join();
+    int once = 0;
+    for(auto& count : taken) if(count==1) once++;
+    BOOST_TEST(once==n);
+}
+
+BOOST_AUTO_TEST_CASE( threadpool_task ) {
+    int value = 0;
+    std::atomic<int> pending{1};
+    Task task;
+    task.set([&value]() { value = 42; },&pending);
+    task.run();
+    BOOST_TEST(value==42);
+}
+
+BOOST_AUTO_TEST_CASE( threadpool_parallel_for ) {
+    ThreadPool pool(4);
+    std::vector<int> results(1000);
+    pool.parallelFor(results.size(),[&](int i) { results[i] = i*2; });
+    for(int i=0;i<results.size();i++) BOOST_TEST(results[i]==i*2);
+
+    pool.parallelFor(0,[&](int i) { BOOST_FAIL("not called"); });
+}
+
+BOOST_AUTO_TEST_CASE( threadpool_nested ) {
+    // a single worker joining a nested fork runs the forked tasks itself
+    ThreadPool pool(1);
+    std::atomic<int> sum{0};
+    pool.parallelFor(8,[&](int i) {
+        pool.parallelFor(8,[&](int j) { sum += i*8+j; });
+    });
+    BOOST_TEST(sum==63*64/2);
+}
+
+BOOST_AUTO_TEST_CASE( threadpool_exception ) {
+    ThreadPool pool(2);
+    std::atomic<int> ran{0};
+    BOOST_CHECK_THROW(pool.parallelFor(10,[&](int i) {
+        ran++;
+        if(i==3) throw std::runtime_error("failed");
+    }),std::runtime_error);
+    // the other tasks still run before the exception is rethrown
+    BOOST_TEST(ran==10);
+}
+
+BOOST_AUTO_TEST_CASE( threadpool_join_blocks ) {
+    // a worker joining tasks that run for a while on other workers blocks rather than spinning
+    ThreadPool pool(4);
+    std::atomic<int> sum{0};
+    auto start = std::clock();
+    pool.parallelFor(2,[&](int i) {
+        pool.parallelFor(4,[&](int j) {
+            if(j<3) std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            sum++;
+        });
+    });
+    double cpu = double(std::clock()-start)/CLOCKS_PER_SEC;
+    BOOST_TEST(sum==8);
+    BOOST_TEST(cpu < 0.2);
+}